@@ -403,18 +403,24 @@ int gunzip_main(int argc UNUSED_PARAM, char **argv)
  * Licensed under GPLv2 or later, see file LICENSE in this source tree.
  */
 //usage:#define bunzip2_trivial_usage
-//usage:       "[-cfk] [FILE]..."
+//usage:       "[-cfk]" IF_FEATURE_BZIP2_PARALLEL(" [-p N]") " [FILE]..."
 //usage:#define bunzip2_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
+//usage:	IF_FEATURE_BZIP2_PARALLEL(
+//usage:     "\n	-p N	Use N processes (0: one per CPU)"
+//usage:	)
 //usage:     "\n	-t	Test integrity"
 //usage:
 //usage:#define bzcat_trivial_usage
-//usage:       "[FILE]..."
+//usage:       IF_FEATURE_BZIP2_PARALLEL("[-p N] ") "[FILE]..."
 //usage:#define bzcat_full_usage "\n\n"
 //usage:       "Decompress to stdout"
+//usage:	IF_FEATURE_BZIP2_PARALLEL(
+//usage:     "\n\n	-p N	Use N processes (0: one per CPU)"
+//usage:	)
 
 //config:config BUNZIP2
 //config:	bool "bunzip2 (8.7 kb)"
@@ -441,14 +447,30 @@ int gunzip_main(int argc UNUSED_PARAM, char **argv)
 //                APPLET_ODDNAME:name   main     location        suid_type     help
 //applet:IF_BZCAT(APPLET_ODDNAME(bzcat, bunzip2, BB_DIR_USR_BIN, BB_SUID_DROP, bzcat))
 #if ENABLE_FEATURE_BZIP2_DECOMPRESS || ENABLE_BUNZIP2 || ENABLE_BZCAT
+# if ENABLE_FEATURE_BZIP2_PARALLEL
+static unsigned bunzip2_jobs; /* -p N */
+
+static IF_DESKTOP(long long) int FAST_FUNC unpack_bz2_parallel(transformer_state_t *xstate)
+{
+	return unpack_bz2_stream_parallel(xstate, bunzip2_jobs);
+}
+# endif
 int bunzip2_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int bunzip2_main(int argc UNUSED_PARAM, char **argv)
 {
-	getopt32(argv, BBUNPK_OPTSTR "dt");
+	IF_FEATURE_BZIP2_PARALLEL(bunzip2_jobs = 1;)
+	getopt32(argv, BBUNPK_OPTSTR "dt" IF_FEATURE_BZIP2_PARALLEL("p:+")
+			IF_FEATURE_BZIP2_PARALLEL(, &bunzip2_jobs));
 	argv += optind;
 	if (ENABLE_BZCAT && (!ENABLE_BUNZIP2 || applet_name[2] == 'c')) /* bzcat */
 		option_mask32 |= BBUNPK_OPT_STDOUT;
 
+# if ENABLE_FEATURE_BZIP2_PARALLEL
+	if (bunzip2_jobs == 0)
+		bunzip2_jobs = get_cpu_count();
+	if (bunzip2_jobs != 1)
+		return bbunpack(argv, unpack_bz2_parallel, make_new_name_generic, "bz2");
+# endif
 	return bbunpack(argv, unpack_bz2_stream, make_new_name_generic, "bz2");
 }
 #endif
@@ -536,16 +558,20 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 
 
 //usage:#define unxz_trivial_usage
-//usage:       "[-cfk] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_UNXZ_PARALLEL("] [-T N") "] [FILE]..."
 //usage:#define unxz_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
 //usage:     "\n	-t	Test integrity"
+//usage:	IF_FEATURE_UNXZ_PARALLEL(
+//usage:     "\n	-T N	Use N processes (0: one per CPU)"
+//usage:	)
 //usage:
+//usage:#if !ENABLE_FEATURE_XZ_COMPRESS
 //usage:#define xz_trivial_usage
-//usage:       "-d [-cfk] [FILE]..."
+//usage:       "-d [-cfk" IF_FEATURE_UNXZ_PARALLEL("] [-T N") "] [FILE]..."
 //usage:#define xz_full_usage "\n\n"
 //usage:       "Decompress FILEs (or stdin)\n"
 //usage:     "\n	-d	Decompress"
@@ -553,11 +579,18 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
 //usage:     "\n	-t	Test integrity"
+//usage:	IF_FEATURE_UNXZ_PARALLEL(
+//usage:     "\n	-T N	Use N processes (0: one per CPU)"
+//usage:	)
+//usage:#endif
 //usage:
 //usage:#define xzcat_trivial_usage
-//usage:       "[FILE]..."
+//usage:       IF_FEATURE_UNXZ_PARALLEL("[-T N] ") "[FILE]..."
 //usage:#define xzcat_full_usage "\n\n"
 //usage:       "Decompress to stdout"
+//usage:	IF_FEATURE_UNXZ_PARALLEL(
+//usage:     "\n\n	-T N	Use N processes (0: one per CPU)"
+//usage:	)
 
 //config:config UNXZ
 //config:	bool "unxz (13 kb)"
@@ -572,25 +605,49 @@ int unlzma_main(int argc UNUSED_PARAM, char **argv)
 //config:	Alias to "unxz -c".
 //config:
 //config:config XZ
-//config:	bool "xz -d"
+//config:	bool "xz"
 //config:	default y
 //config:	help
 //config:	Enable this option if you want commands like "xz -d" to work.
-//config:	IOW: you'll get xz applet, but it will always require -d option.
+//config:	Unless FEATURE_XZ_COMPRESS is also selected, the xz applet
+//config:	will always require -d option.
+//config:
+//config:config FEATURE_UNXZ_PARALLEL
+//config:	bool "Enable -T N (decompress in N processes)"
+//config:	default y
+//config:	depends on (UNXZ || XZCAT || XZ) && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	When a regular file holds more than one block (as made by
+//config:	xz -T N), find the blocks from the index at the end of
+//config:	the file and decompress up to N of them at once in child
+//config:	processes. Other input is decompressed as usual.
 
 //applet:IF_UNXZ(APPLET(unxz, BB_DIR_USR_BIN, BB_SUID_DROP))
 //                APPLET_ODDNAME:name   main  location        suid_type     help
 //applet:IF_XZCAT(APPLET_ODDNAME(xzcat, unxz, BB_DIR_USR_BIN, BB_SUID_DROP, xzcat))
-//applet:IF_XZ(   APPLET_ODDNAME(xz,    unxz, BB_DIR_USR_BIN, BB_SUID_DROP, xz))
+//applet:IF_XZ(IF_NOT_FEATURE_XZ_COMPRESS(APPLET_ODDNAME(xz, unxz, BB_DIR_USR_BIN, BB_SUID_DROP, xz)))
 //kbuild:lib-$(CONFIG_UNXZ) += bbunzip.o
 //kbuild:lib-$(CONFIG_XZCAT) += bbunzip.o
 //kbuild:lib-$(CONFIG_XZ) += bbunzip.o
 #if ENABLE_UNXZ || ENABLE_XZCAT || ENABLE_XZ
+# if ENABLE_FEATURE_UNXZ_PARALLEL
+static unsigned unxz_jobs; /* -T N */
+
+static IF_DESKTOP(long long) int FAST_FUNC unpack_xz_parallel(transformer_state_t *xstate)
+{
+	return unpack_xz_stream_parallel(xstate, unxz_jobs);
+}
+# endif
 int unxz_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int unxz_main(int argc UNUSED_PARAM, char **argv)
 {
-	IF_XZ(int opts =) getopt32(argv, BBUNPK_OPTSTR "dt");
-# if ENABLE_XZ
+	IF_XZ(IF_NOT_FEATURE_XZ_COMPRESS(int opts;))
+
+	IF_FEATURE_UNXZ_PARALLEL(unxz_jobs = 1;)
+	IF_XZ(IF_NOT_FEATURE_XZ_COMPRESS(opts =)) getopt32(argv, BBUNPK_OPTSTR "dt"
+			IF_FEATURE_UNXZ_PARALLEL("T:+")
+			IF_FEATURE_UNXZ_PARALLEL(, &unxz_jobs));
+# if ENABLE_XZ && !ENABLE_FEATURE_XZ_COMPRESS
 	/* xz without -d or -t? */
 	if (applet_name[2] == '\0' && !(opts & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)))
 		bb_show_usage();
@@ -600,6 +657,12 @@ int unxz_main(int argc UNUSED_PARAM, char **argv)
 		option_mask32 |= BBUNPK_OPT_STDOUT;
 
 	argv += optind;
+# if ENABLE_FEATURE_UNXZ_PARALLEL
+	if (unxz_jobs == 0)
+		unxz_jobs = get_cpu_count();
+	if (unxz_jobs != 1)
+		return bbunpack(argv, unpack_xz_parallel, make_new_name_generic, "xz");
+# endif
 	return bbunpack(argv, unpack_xz_stream, make_new_name_generic, "xz");
 }
 #endif
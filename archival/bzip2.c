@@ -44,13 +44,24 @@
 //config:	Enable -d (--decompress) and -t (--test) options for bzip2.
 //config:	This will be automatically selected if bunzip2 or bzcat is
 //config:	enabled.
+//config:
+//config:config FEATURE_BZIP2_PARALLEL
+//config:	bool "Enable -p N (use N processes)"
+//config:	default y
+//config:	depends on (BZIP2 || BUNZIP2 || BZCAT) && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	bzip2 compresses the input in pieces of one block each,
+//config:	up to N pieces at a time in child processes. The output is
+//config:	a series of complete bzip2 streams, as pbzip2 makes.
+//config:	bunzip2 and bzcat decompress up to N blocks at a time.
 
 //applet:IF_BZIP2(APPLET(bzip2, BB_DIR_USR_BIN, BB_SUID_DROP))
 
 //kbuild:lib-$(CONFIG_BZIP2) += bzip2.o
 
 //usage:#define bzip2_trivial_usage
-//usage:       "[-cfk" IF_FEATURE_BZIP2_DECOMPRESS("dt") "123456789] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_BZIP2_DECOMPRESS("dt") "123456789]"
+//usage:	IF_FEATURE_BZIP2_PARALLEL(" [-p N]") " [FILE]..."
 //usage:#define bzip2_full_usage "\n\n"
 //usage:       "Compress FILEs (or stdin) with bzip2 algorithm\n"
 //usage:     "\n	-1..9	Compression level"
@@ -60,6 +71,9 @@
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
+//usage:	IF_FEATURE_BZIP2_PARALLEL(
+//usage:     "\n	-p N	Use N processes (0: one per CPU)"
+//usage:	)
 //usage:	IF_FEATURE_BZIP2_DECOMPRESS(
 //usage:     "\n	-t	Test integrity"
 //usage:	)
@@ -160,6 +174,163 @@ IF_DESKTOP(long long) int bz_write(bz_stream *strm, void* rbuf, ssize_t rlen, vo
 	return 0 IF_DESKTOP( + strm->total_out );
 }
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+/* -p N: the input is cut into pieces of one block each, and every piece
+ * is compressed into a complete bzip2 stream by a child process, up to
+ * N at a time. The streams are written out in order. Decompressors
+ * treat such a series of streams as one file (pbzip2 makes these too).
+ */
+enum {
+	MAX_JOBS = 64,
+};
+
+struct bzip2_job {
+	pid_t pid;
+	int fd;
+};
+
+static unsigned bz_jobs = 1; /* -p N */
+
+/* Copy the output of a job to stdout, returns its size or -1 */
+static off_t finish_job(struct bzip2_job *job)
+{
+	int status;
+	off_t n = bb_copyfd_eof(job->fd, STDOUT_FILENO);
+
+	close(job->fd);
+	if (n < 0)
+		kill(job->pid, SIGKILL);
+	if (safe_waitpid(job->pid, &status, 0) < 0
+	 || !WIFEXITED(status) || WEXITSTATUS(status) != 0
+	) {
+		n = -1; /* the child has said why */
+	}
+	return n;
+}
+
+/* How many bytes from the start of buf fit in one block after the
+ * initial run-length encoding (as ADD_CHAR_TO_BLOCK does it), leaving
+ * room for the run that BZ_FINISH flushes */
+static unsigned block_fit(const uint8_t *buf, unsigned len, unsigned nblockMAX)
+{
+	unsigned i, nblock = 0, run = 0;
+	unsigned prev = 256;
+
+	for (i = 0; i < len; i++) {
+		if (buf[i] != prev || run == 255) {
+			nblock += (run < 4) ? run : 5;
+			if (nblock >= nblockMAX)
+				return i;
+			prev = buf[i];
+			run = 1;
+		} else {
+			run++;
+		}
+	}
+	return len;
+}
+
+static IF_DESKTOP(long long) int compress_parallel(unsigned level, char *wbuf)
+{
+	struct bzip2_job job[MAX_JOBS];
+	unsigned first = 0, running = 0;
+	unsigned njobs = bz_jobs;
+	unsigned nblockMAX = level * 100000 - 19; /* as in BZ2_bzCompressInit */
+	/* Runs can make a block hold much more input than its size,
+	 * but we don't bother with blocks of more than twice that */
+	unsigned size = 2 * level * 100000;
+	unsigned have = 0;
+	IF_DESKTOP(long long) int total = 0;
+	smallint started = 0;
+	uint8_t *buf;
+
+	if (njobs > MAX_JOBS)
+		njobs = MAX_JOBS;
+	buf = xmalloc(size);
+
+	while (total >= 0) {
+		struct bzip2_job *j;
+		int p[2];
+		unsigned len;
+		ssize_t n = full_read(STDIN_FILENO, buf + have, size - have);
+
+		if (n < 0) {
+			bb_simple_perror_msg(bb_msg_read_error);
+			total = -1;
+			break;
+		}
+		have += n;
+		if (have == 0)
+			break;
+		started = 1;
+		len = block_fit(buf, have, nblockMAX);
+
+		if (running == njobs) {
+			off_t r = finish_job(&job[first]);
+			first = (first + 1) % njobs;
+			running--;
+			if (r < 0) {
+				total = -1;
+				break;
+			}
+			IF_DESKTOP(total += r;)
+		}
+		j = &job[(first + running) % njobs];
+		xpipe(p);
+# ifdef F_SETPIPE_SZ
+		/* let the child write all of its output without waiting
+		 * for us to collect the jobs started before it */
+		fcntl(p[1], F_SETPIPE_SZ, level * 100000);
+# endif
+		j->pid = xfork();
+		if (j->pid == 0) {
+			bz_stream bzs;
+
+			close(p[0]);
+			xmove_fd(p[1], STDOUT_FILENO);
+			BZ2_bzCompressInit(&bzs, level);
+			if (bz_write(&bzs, buf, len, wbuf) < 0
+			 || bz_write(&bzs, buf, 0, wbuf) < 0
+			) {
+				_exit(EXIT_FAILURE);
+			}
+			_exit(EXIT_SUCCESS);
+		}
+		close(p[1]);
+		j->fd = p[0];
+		running++;
+
+		have -= len;
+		memmove(buf, buf + len, have);
+	}
+	while (running != 0) {
+		off_t n;
+
+		if (total < 0) {
+			/* we are failing anyway, don't wait for the work */
+			kill(job[first].pid, SIGKILL);
+		}
+		n = finish_job(&job[first]);
+		first = (first + 1) % njobs;
+		running--;
+		if (n < 0)
+			total = -1;
+		IF_DESKTOP(if (total >= 0) total += n;)
+	}
+	free(buf);
+
+	if (!started) {
+		/* Empty input still makes a (tiny) stream */
+		bz_stream bzs;
+
+		BZ2_bzCompressInit(&bzs, level);
+		total = bz_write(&bzs, NULL, 0, wbuf);
+		BZ2_bzCompressEnd(&bzs);
+	}
+	return total;
+}
+#endif
+
 static
 IF_DESKTOP(long long) int FAST_FUNC compressStream(transformer_state_t *xstate UNUSED_PARAM)
 {
@@ -184,6 +355,14 @@ IF_DESKTOP(long long) int FAST_FUNC compressStream(transformer_state_t *xstate U
 		opt >>= 1;
 	}
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+	if (bz_jobs != 1) {
+		total = compress_parallel(level, wbuf);
+		free(iobuf);
+		return total;
+	}
+#endif
+
 	BZ2_bzCompressInit(strm, level);
 
 	while (1) {
@@ -231,7 +410,9 @@ int bzip2_main(int argc UNUSED_PARAM, char **argv)
 	opt = getopt32(argv, "^"
 		/* Must match BBUNPK_foo constants! */
 		BBUNPK_OPTSTR IF_FEATURE_BZIP2_DECOMPRESS("dt") "zs123456789"
+		IF_FEATURE_BZIP2_PARALLEL("p:+")
 		"\0" "s2" /* -s means -2 (compatibility) */
+		IF_FEATURE_BZIP2_PARALLEL(, &bz_jobs)
 	);
 #if ENABLE_FEATURE_BZIP2_DECOMPRESS /* bunzip2_main may not be visible... */
 	if (opt & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)) /* -d and/or -t */
@@ -242,6 +423,11 @@ int bzip2_main(int argc UNUSED_PARAM, char **argv)
 	option_mask32 = opt & ~(BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST);
 #endif
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+	if (bz_jobs == 0)
+		bz_jobs = get_cpu_count();
+#endif
+
 	argv += optind;
 	return bbunpack(argv, compressStream, append_ext, "bz2");
 }
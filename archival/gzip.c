@@ -55,6 +55,15 @@ aa:      85.1% -- replaced with aa.gz
 //config:	If this option is not selected, -N options are ignored and -6
 //config:	is used.
 //config:
+//config:config FEATURE_GZIP_PARALLEL
+//config:	bool "Enable -p N (compress in N processes)"
+//config:	default y
+//config:	depends on GZIP && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	Split the input into 128K chunks and compress up to N of them
+//config:	at once in child processes. The result is one ordinary gzip
+//config:	stream, a few bytes per chunk larger than without -p.
+//config:
 //config:config FEATURE_GZIP_DECOMPRESS
 //config:	bool "Enable decompression"
 //config:	default y
@@ -69,7 +78,8 @@ aa:      85.1% -- replaced with aa.gz
 //kbuild:lib-$(CONFIG_GZIP) += gzip.o
 
 //usage:#define gzip_trivial_usage
-//usage:       "[-cfk" IF_FEATURE_GZIP_DECOMPRESS("dt") IF_FEATURE_GZIP_LEVELS("123456789") "] [FILE]..."
+//usage:       "[-cfk" IF_FEATURE_GZIP_DECOMPRESS("dt") IF_FEATURE_GZIP_LEVELS("123456789") "]"
+//usage:	IF_FEATURE_GZIP_PARALLEL(" [-p N]") " [FILE]..."
 //usage:#define gzip_full_usage "\n\n"
 //usage:       "Compress FILEs (or stdin)\n"
 //usage:	IF_FEATURE_GZIP_LEVELS(
@@ -81,6 +91,9 @@ aa:      85.1% -- replaced with aa.gz
 //usage:     "\n	-c	Write to stdout"
 //usage:     "\n	-f	Force"
 //usage:     "\n	-k	Keep input files"
+//usage:	IF_FEATURE_GZIP_PARALLEL(
+//usage:     "\n	-p N	Compress in N processes (0: one per CPU)"
+//usage:	)
 //usage:	IF_FEATURE_GZIP_DECOMPRESS(
 //usage:     "\n	-t	Test integrity"
 //usage:	)
@@ -348,6 +361,9 @@ struct globals {
 #define good_match        (G1.good_match)
 #define nice_match        (G1.nice_match)
 #endif
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	unsigned jobs;		/* -p N */
+#endif
 
 /* =========================================================================== */
 /* all members below are zeroed out in pack_gzip() for each next file */
@@ -390,6 +406,10 @@ struct globals {
 #endif
 	unsigned outcnt;	/* bytes in output buffer */
 	smallint eofile;	/* flag set at end of input file */
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	const uch *chunk;	/* if set, input is read from here (in -p child) */
+	unsigned chunk_left;
+#endif
 
 /* ===========================================================================
  * Local data used by the "bit string" routines.
@@ -525,6 +545,16 @@ static unsigned file_read(void *buf, unsigned size)
 
 	Assert(G1.insize == 0, "l_buf not empty");
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.chunk) {
+		/* the parent does crc and isize */
+		len = MIN(size, G1.chunk_left);
+		memcpy(buf, G1.chunk, len);
+		G1.chunk += len;
+		G1.chunk_left -= len;
+		return len;
+	}
+#endif
 	len = safe_read(ifd, buf, size);
 	if (len == (unsigned)(-1) || len == 0)
 		return len;
@@ -1908,6 +1938,16 @@ static NOINLINE void deflate(void)
 	if (match_available)
 		ct_tally(0, G1.window[G1.strstart - 1]);
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.chunk) {
+		/* More chunks follow: end with an empty stored block,
+		 * which also byte-aligns the output ("sync flush") */
+		FLUSH_BLOCK(0);
+		send_bits(STORED_BLOCK << 1, 3);
+		copy_block(NULL, 0, 1);
+		return;
+	}
+#endif
 	FLUSH_BLOCK(1);	/* eof */
 }
 
@@ -2057,6 +2097,128 @@ static void ct_init(void)
 	init_block();
 }
 
+#if ENABLE_FEATURE_GZIP_PARALLEL
+/* ===========================================================================
+ * -p N: the input is compressed in 128K chunks, each by a child process,
+ * up to N at a time. A child gets the last 32K of input before its chunk
+ * as the dictionary and ends its output with a sync flush, so the outputs
+ * of all children, concatenated in order, form one deflate stream. The
+ * parent reads the input, does crc and size, and collects the outputs.
+ */
+enum {
+	CHUNK_SIZE = 128 * 1024,
+	MAX_JOBS = 64,
+};
+
+struct gzip_job {
+	pid_t pid;
+	int fd;
+};
+
+/* Runs in the child: dictionary is the dlen bytes before chunk */
+static void deflate_chunk(const uch *chunk, unsigned dlen, unsigned len) NORETURN;
+static void deflate_chunk(const uch *chunk, unsigned dlen, unsigned len)
+{
+	IPos hash_head;
+	unsigned s;
+
+	G1.chunk = chunk - dlen;
+	G1.chunk_left = dlen + len;
+	lm_init();
+	/* Hash the dictionary strings, start compressing after them */
+	for (s = 0; s < dlen; s++)
+		INSERT_STRING(s, hash_head);
+	G1.strstart = G1.block_start = dlen;
+	G1.lookahead -= dlen;
+	deflate();
+	flush_outbuf();
+	_exit(EXIT_SUCCESS);
+}
+
+/* Copy the output of a job to ofd */
+static void finish_job(struct gzip_job *job)
+{
+	int status;
+
+	if (bb_copyfd_eof(job->fd, ofd) < 0)
+		xfunc_die();
+	close(job->fd);
+	if (safe_waitpid(job->pid, &status, 0) < 0
+	 || !WIFEXITED(status) || WEXITSTATUS(status) != 0
+	) {
+		xfunc_die(); /* the child has said why */
+	}
+}
+
+static void deflate_parallel(void)
+{
+	struct gzip_job job[MAX_JOBS];
+	unsigned first = 0, running = 0;
+	unsigned njobs = G1.jobs;
+	unsigned dlen = 0;
+	uch *buf;
+
+	if (njobs == 0)
+		njobs = get_cpu_count();
+	if (njobs > MAX_JOBS)
+		njobs = MAX_JOBS;
+	/* dictionary, then chunk */
+	buf = xmalloc(WSIZE + CHUNK_SIZE);
+	/* children must not inherit unwritten output */
+	flush_outbuf();
+
+	while (1) {
+		struct gzip_job *j;
+		int p[2];
+		int len = full_read(ifd, buf + WSIZE, CHUNK_SIZE);
+
+		if (len < 0)
+			bb_simple_perror_msg_and_die(bb_msg_read_error);
+		if (len == 0)
+			break;
+		updcrc(buf + WSIZE, len);
+		G1.isize += len;
+
+		if (running == njobs) {
+			finish_job(&job[first]);
+			first = (first + 1) % njobs;
+			running--;
+		}
+		j = &job[(first + running) % njobs];
+		xpipe(p);
+# ifdef F_SETPIPE_SZ
+		/* let the child write all of its output without waiting
+		 * for us to collect the jobs started before it */
+		fcntl(p[1], F_SETPIPE_SZ, CHUNK_SIZE + CHUNK_SIZE / 8);
+# endif
+		j->pid = xfork();
+		if (j->pid == 0) {
+			close(p[0]);
+			xmove_fd(p[1], ofd);
+			deflate_chunk(buf + WSIZE, dlen, len);
+		}
+		close(p[1]);
+		j->fd = p[0];
+		running++;
+
+		/* Last 32K of input is the dictionary of the next chunk */
+		dlen = MIN(dlen + len, WSIZE);
+		memmove(buf + WSIZE - dlen, buf + WSIZE + len - dlen, dlen);
+	}
+	while (running != 0) {
+		finish_job(&job[first]);
+		first = (first + 1) % njobs;
+		running--;
+	}
+	free(buf);
+
+	/* Final block: empty, fixed codes */
+	send_bits((STATIC_TREES << 1) + 1, 3);
+	SEND_CODE(END_BLOCK, G2.static_ltree);
+	bi_windup();
+}
+#endif
+
 /* ===========================================================================
  * Deflate in to out.
  * IN assertions: the input and output buffers are cleared.
@@ -2079,7 +2241,6 @@ static void zip(void)
 
 	bi_init();
 	ct_init();
-	lm_init();
 
 	deflate_flags = 0x300; /* extra flags. OS id = 3 (Unix) */
 #if ENABLE_FEATURE_GZIP_LEVELS
@@ -2093,7 +2254,15 @@ static void zip(void)
 	/* The above 32-bit misaligns outbuf (10 bytes are stored), flush it */
 	flush_outbuf_if_32bit_optimized();
 
-	deflate();
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	if (G1.jobs != 1)
+		deflate_parallel();
+	else
+#endif
+	{
+		lm_init();
+		deflate();
+	}
 
 	/* Write the crc and uncompressed size */
 	put_32bit(~G1.crc);
@@ -2174,6 +2343,9 @@ static const char gzip_longopts[] ALIGN1 =
 	"fast\0"                No_argument       "1"
 	"best\0"                No_argument       "9"
 	"no-name\0"             No_argument       "n"
+#if ENABLE_FEATURE_GZIP_PARALLEL
+	"processes\0"           Required_argument "p"
+#endif
 	;
 #endif
 
@@ -2217,12 +2389,17 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 
 	SET_PTR_TO_GLOBALS((char *)xzalloc(sizeof(struct globals)+sizeof(struct globals2))
 			+ sizeof(struct globals));
+	IF_FEATURE_GZIP_PARALLEL(G1.jobs = 1;)
 
 	/* Must match bbunzip's constants OPT_STDOUT, OPT_FORCE! */
 #if ENABLE_FEATURE_GZIP_LONG_OPTIONS
-	opt = getopt32long(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789", gzip_longopts);
+	opt = getopt32long(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789"
+			IF_FEATURE_GZIP_PARALLEL("p:+"), gzip_longopts
+			IF_FEATURE_GZIP_PARALLEL(, &G1.jobs));
 #else
-	opt = getopt32(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789");
+	opt = getopt32(argv, BBUNPK_OPTSTR IF_FEATURE_GZIP_DECOMPRESS("dt") "n123456789"
+			IF_FEATURE_GZIP_PARALLEL("p:+")
+			IF_FEATURE_GZIP_PARALLEL(, &G1.jobs));
 #endif
 #if ENABLE_FEATURE_GZIP_DECOMPRESS /* gunzip_main may not be visible... */
 	if (opt & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)) /* -d and/or -t */
@@ -2230,6 +2407,7 @@ int gzip_main(int argc UNUSED_PARAM, char **argv)
 #endif
 #if ENABLE_FEATURE_GZIP_LEVELS
 	opt >>= (BBUNPK_OPTSTRLEN IF_FEATURE_GZIP_DECOMPRESS(+ 2) + 1); /* drop cfkvq[dt]n bits */
+	opt &= 0x1ff; /* drop -p bit */
 	if (opt == 0)
 		opt = 1 << 5; /* default: 6 */
 	opt = ffs(opt >> 4); /* Maps -1..-4 to [0], -5 to [1] ... -9 to [5] */
@@ -102,6 +102,11 @@ struct bunzip_data {
 	/* For I/O error handling */
 	jmp_buf *jmpbuf;
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+	/* -p N child: stop after one block */
+	smallint one_block;
+#endif
+
 	/* Big things go last (register-relative addressing can be larger for big offsets) */
 	uint32_t crc32Table[256];
 	uint8_t selectors[32768];  /* nSelectors=15 bits */
@@ -665,6 +670,12 @@ static int read_bunzip(bunzip_data *bd, char *outbuf, int len)
 			bd->totalCRC = bd->headerCRC + 1;
 			return RETVAL_LAST_BLOCK;
 		}
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+		if (bd->one_block) {
+			bd->writeCount = RETVAL_LAST_BLOCK;
+			return len;
+		}
+#endif
 	}
 
 	/* Refill the intermediate buffer by Huffman-decoding next block of input */
@@ -847,6 +858,377 @@ unpack_bz2_stream(transformer_state_t *xstate)
 	return i ? i : IF_DESKTOP(total_written) + 0;
 }
 
+#if ENABLE_FEATURE_BZIP2_PARALLEL
+/* Decompression in N processes.
+ *
+ * Blocks are not byte aligned and do not record their size, but each
+ * starts with the 48-bit magic 0x314159265359. The parent reads the
+ * input, looks for the magic at every bit position and forks a child
+ * for every place it is found. The child decodes one block from there
+ * and sends back its output and where the block ended. The magic can
+ * also turn up by chance inside compressed data, so the parent uses the
+ * output of a child only if its block starts where the previous one
+ * ended. Stream headers and trailers between blocks are parsed by
+ * the parent, which also checks the combined crc of every stream.
+ */
+#define BLOCK_MAGIC 0x314159265359ULL
+#define EOS_MAGIC   0x177245385090ULL
+#define PAR_CRC_ERROR 1 /* not a RETVAL_xxx */
+enum {
+	/* A block has at most 900k symbols of at most 20 bits, plus tables */
+	MAX_BLOCK_BYTES = 900000 / 8 * MAX_HUFCODE_BITS + 64 * 1024,
+	PAR_READ_SIZE = 256 * 1024,
+	PAR_FRAME_SIZE = 64 * 1024,
+	MAX_JOBS = 64,
+};
+
+struct bz2_job {
+	uint64_t pos; /* bit offset of the block */
+	pid_t pid;
+	int fd;
+};
+
+/* Sent by the child after the output of its block */
+struct bz2_job_result {
+	uint64_t end; /* bit offset just past the block */
+	uint32_t crc;
+	uint32_t size; /* of output */
+	int status;
+};
+
+struct bz2_par {
+	int src_fd;
+	smallint eof;
+	uint8_t *buf;
+	uint64_t base; /* input offset of buf[0] */
+	unsigned len, size;
+	uint64_t next; /* bit offset of the next block to output */
+	uint64_t shreg; /* the last 64 bits of input */
+	uint64_t *cand; /* block magic seen here, no child started yet */
+	unsigned ncand;
+	uint8_t magic_end[256]; /* bit k set: magic can end at bit k of byte */
+};
+
+/* Read more input, looking for the block magic in it */
+static void bz2_fill(struct bz2_par *par)
+{
+	unsigned keep, i;
+	ssize_t n;
+
+	/* Bytes before the next block and before all candidates
+	 * are not needed anymore */
+	while (par->ncand != 0 && par->cand[0] < par->next)
+		memmove(par->cand, par->cand + 1, --par->ncand * sizeof(par->cand[0]));
+	keep = 0;
+	if (par->next / 8 > par->base) {
+		uint64_t k = par->next / 8;
+		if (par->ncand != 0 && par->cand[0] / 8 < k)
+			k = par->cand[0] / 8;
+		keep = MIN(k - par->base, par->len);
+	}
+	if (keep != 0 && par->len + PAR_READ_SIZE > par->size) {
+		par->len -= keep;
+		memmove(par->buf, par->buf + keep, par->len);
+		par->base += keep;
+	}
+	if (par->len + PAR_READ_SIZE > par->size) {
+		par->size = par->len + PAR_READ_SIZE;
+		par->buf = xrealloc(par->buf, par->size);
+	}
+
+	n = safe_read(par->src_fd, par->buf + par->len, PAR_READ_SIZE);
+	if (n <= 0) {
+		if (n < 0)
+			bb_simple_perror_msg(bb_msg_read_error);
+		par->eof = 1;
+		return;
+	}
+	for (i = par->len; i < par->len + n; i++) {
+		unsigned m = par->magic_end[par->buf[i]];
+		int k;
+
+		par->shreg = (par->shreg << 8) | par->buf[i];
+		if (!m)
+			continue;
+		for (k = 7; k >= 0; k--) {
+			uint64_t end = (par->base + i + 1) * 8 - k;
+			if ((m & (1 << k))
+			 && end >= 48
+			 && ((par->shreg >> k) & 0xffffffffffffULL) == BLOCK_MAGIC
+			) {
+				par->cand = xrealloc_vector(par->cand, 4, par->ncand);
+				par->cand[par->ncand++] = end - 48;
+			}
+		}
+	}
+	par->len += n;
+}
+
+/* Have bits up to bit offset end in buffer? */
+static int bz2_have(struct bz2_par *par, uint64_t end)
+{
+	while ((par->base + par->len) * 8 < end) {
+		if (par->eof)
+			return 0;
+		bz2_fill(par);
+	}
+	return 1;
+}
+
+/* Get n (<= 32) bits at bit offset pos, which must be in buffer */
+static unsigned bz2_bits(struct bz2_par *par, uint64_t pos, int n)
+{
+	const uint8_t *p = par->buf + (pos / 8 - par->base);
+	unsigned i, nb = ((pos & 7) + n + 7) / 8;
+	uint64_t v = 0;
+
+	for (i = 0; i < nb; i++)
+		v = (v << 8) | p[i];
+	return (v >> (nb * 8 - (pos & 7) - n)) & ((1ULL << n) - 1);
+}
+
+/* par->next is where a block ended (or 0: the start of input).
+ * Go past stream trailers and headers to the next block.
+ * par->next = 0 if there is none */
+static int bz2_next_block(struct bz2_par *par, uint32_t *crc)
+{
+	enum { BZh0 = ('B' << 24) + ('Z' << 16) + ('h' << 8) + '0' };
+	uint64_t pos = par->next;
+	int at_start = (pos == 0);
+	int i;
+
+	for (;;) {
+		if (!at_start) {
+			uint64_t magic;
+
+			if (!bz2_have(par, pos + 80))
+				return RETVAL_UNEXPECTED_INPUT_EOF;
+			magic = ((uint64_t)bz2_bits(par, pos, 24) << 24)
+				| bz2_bits(par, pos + 24, 24);
+			if (magic == BLOCK_MAGIC)
+				break;
+			if (magic != EOS_MAGIC)
+				return RETVAL_NOT_BZIP_DATA;
+			if (bz2_bits(par, pos + 48, 32) != *crc)
+				return PAR_CRC_ERROR;
+			/* Streams end on a byte boundary */
+			pos = (pos + 80 + 7) & ~(uint64_t)7;
+		}
+		/* "BZh['1'-'9']": maybe one more stream follows (pbzip2) */
+		i = bz2_have(par, pos + 32);
+		if (!i || (bz2_bits(par, pos, 32) - BZh0 - 1) >= 9) {
+			if (at_start)
+				return i ? RETVAL_NOT_BZIP_DATA : RETVAL_UNEXPECTED_INPUT_EOF;
+			pos = 0; /* end of bzip2 data */
+			break;
+		}
+		pos += 32;
+		*crc = 0;
+		at_start = 0;
+	}
+	par->next = pos;
+	return RETVAL_OK;
+}
+
+/* Runs in the child: decode the block at bit offset pos, send to fd */
+static void bz2_decode_block(struct bz2_par *par, uint64_t pos, int fd) NORETURN;
+static void bz2_decode_block(struct bz2_par *par, uint64_t pos, int fd)
+{
+	struct bz2_job_result res;
+	bunzip_data *bd;
+	jmp_buf jmpbuf;
+	uint32_t *frame;
+	uint32_t size = 0;
+	int i;
+
+	bd = xzalloc(sizeof(*bd));
+	bd->jmpbuf = &jmpbuf;
+	bd->in_fd = -1;
+	bd->inbuf = par->buf + (pos / 8 - par->base);
+	bd->inbufCount = par->len - (pos / 8 - par->base);
+	crc32_filltable(bd->crc32Table, 1);
+	/* We don't know which stream this is, allow the largest blocks */
+	bd->dbufSize = 900000;
+	bd->dbuf = xmalloc(bd->dbufSize * sizeof(bd->dbuf[0]));
+	bd->one_block = 1;
+	frame = xmalloc(sizeof(frame[0]) + PAR_FRAME_SIZE);
+
+	i = setjmp(jmpbuf);
+	if (i == 0) {
+		get_bits(bd, pos & 7);
+		while (1) {
+			i = read_bunzip(bd, (char*)(frame + 1), PAR_FRAME_SIZE);
+			if (i < 0)
+				break;
+			i = PAR_FRAME_SIZE - i;
+			if (i == 0)
+				break;
+			frame[0] = i;
+			xwrite(fd, frame, sizeof(frame[0]) + i);
+			size += i;
+		}
+		/* read_bunzip says "last block" after the one block */
+		if (i == RETVAL_LAST_BLOCK)
+			i = (bd->writeCRC == bd->headerCRC) ? RETVAL_OK : PAR_CRC_ERROR;
+	}
+	res.end = pos / 8 * 8 + bd->inbufPos * 8 - bd->inbufBitCount;
+	res.crc = bd->headerCRC;
+	res.size = size;
+	res.status = i;
+	frame[0] = 0;
+	xwrite(fd, frame, sizeof(frame[0]));
+	xwrite(fd, &res, sizeof(res));
+	_exit(EXIT_SUCCESS);
+}
+
+/* Copy the output of a child to the destination */
+static int bz2_job_output(transformer_state_t *xstate, struct bz2_job *job,
+		char *buf, struct bz2_job_result *res)
+{
+	uint32_t n;
+
+	for (;;) {
+		if (full_read(job->fd, &n, sizeof(n)) != sizeof(n))
+			return RETVAL_OUT_OF_MEMORY; /* the child has died */
+		if (n == 0)
+			break;
+		if (n > PAR_FRAME_SIZE || full_read(job->fd, buf, n) != n)
+			return RETVAL_OUT_OF_MEMORY;
+		if (n != transformer_write(xstate, buf, n))
+			return RETVAL_SHORT_WRITE;
+	}
+	if (full_read(job->fd, res, sizeof(*res)) != sizeof(*res))
+		return RETVAL_OUT_OF_MEMORY;
+	return res->status;
+}
+
+static void bz2_end_job(struct bz2_job *job, int kill_it)
+{
+	if (kill_it)
+		kill(job->pid, SIGKILL);
+	close(job->fd);
+	safe_waitpid(job->pid, NULL, 0);
+}
+
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_bz2_stream_parallel(transformer_state_t *xstate, unsigned njobs)
+{
+	IF_DESKTOP(long long total_written = 0;)
+	struct bz2_job job[MAX_JOBS];
+	unsigned first = 0, running = 0;
+	struct bz2_par *par;
+	uint32_t crc = 0;
+	char *outbuf;
+	int i, k;
+
+	if (njobs > MAX_JOBS)
+		njobs = MAX_JOBS;
+	if (njobs <= 1)
+		return unpack_bz2_stream(xstate);
+	if (check_signature16(xstate, BZIP2_MAGIC))
+		return -1;
+
+	par = xzalloc(sizeof(*par));
+	par->src_fd = xstate->src_fd;
+	for (i = 0; i < 256; i++)
+		for (k = 0; k < 8; k++)
+			if ((i >> k) == (BLOCK_MAGIC & ((1 << (8 - k)) - 1)))
+				par->magic_end[i] |= 1 << k;
+	/* "BZ" is already read */
+	par->size = PAR_READ_SIZE;
+	par->buf = xmalloc(par->size);
+	par->buf[0] = 'B';
+	par->buf[1] = 'Z';
+	par->len = 2;
+	outbuf = xmalloc(PAR_FRAME_SIZE);
+
+	i = bz2_next_block(par, &crc);
+	while (i == RETVAL_OK && par->next != 0) {
+		struct bz2_job_result res;
+		struct bz2_job *j;
+
+		/* Start children for the blocks found so far */
+		while (running < njobs) {
+			uint64_t pos;
+			int p[2];
+
+			while (par->ncand != 0 && par->cand[0] < par->next)
+				memmove(par->cand, par->cand + 1, --par->ncand * sizeof(par->cand[0]));
+			if (par->ncand == 0) {
+				if (par->eof)
+					break;
+				bz2_fill(par);
+				continue;
+			}
+			pos = par->cand[0];
+			if (!par->eof && (par->base + par->len) < pos / 8 + MAX_BLOCK_BYTES) {
+				/* the child needs the whole block */
+				bz2_fill(par);
+				continue;
+			}
+			memmove(par->cand, par->cand + 1, --par->ncand * sizeof(par->cand[0]));
+
+			j = &job[(first + running) % njobs];
+			j->pos = pos;
+			xpipe(p);
+# ifdef F_SETPIPE_SZ
+			/* let the child write all of its output without waiting
+			 * for us to collect the jobs started before it */
+			fcntl(p[1], F_SETPIPE_SZ, 1024 * 1024);
+# endif
+			j->pid = xfork();
+			if (j->pid == 0) {
+				close(p[0]);
+				bz2_decode_block(par, pos, p[1]);
+			}
+			close(p[1]);
+			j->fd = p[0];
+			running++;
+		}
+		if (running == 0) {
+			/* can't be: par->next has the magic, so it was found */
+			i = RETVAL_DATA_ERROR;
+			break;
+		}
+
+		j = &job[first];
+		first = (first + 1) % njobs;
+		running--;
+		if (j->pos != par->next) {
+			/* Not a block, the magic was inside of one */
+			bz2_end_job(j, 1);
+			continue;
+		}
+		i = bz2_job_output(xstate, j, outbuf, &res);
+		bz2_end_job(j, i != RETVAL_OK);
+		if (i != RETVAL_OK)
+			break;
+		IF_DESKTOP(total_written += res.size;)
+		crc = ((crc << 1) | (crc >> 31)) ^ res.crc;
+		par->next = res.end;
+		i = bz2_next_block(par, &crc);
+	}
+	/* Children still running were started for bogus magic
+	 * after the end of data, or we are failing */
+	while (running != 0) {
+		bz2_end_job(&job[first], 1);
+		first = (first + 1) % njobs;
+		running--;
+	}
+
+	if (i == PAR_CRC_ERROR)
+		bb_simple_error_msg("CRC error");
+	else if (i != RETVAL_OK)
+		bb_error_msg("bunzip error %d", i);
+
+	free(outbuf);
+	free(par->cand);
+	free(par->buf);
+	free(par);
+	return i ? -1 : IF_DESKTOP(total_written) + 0;
+}
+#endif
+
 char* FAST_FUNC
 unpack_bz2_data(const char *packed, int packed_len, int unpacked_len)
 {
@@ -52,6 +52,25 @@ enum {
 	/* If BMAX needs to be larger than 16, then h and x[] should be ulg. */
 	BMAX = 16,	/* maximum bit length of any code (16 for explode) */
 	N_MAX = 288,	/* maximum number of codes in any set */
+#if ENABLE_FEATURE_GZIP_DECOMPRESS_FAST
+	/* Root table sizes of the table-driven decoder. Longer codes go
+	 * through a subtable. The ENOUGH values are the largest tables
+	 * any valid code can need (as computed by zlib's "enough").
+	 */
+	LITLEN_BITS = 10,
+	LITLEN_ENOUGH = 1334,
+	DIST_BITS = 8,
+	DIST_ENOUGH = 402,
+	PRECODE_BITS = 7,
+	/* Output is decoded straight into one flat buffer: 32K of history
+	 * followed by up to 64K of new data, plus room for the last match
+	 * and the up to 7 bytes its copy loop writes past its end.
+	 */
+	GUNZIP_OUT_MAX = GUNZIP_WSIZE + 0x10000,
+	GUNZIP_OUTBUF_SIZE = GUNZIP_OUT_MAX + 258 + 8,
+#else
+	GUNZIP_OUTBUF_SIZE = GUNZIP_WSIZE,
+#endif
 };
 
 
@@ -115,6 +134,16 @@ typedef struct state_t {
 	unsigned inflate_stored_k;
 	unsigned inflate_stored_w;
 
+#if ENABLE_FEATURE_GZIP_DECOMPRESS_FAST
+	uint64_t inflate_bitbuf;
+	unsigned inflate_bitcnt;
+	unsigned inflate_overrun; /* zero bytes fed past end of input */
+	unsigned gunzip_outbuf_start; /* new data in gunzip_window starts here */
+	smallint fixed_tables_built;
+	uint32_t litlen_table[LITLEN_ENOUGH];
+	uint32_t dist_table[DIST_ENOUGH];
+#endif
+
 	const char *error_msg;
 	jmp_buf error_jmp;
 } state_t;
@@ -152,6 +181,17 @@ typedef struct state_t {
 #define inflate_stored_b    (S()inflate_stored_b   )
 #define inflate_stored_k    (S()inflate_stored_k   )
 #define inflate_stored_w    (S()inflate_stored_w   )
+#if ENABLE_FEATURE_GZIP_DECOMPRESS_FAST
+#define inflate_bitbuf      (S()inflate_bitbuf     )
+#define inflate_bitcnt      (S()inflate_bitcnt     )
+#define inflate_overrun     (S()inflate_overrun    )
+#define gunzip_outbuf_start (S()gunzip_outbuf_start)
+#define fixed_tables_built  (S()fixed_tables_built )
+#define litlen_table        (S()litlen_table       )
+#define dist_table          (S()dist_table         )
+#else
+#define gunzip_outbuf_start 0
+#endif
 #define error_msg           (S()error_msg          )
 #define error_jmp           (S()error_jmp          )
 
@@ -214,6 +254,7 @@ static const uint8_t border[] ALIGN1 = {
 };
 
 
+#if !ENABLE_FEATURE_GZIP_DECOMPRESS_FAST
 /*
  * Free the malloc'ed tables built by huft_build(), which makes a linked
  * list of the tables it made, with the links in a dummy first entry of
@@ -952,17 +993,492 @@ static int inflate_block(STATE_PARAM smallint *e)
 	}
 }
 
+#else /* FEATURE_GZIP_DECOMPRESS_FAST */
+
+/*
+ * Table-driven inflate.
+ *
+ * Bits are taken LSB first from a 64-bit buffer. While at least 8 input
+ * bytes are at hand it is topped up to 56+ bits by one unaligned load,
+ * which covers a whole length/distance pair with its extra bits (at most
+ * 46 bits). A Huffman code is resolved by one lookup in a root table
+ * indexed by the next LITLEN_BITS/DIST_BITS bits, codes longer than that
+ * need one more lookup in a subtable. Output is decoded straight into
+ * gunzip_window, which keeps the last 32K of history in front of the new
+ * data, so a match is a plain forward copy.
+ *
+ * Table entry: value << 16 | op << 8 | number of bits to consume.
+ */
+enum {
+	HT_BAD  = 0x00, /* invalid code */
+	HT_EOB  = 0x10, /* end of block */
+	HT_SUB  = 0x20, /* value: subtable offset, op & 0xf: its index bits */
+	HT_BASE = 0x40, /* value: length/distance base, op & 0xf: extra bits */
+	HT_LIT  = 0x80, /* value: literal byte (or code length symbol) */
+};
+#define HT_OP(e)   ((e) >> 8)
+#define HT_NBITS(e) ((uint8_t)(e))
+#define HT_XBITS(e) (HT_OP(e) & 0xf)
+
+static void abort_unzip(STATE_PARAM_ONLY) NORETURN;
+static void abort_unzip(STATE_PARAM_ONLY)
+{
+	longjmp(error_jmp, 1);
+}
+
+static ALWAYS_INLINE uint64_t get_le64(const uint8_t *p)
+{
+	uint64_t v;
+	memcpy(&v, p, 8);
+	return SWAP_LE64(v);
+}
+
+/* Read more compressed data, keeping the last 8 bytes of the old buffer
+ * in front of it: unused whole bytes in the bit buffer are then always
+ * still there to be given back (see return_bytes).
+ * Returns 0 at end of input.
+ */
+static int read_bytebuffer(STATE_PARAM_ONLY)
+{
+	unsigned keep = bytebuffer_size < 8 ? bytebuffer_size : 8;
+	int sz = bytebuffer_max - 8;
+
+	if (to_read >= 0 && to_read < sz) /* unzip only */
+		sz = to_read;
+	memmove(&bytebuffer[8 - keep], &bytebuffer[bytebuffer_size - keep], keep);
+	if (sz)
+		sz = safe_read(gunzip_src_fd, &bytebuffer[8], sz);
+	if (sz < 0) {
+		error_msg = bb_msg_read_error;
+		abort_unzip(PASS_STATE_ONLY);
+	}
+	if (to_read >= 0) /* unzip only */
+		to_read -= sz;
+	bytebuffer_offset = 8;
+	bytebuffer_size = 8 + sz;
+	return sz;
+}
+
+/* Top up the bit buffer to more than 56 bits a byte at a time.
+ * Past the end of input, zero bytes are fed and counted: a good stream
+ * never consumes them, this is checked when the bytes are given back.
+ */
+static void refill_slow(STATE_PARAM_ONLY)
+{
+	while (inflate_bitcnt <= 56) {
+		if (bytebuffer_offset >= bytebuffer_size
+		 && read_bytebuffer(PASS_STATE_ONLY) == 0
+		) {
+			if (++inflate_overrun > 8) {
+				error_msg = "unexpected end of file";
+				abort_unzip(PASS_STATE_ONLY);
+			}
+		} else {
+			inflate_bitbuf |= (uint64_t)bytebuffer[bytebuffer_offset++] << inflate_bitcnt;
+		}
+		inflate_bitcnt += 8;
+	}
+}
+
+static unsigned get_bits(STATE_PARAM unsigned n)
+{
+	unsigned v;
+
+	if (inflate_bitcnt < n)
+		refill_slow(PASS_STATE_ONLY);
+	v = (unsigned)inflate_bitbuf & mask_bits[n];
+	inflate_bitbuf >>= n;
+	inflate_bitcnt -= n;
+	return v;
+}
+
+/* Drop the bits of a partially used byte and give the whole unused
+ * bytes back to bytebuffer, leaving the bit buffer empty.
+ */
+static void return_bytes(STATE_PARAM_ONLY)
+{
+	unsigned n = inflate_bitcnt >> 3;
+
+	if (inflate_overrun > n) {
+		error_msg = "unexpected end of file";
+		abort_unzip(PASS_STATE_ONLY);
+	}
+	bytebuffer_offset -= n - inflate_overrun;
+	inflate_overrun = 0;
+	inflate_bitbuf = 0;
+	inflate_bitcnt = 0;
+}
+
+/* Build the decode table for the code with lengths lens[0..num-1].
+ * Symbols from 'valid' up are in the code but decode as invalid.
+ * type: 0 - code length code, 1 - literal/length, 2 - distance.
+ * Returns -1 for an oversubscribed or incomplete code. Like zlib, we
+ * accept a lone 1-bit code (and no codes at all: then every lookup
+ * hits an invalid entry).
+ */
+static int build_table(uint32_t *table, unsigned size,
+		const uint8_t *lens, unsigned num, unsigned valid,
+		unsigned root, int type)
+{
+	unsigned count[BMAX + 1];
+	unsigned offs[BMAX + 1];
+	uint16_t sorted[N_MAX];
+	uint32_t *sub;
+	unsigned sym, len, max, left, i, j;
+	unsigned huff;  /* current code, bit-reversed */
+	unsigned low;   /* root index of the current subtable */
+	unsigned curr;  /* index bits of the current subtable */
+	unsigned next;  /* where the next subtable goes */
+
+	memset(count, 0, sizeof(count));
+	for (sym = 0; sym < num; sym++)
+		count[lens[sym]]++;
+	for (max = BMAX; max != 0 && count[max] == 0; max--)
+		continue;
+
+	left = 1;
+	for (len = 1; len <= BMAX; len++) {
+		left <<= 1;
+		if (left < count[len])
+			return -1; /* oversubscribed */
+		left -= count[len];
+	}
+	if (left != 0) {
+		if (max > 1)
+			return -1; /* incomplete */
+		/* unused codes decode as invalid */
+		memset(table, HT_BAD, sizeof(table[0]) << root);
+	}
+
+	/* sort symbols by code length, in symbol order within a length */
+	offs[1] = 0;
+	for (len = 1; len < BMAX; len++)
+		offs[len + 1] = offs[len] + count[len];
+	for (sym = 0; sym < num; sym++)
+		if (lens[sym] != 0)
+			sorted[offs[lens[sym]]++] = sym;
+
+	huff = 0;
+	low = (unsigned)-1;
+	curr = 0;
+	next = 1U << root;
+	sub = table;
+	i = 0;
+	for (len = 1; len <= max; len++) {
+		while (count[len] != 0) {
+			uint32_t e;
+
+			sym = sorted[i++];
+			if (sym >= valid) {
+				e = HT_BAD << 8;
+			} else if (type == 0) {
+				e = (sym << 16) | (HT_LIT << 8);
+			} else if (type == 1 && sym < 256) {
+				e = (sym << 16) | (HT_LIT << 8);
+			} else if (type == 1 && sym == 256) {
+				e = HT_EOB << 8;
+			} else {
+				const struct cp_ext *c = (type == 1) ? &lit : &dist;
+				sym -= (type == 1) ? 257 : 0;
+				e = ((uint32_t)c->cp[sym] << 16) | ((HT_BASE | c->ext[sym]) << 8);
+			}
+
+			if (len <= root) {
+				for (j = huff; j < (1U << root); j += 1U << len)
+					table[j] = e | len;
+			} else {
+				if ((huff & ((1U << root) - 1)) != low) {
+					/* start a subtable, wide enough for all
+					 * remaining codes with this root prefix */
+					low = huff & ((1U << root) - 1);
+					curr = len - root;
+					left = 1U << curr;
+					while (curr + root < max) {
+						if (left <= count[curr + root])
+							break;
+						left -= count[curr + root];
+						curr++;
+						left <<= 1;
+					}
+					if (next + (1U << curr) > size)
+						return -1;
+					sub = table + next;
+					table[low] = (next << 16) | ((HT_SUB | curr) << 8) | root;
+					next += 1U << curr;
+				}
+				for (j = huff >> root; j < (1U << curr); j += 1U << (len - root))
+					sub[j] = e | (len - root);
+			}
+			count[len]--;
+
+			/* next code of this length, bit-reversed */
+			j = 1U << (len - 1);
+			while (huff & j)
+				j >>= 1;
+			huff = j ? (huff & (j - 1)) + j : 0;
+		}
+	}
+	return 0;
+}
+
+/* Decode the codes of a Huffman block into gunzip_window until the end
+ * of block (returns 0) or until it holds GUNZIP_OUT_MAX bytes (returns 1).
+ */
+static NOINLINE int inflate_codes(STATE_PARAM_ONLY)
+{
+	const uint32_t *lt = litlen_table;
+	const uint32_t *dt = dist_table;
+	uint8_t *out = gunzip_window;
+	unsigned pos = gunzip_outbuf_count;
+	const uint8_t *in = bytebuffer + bytebuffer_offset;
+	const uint8_t *in_end = bytebuffer + bytebuffer_size;
+	uint64_t bitbuf = inflate_bitbuf;
+	unsigned bitcnt = inflate_bitcnt;
+	int ret = 1;
+
+#define CONSUME(n) do { bitbuf >>= (n); bitcnt -= (n); } while (0)
+#define PEEK(n) ((unsigned)bitbuf & ((1U << (n)) - 1))
+	while (pos < GUNZIP_OUT_MAX) {
+		uint8_t *dst, *src;
+		unsigned e, len, d;
+
+		if (in_end - in >= 8) {
+			bitbuf |= get_le64(in) << bitcnt;
+			in += (63 - bitcnt) >> 3;
+			bitcnt |= 56;
+		} else {
+			inflate_bitbuf = bitbuf;
+			inflate_bitcnt = bitcnt;
+			bytebuffer_offset = in - bytebuffer;
+			refill_slow(PASS_STATE_ONLY);
+			bitbuf = inflate_bitbuf;
+			bitcnt = inflate_bitcnt;
+			in = bytebuffer + bytebuffer_offset;
+			in_end = bytebuffer + bytebuffer_size;
+		}
+
+		e = lt[PEEK(LITLEN_BITS)];
+		if (HT_OP(e) & HT_SUB) {
+			CONSUME(LITLEN_BITS);
+			e = lt[(e >> 16) + PEEK(HT_XBITS(e))];
+		}
+		CONSUME(HT_NBITS(e));
+		if (HT_OP(e) & HT_LIT) {
+			out[pos++] = e >> 16;
+			/* 41+ bits are left: enough for a second literal */
+			e = lt[PEEK(LITLEN_BITS)];
+			if (HT_OP(e) == HT_LIT) {
+				CONSUME(HT_NBITS(e));
+				out[pos++] = e >> 16;
+			}
+			continue;
+		}
+		if (!(HT_OP(e) & HT_BASE)) {
+			if (HT_OP(e) & HT_EOB) {
+				ret = 0;
+				break;
+			}
+			abort_unzip(PASS_STATE_ONLY);
+		}
+
+		/* length/distance pair */
+		len = (e >> 16) + PEEK(HT_XBITS(e));
+		CONSUME(HT_XBITS(e));
+		e = dt[PEEK(DIST_BITS)];
+		if (HT_OP(e) & HT_SUB) {
+			CONSUME(DIST_BITS);
+			e = dt[(e >> 16) + PEEK(HT_XBITS(e))];
+		}
+		CONSUME(HT_NBITS(e));
+		if (!(HT_OP(e) & HT_BASE))
+			abort_unzip(PASS_STATE_ONLY);
+		d = (e >> 16) + PEEK(HT_XBITS(e));
+		CONSUME(HT_XBITS(e));
+		if (d > pos)
+			abort_unzip(PASS_STATE_ONLY); /* before start of data */
+
+		/* copy the match, in 8-byte steps if it does not overlap
+		 * itself by less than that (may write up to 7 bytes past it) */
+		dst = out + pos;
+		src = dst - d;
+		pos += len;
+		if (d >= 8) {
+			do {
+				memcpy(dst, src, 8);
+				dst += 8;
+				src += 8;
+			} while (dst < out + pos);
+		} else if (d == 1) {
+			memset(dst, *src, len);
+		} else {
+			do
+				*dst++ = *src++;
+			while (dst < out + pos);
+		}
+	}
+#undef CONSUME
+#undef PEEK
+
+	gunzip_outbuf_count = pos;
+	inflate_bitbuf = bitbuf;
+	inflate_bitcnt = bitcnt;
+	bytebuffer_offset = in - bytebuffer;
+	return ret;
+}
+
+/* Copy a stored block. Returns 0 at its end, 1 if gunzip_window is full */
+static int inflate_stored(STATE_PARAM_ONLY)
+{
+	while (inflate_stored_n != 0) {
+		unsigned n = inflate_stored_n;
+
+		if (gunzip_outbuf_count >= GUNZIP_OUT_MAX)
+			return 1;
+		if (bytebuffer_offset >= bytebuffer_size
+		 && read_bytebuffer(PASS_STATE_ONLY) == 0
+		) {
+			error_msg = "unexpected end of file";
+			abort_unzip(PASS_STATE_ONLY);
+		}
+		if (n > bytebuffer_size - bytebuffer_offset)
+			n = bytebuffer_size - bytebuffer_offset;
+		if (n > GUNZIP_OUT_MAX - gunzip_outbuf_count)
+			n = GUNZIP_OUT_MAX - gunzip_outbuf_count;
+		memcpy(gunzip_window + gunzip_outbuf_count, bytebuffer + bytebuffer_offset, n);
+		gunzip_outbuf_count += n;
+		bytebuffer_offset += n;
+		inflate_stored_n -= n;
+	}
+	return 0;
+}
+
+/*
+ * Read the header of the next block and set up for decoding it.
+ * e: last block flag
+ */
+/* Return values: -1 = inflate_stored, -2 = inflate_codes */
+/* One callsite in inflate_get_next_window */
+static int inflate_block(STATE_PARAM smallint *e)
+{
+	uint8_t ll[286 + 30];   /* literal/length and distance code lengths */
+	unsigned t;             /* block type */
+
+	*e = get_bits(PASS_STATE 1);
+	t = get_bits(PASS_STATE 2);
+
+	switch (t) {
+	case 0: /* Inflate stored */
+	{
+		unsigned n;
+
+		/* go to byte boundary */
+		get_bits(PASS_STATE inflate_bitcnt & 7);
+		n = get_bits(PASS_STATE 16);
+		if (n != (get_bits(PASS_STATE 16) ^ 0xffff))
+			abort_unzip(PASS_STATE_ONLY); /* error in compressed data */
+		/* the data is copied from bytebuffer */
+		return_bytes(PASS_STATE_ONLY);
+		inflate_stored_n = n;
+		return -1;
+	}
+	case 1: /* Inflate fixed */
+		if (!fixed_tables_built) {
+			memset(ll, 8, 144);
+			memset(ll + 144, 9, 256 - 144);
+			memset(ll + 256, 7, 280 - 256);
+			memset(ll + 280, 8, 288 - 280);
+			build_table(litlen_table, LITLEN_ENOUGH, ll, 288, 286, LITLEN_BITS, 1);
+			memset(ll, 5, 32);
+			build_table(dist_table, DIST_ENOUGH, ll, 32, 30, DIST_BITS, 2);
+			/* ^^^ never fail: we use known data */
+			fixed_tables_built = 1;
+		}
+		return -2;
+	case 2: /* Inflate dynamic */
+	{
+		uint32_t pre[1 << PRECODE_BITS]; /* code length code table */
+		unsigned nl, nd, nb, n, i, j, l;
+
+		nl = 257 + get_bits(PASS_STATE 5);
+		nd = 1 + get_bits(PASS_STATE 5);
+		nb = 4 + get_bits(PASS_STATE 4);
+		if (nl > 286 || nd > 30)
+			abort_unzip(PASS_STATE_ONLY); /* bad lengths */
+
+		memset(ll, 0, 19);
+		for (j = 0; j < nb; j++)
+			ll[border[j]] = get_bits(PASS_STATE 3);
+		if (build_table(pre, 1 << PRECODE_BITS, ll, 19, 19, PRECODE_BITS, 0) != 0)
+			abort_unzip(PASS_STATE_ONLY); /* incomplete code set */
+
+		/* read in literal and distance code lengths */
+		n = nl + nd;
+		i = l = 0;
+		while (i < n) {
+			uint32_t ent;
+
+			if (inflate_bitcnt < PRECODE_BITS)
+				refill_slow(PASS_STATE_ONLY);
+			ent = pre[(unsigned)inflate_bitbuf & ((1 << PRECODE_BITS) - 1)];
+			if (!(HT_OP(ent) & HT_LIT))
+				abort_unzip(PASS_STATE_ONLY);
+			get_bits(PASS_STATE HT_NBITS(ent));
+			j = ent >> 16;
+			if (j < 16) {   /* length of code in bits (0..15) */
+				ll[i++] = l = j;
+				continue;
+			}
+			if (j == 16) {  /* repeat last length 3 to 6 times */
+				j = 3 + get_bits(PASS_STATE 2);
+			} else {
+				l = 0;
+				if (j == 17) /* 3 to 10 zero length codes */
+					j = 3 + get_bits(PASS_STATE 3);
+				else    /* j == 18: 11 to 138 zero length codes */
+					j = 11 + get_bits(PASS_STATE 7);
+			}
+			if (i + j > n)
+				abort_unzip(PASS_STATE_ONLY);
+			memset(ll + i, l, j);
+			i += j;
+		}
+
+		fixed_tables_built = 0;
+		if (build_table(litlen_table, LITLEN_ENOUGH, ll, nl, 286, LITLEN_BITS, 1) != 0
+		 || build_table(dist_table, DIST_ENOUGH, ll + nl, nd, 30, DIST_BITS, 2) != 0
+		) {
+			abort_unzip(PASS_STATE_ONLY);
+		}
+		return -2;
+	}
+	default:
+		abort_unzip(PASS_STATE_ONLY);
+	}
+}
+#endif /* FEATURE_GZIP_DECOMPRESS_FAST */
+
 /* Two callsites, both in inflate_get_next_window */
 static void calculate_gunzip_crc(STATE_PARAM_ONLY)
 {
-	gunzip_crc = crc32_block_endian0(gunzip_crc, gunzip_window, gunzip_outbuf_count, gunzip_crc_table);
-	gunzip_bytes_out += gunzip_outbuf_count;
+	unsigned n = gunzip_outbuf_count - gunzip_outbuf_start;
+
+	gunzip_crc = crc32_block_endian0(gunzip_crc, gunzip_window + gunzip_outbuf_start, n, gunzip_crc_table);
+	gunzip_bytes_out += n;
 }
 
 /* One callsite in inflate_unzip_internal */
 static int inflate_get_next_window(STATE_PARAM_ONLY)
 {
+#if ENABLE_FEATURE_GZIP_DECOMPRESS_FAST
+	/* keep the last 32K as history for the next matches */
+	if (gunzip_outbuf_count > GUNZIP_WSIZE) {
+		memmove(gunzip_window, gunzip_window + gunzip_outbuf_count - GUNZIP_WSIZE, GUNZIP_WSIZE);
+		gunzip_outbuf_count = GUNZIP_WSIZE;
+	}
+	gunzip_outbuf_start = gunzip_outbuf_count;
+#else
 	gunzip_outbuf_count = 0;
+#endif
 
 	while (1) {
 		int ret;
@@ -1007,7 +1523,7 @@ inflate_unzip_internal(STATE_PARAM transformer_state_t *xstate)
 	ssize_t nwrote;
 
 	/* Allocate all global buffers (for DYN_ALLOC option) */
-	gunzip_window = xmalloc(GUNZIP_WSIZE);
+	gunzip_window = xmalloc(GUNZIP_OUTBUF_SIZE);
 	gunzip_outbuf_count = 0;
 	gunzip_bytes_out = 0;
 	gunzip_src_fd = xstate->src_fd;
@@ -1015,9 +1531,15 @@ inflate_unzip_internal(STATE_PARAM transformer_state_t *xstate)
 	/* (re) initialize state */
 	method = -1;
 	need_another_block = 1;
+#if ENABLE_FEATURE_GZIP_DECOMPRESS_FAST
+	inflate_bitbuf = 0;
+	inflate_bitcnt = 0;
+	inflate_overrun = 0;
+#else
 	resume_copy = 0;
 	gunzip_bk = 0;
 	gunzip_bb = 0;
+#endif
 
 	/* Create the crc table */
 	gunzip_crc_table = crc32_new_table_le();
@@ -1033,7 +1555,8 @@ inflate_unzip_internal(STATE_PARAM transformer_state_t *xstate)
 
 	while (1) {
 		int r = inflate_get_next_window(PASS_STATE_ONLY);
-		nwrote = transformer_write(xstate, gunzip_window, gunzip_outbuf_count);
+		nwrote = transformer_write(xstate, gunzip_window + gunzip_outbuf_start,
+				gunzip_outbuf_count - gunzip_outbuf_start);
 		if (nwrote == (ssize_t)-1) {
 			n = -1;
 			goto ret;
@@ -1043,6 +1566,9 @@ inflate_unzip_internal(STATE_PARAM transformer_state_t *xstate)
 	}
 
 	/* Store unused bytes in a global buffer so calling applets can access it */
+#if ENABLE_FEATURE_GZIP_DECOMPRESS_FAST
+	return_bytes(PASS_STATE_ONLY);
+#else
 	if (gunzip_bk >= 8) {
 		/* Undo too much lookahead. The next read will be byte aligned
 		 * so we can discard unused bits in the last meaningful byte. */
@@ -1051,6 +1577,7 @@ inflate_unzip_internal(STATE_PARAM transformer_state_t *xstate)
 		gunzip_bb >>= 8;
 		gunzip_bk -= 8;
 	}
+#endif
  ret:
 	/* Cleanup */
 	free(gunzip_window);
@@ -152,3 +152,384 @@ unpack_xz_stream(transformer_state_t *xstate)
 
 	return total;
 }
+
+#if ENABLE_FEATURE_UNXZ_PARALLEL
+/* Decompression in N processes.
+ *
+ * Every stream ends with an index of the sizes of its blocks, and the
+ * footer after it gives the size of the index. In a regular file the
+ * parent can walk these from the end of the file back to the start
+ * and find where every block is. Each child then decodes one block.
+ * It wraps the block in a stream with only that block, so the usual
+ * decoder checks the block against its index record. The parent copies
+ * the output of the children in order. Files that have only one block,
+ * or whose tail is not a valid stream, are decoded serially.
+ */
+enum {
+	XZ_HEADER_SIZE = 12, /* also the size of stream footer */
+	XZ_INDEX_MAX = 16 * 1024 * 1024,
+	PAR_FRAME_SIZE = 64 * 1024,
+	PAR_CORRUPTED = 1,
+	PAR_READ_ERROR = 2,
+	MAX_JOBS = 64,
+};
+
+struct xz_block {
+	uint64_t offset; /* in the file */
+	uint64_t unpadded;
+	uint64_t uncompressed;
+	uint8_t flags; /* check type of the stream */
+};
+
+struct xz_job {
+	pid_t pid;
+	int fd;
+};
+
+static int xz_pread(int fd, void *buf, size_t len, off_t pos)
+{
+	return pread(fd, buf, len, pos) == (ssize_t)len;
+}
+
+static unsigned xz_get_vli(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+	unsigned n = 0;
+
+	*v = 0;
+	do {
+		if (p + n == end || n == 9)
+			return 0;
+		*v |= (uint64_t)(p[n] & 0x7f) << (n * 7);
+	} while (p[n++] & 0x80);
+	return n;
+}
+
+static unsigned xz_put_vli(uint8_t *p, uint64_t v)
+{
+	unsigned n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+/* Find the blocks of all streams from start to the end of the file.
+ * Returns the number of blocks, or -1 if the file is not a sequence
+ * of complete streams */
+static int xz_read_index(int fd, off_t start, off_t pos, struct xz_block **blocks)
+{
+	struct xz_block *b = NULL;
+	unsigned nb = 0;
+	uint8_t *idx = NULL;
+	uint8_t h[XZ_HEADER_SIZE];
+
+	while (pos > start) {
+		uint64_t count, blocks_size;
+		const uint8_t *p, *end;
+		uint32_t index_size;
+		unsigned n, first = nb;
+		uint8_t check;
+		off_t sstart;
+
+		/* Stream padding */
+		if (!xz_pread(fd, h, 4, pos - 4))
+			goto bad;
+		if (get_unaligned_le32(h) == 0) {
+			pos -= 4;
+			continue;
+		}
+
+		/* Stream footer */
+		if (pos - start < 2 * XZ_HEADER_SIZE
+		 || !xz_pread(fd, h, XZ_HEADER_SIZE, pos - XZ_HEADER_SIZE)
+		 || h[10] != 'Y' || h[11] != 'Z' || h[8] != 0 || h[9] > 0x0f
+		 || xz_crc32(h + 4, 6, 0) != get_unaligned_le32(h)
+		) {
+			goto bad;
+		}
+		check = h[9];
+		index_size = (get_unaligned_le32(h + 4) + 1) * 4;
+		if (index_size > XZ_INDEX_MAX
+		 || index_size + 2 * XZ_HEADER_SIZE > pos - start
+		) {
+			goto bad;
+		}
+		pos -= XZ_HEADER_SIZE + index_size;
+		idx = xrealloc(idx, index_size);
+		if (!xz_pread(fd, idx, index_size, pos)
+		 || idx[0] != 0x00
+		 || xz_crc32(idx, index_size - 4, 0) != get_unaligned_le32(idx + index_size - 4)
+		) {
+			goto bad;
+		}
+
+		/* Index records */
+		p = idx + 1;
+		end = idx + index_size - 4;
+		n = xz_get_vli(p, end, &count);
+		if (n == 0 || count > index_size / 2)
+			goto bad;
+		p += n;
+		b = xrealloc(b, (nb + (unsigned)count) * sizeof(b[0]));
+		blocks_size = 0;
+		while (count-- != 0) {
+			struct xz_block *r = &b[nb++];
+
+			n = xz_get_vli(p, end, &r->unpadded);
+			if (n == 0)
+				goto bad;
+			p += n;
+			n = xz_get_vli(p, end, &r->uncompressed);
+			if (n == 0 || r->unpadded == 0 || r->unpadded > (uint64_t)(pos - start))
+				goto bad;
+			p += n;
+			r->offset = blocks_size; /* from the end of stream header */
+			r->flags = check;
+			blocks_size += (r->unpadded + 3) & ~(uint64_t)3;
+		}
+		if (end - p > 3)
+			goto bad;
+		while (p != end)
+			if (*p++ != 0)
+				goto bad;
+		if (blocks_size > (uint64_t)(pos - start) - XZ_HEADER_SIZE)
+			goto bad;
+		sstart = pos - blocks_size - XZ_HEADER_SIZE;
+
+		/* Stream header */
+		if (!xz_pread(fd, h, XZ_HEADER_SIZE, sstart)
+		 || memcmp(h, HEADER_MAGIC, HEADER_MAGIC_SIZE) != 0
+		 || h[6] != 0 || h[7] != check
+		 || xz_crc32(h + 6, 2, 0) != get_unaligned_le32(h + 8)
+		) {
+			goto bad;
+		}
+		for (n = first; n < nb; n++)
+			b[n].offset += sstart + XZ_HEADER_SIZE;
+		/* Streams are found last to first, keep blocks in order */
+		if (first != 0 && nb != first) {
+			unsigned cnt = nb - first;
+			struct xz_block *tmp = xmalloc(cnt * sizeof(*tmp));
+
+			memcpy(tmp, b + first, cnt * sizeof(*tmp));
+			memmove(b + cnt, b, first * sizeof(*tmp));
+			memcpy(b, tmp, cnt * sizeof(*tmp));
+			free(tmp);
+		}
+		pos = sstart;
+	}
+	if (pos != start)
+		goto bad;
+	free(idx);
+	*blocks = b;
+	return nb;
+ bad:
+	free(idx);
+	free(b);
+	return -1;
+}
+
+/* Runs in the child: decode one block, send its output to fd in frames
+ * of a 32-bit length and data, then a 0 length and the status */
+static void xz_decode_block(int src_fd, const struct xz_block *blk, int fd) NORETURN;
+static void xz_decode_block(int src_fd, const struct xz_block *blk, int fd)
+{
+	uint8_t head[XZ_HEADER_SIZE];
+	uint8_t tail[32];
+	uint32_t *frame;
+	struct xz_buf iobuf;
+	struct xz_dec *state;
+	uint8_t *inbuf;
+	uint64_t left = (blk->unpadded + 3) & ~(uint64_t)3;
+	off_t pos = blk->offset;
+	unsigned n, phase = 0;
+	int status = PAR_CORRUPTED;
+
+	/* A stream with this block only: header, block, index, footer */
+	memcpy(head, HEADER_MAGIC, HEADER_MAGIC_SIZE);
+	head[6] = 0;
+	head[7] = blk->flags;
+	put_unaligned_le32(xz_crc32(head + 6, 2, 0), head + 8);
+	tail[0] = 0x00;
+	tail[1] = 1;
+	n = 2;
+	n += xz_put_vli(tail + n, blk->unpadded);
+	n += xz_put_vli(tail + n, blk->uncompressed);
+	while (n & 3)
+		tail[n++] = 0;
+	put_unaligned_le32(xz_crc32(tail, n, 0), tail + n);
+	n += 4;
+	put_unaligned_le32(n / 4 - 1, tail + n + 4);
+	tail[n + 8] = 0;
+	tail[n + 9] = blk->flags;
+	put_unaligned_le32(xz_crc32(tail + n + 4, 6, 0), tail + n);
+	tail[n + 10] = 'Y';
+	tail[n + 11] = 'Z';
+	n += XZ_HEADER_SIZE;
+
+	inbuf = xmalloc(BUFSIZ);
+	frame = xmalloc(sizeof(frame[0]) + PAR_FRAME_SIZE);
+	memset(&iobuf, 0, sizeof(iobuf));
+	iobuf.out = (uint8_t*)(frame + 1);
+	iobuf.out_size = PAR_FRAME_SIZE;
+	state = xz_dec_init(XZ_DYNALLOC, 64*1024*1024);
+
+	for (;;) {
+		enum xz_ret xz_result;
+
+		if (iobuf.in_pos == iobuf.in_size) {
+			iobuf.in_pos = 0;
+			if (phase == 0) {
+				iobuf.in = head;
+				iobuf.in_size = XZ_HEADER_SIZE;
+				phase = 1;
+			} else if (left != 0) {
+				ssize_t rd = pread(src_fd, inbuf, MIN(left, BUFSIZ), pos);
+				if (rd <= 0) {
+					status = PAR_READ_ERROR;
+					break;
+				}
+				iobuf.in = inbuf;
+				iobuf.in_size = rd;
+				pos += rd;
+				left -= rd;
+			} else if (phase == 1) {
+				iobuf.in = tail;
+				iobuf.in_size = n;
+				phase = 2;
+			} else {
+				break; /* no stream end? */
+			}
+		}
+		xz_result = xz_dec_run(state, &iobuf);
+		if (iobuf.out_pos != 0) {
+			frame[0] = iobuf.out_pos;
+			xwrite(fd, frame, sizeof(frame[0]) + iobuf.out_pos);
+			iobuf.out_pos = 0;
+		}
+		if (xz_result == XZ_STREAM_END) {
+			status = 0;
+			break;
+		}
+		if (xz_result != XZ_OK && xz_result != XZ_UNSUPPORTED_CHECK)
+			break;
+	}
+	frame[0] = 0;
+	xwrite(fd, frame, sizeof(frame[0]));
+	xwrite(fd, &status, sizeof(status));
+	_exit(EXIT_SUCCESS);
+}
+
+/* Copy the output of a child to the destination */
+static int xz_job_output(transformer_state_t *xstate, struct xz_job *job, uint8_t *buf)
+{
+	uint32_t n;
+	int status;
+
+	for (;;) {
+		if (full_read(job->fd, &n, sizeof(n)) != sizeof(n))
+			return PAR_CORRUPTED; /* the child has died */
+		if (n == 0)
+			break;
+		if (n > PAR_FRAME_SIZE || full_read(job->fd, buf, n) != n)
+			return PAR_CORRUPTED;
+		xtransformer_write(xstate, buf, n);
+	}
+	if (full_read(job->fd, &status, sizeof(status)) != sizeof(status))
+		return PAR_CORRUPTED;
+	return status;
+}
+
+static void xz_end_job(struct xz_job *job, int kill_it)
+{
+	if (kill_it)
+		kill(job->pid, SIGKILL);
+	close(job->fd);
+	safe_waitpid(job->pid, NULL, 0);
+}
+
+IF_DESKTOP(long long) int FAST_FUNC
+unpack_xz_stream_parallel(transformer_state_t *xstate, unsigned njobs)
+{
+	IF_DESKTOP(long long total = 0;)
+	struct xz_job job[MAX_JOBS];
+	unsigned first = 0, running = 0, next = 0, done = 0;
+	struct xz_block *blocks;
+	struct stat st;
+	uint8_t *outbuf;
+	off_t start;
+	int nblocks, status = 0;
+
+	if (njobs > MAX_JOBS)
+		njobs = MAX_JOBS;
+	/* The index is at the end: need a file we can seek in,
+	 * with nothing read from it yet */
+	if (njobs <= 1 || xstate->signature_skipped
+	 || fstat(xstate->src_fd, &st) != 0 || !S_ISREG(st.st_mode)
+	 || (start = lseek(xstate->src_fd, 0, SEEK_CUR)) < 0
+	) {
+		return unpack_xz_stream(xstate);
+	}
+	if (!global_crc32_table)
+		global_crc32_new_table_le();
+	nblocks = xz_read_index(xstate->src_fd, start, st.st_size, &blocks);
+	if (nblocks < 2) {
+		if (nblocks >= 0)
+			free(blocks);
+		return unpack_xz_stream(xstate);
+	}
+
+	outbuf = xmalloc(PAR_FRAME_SIZE);
+	while (done < (unsigned)nblocks) {
+		struct xz_job *j;
+
+		while (running < njobs && next < (unsigned)nblocks) {
+			int p[2];
+
+			j = &job[(first + running) % njobs];
+			xpipe(p);
+# ifdef F_SETPIPE_SZ
+			/* let the child write all of its output without waiting
+			 * for us to collect the jobs started before it */
+			fcntl(p[1], F_SETPIPE_SZ, 1024 * 1024);
+# endif
+			j->pid = xfork();
+			if (j->pid == 0) {
+				close(p[0]);
+				xz_decode_block(xstate->src_fd, &blocks[next], p[1]);
+			}
+			close(p[1]);
+			j->fd = p[0];
+			running++;
+			next++;
+		}
+
+		j = &job[first];
+		status = xz_job_output(xstate, j, outbuf);
+		xz_end_job(j, status != 0);
+		first = (first + 1) % njobs;
+		running--;
+		if (status != 0)
+			break;
+		IF_DESKTOP(total += blocks[done].uncompressed;)
+		done++;
+	}
+	while (running != 0) {
+		xz_end_job(&job[first], 1);
+		first = (first + 1) % njobs;
+		running--;
+	}
+
+	if (status == PAR_READ_ERROR)
+		bb_simple_error_msg(bb_msg_read_error);
+	else if (status != 0)
+		bb_simple_error_msg("corrupted data");
+
+	free(outbuf);
+	free(blocks);
+	return status ? -1 : IF_DESKTOP(total) + 0;
+}
+#endif
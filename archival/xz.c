@@ -0,0 +1,1301 @@
+/* vi: set sw=4 ts=4: */
+/*
+ * xz compressor: LZMA2 in the .xz container.
+ *
+ * The LZMA encoder follows the design of the public domain LZMA SDK
+ * by Igor Pavlov and of XZ Utils by Lasse Collin: a range coder with
+ * adaptive binary models, hash chain and binary tree match finders,
+ * and the "fast" parser, which looks one byte ahead to decide between
+ * a match and a literal.
+ *
+ * Licensed under GPLv2 or later, see file LICENSE in this source tree.
+ */
+//config:config FEATURE_XZ_COMPRESS
+//config:	bool "Enable compression"
+//config:	default y
+//config:	depends on XZ
+//config:	help
+//config:	Without -d, xz compresses. Levels -0..-3 use a hash chain
+//config:	match finder, -4..-9 a binary tree one; the dictionary is
+//config:	256k..64M. The block check is CRC32.
+//config:
+//config:config FEATURE_XZ_PARALLEL
+//config:	bool "Enable -T N (compress in N processes)"
+//config:	default y
+//config:	depends on FEATURE_XZ_COMPRESS && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	Split the input into blocks of three times the dictionary
+//config:	size and compress up to N of them at once in child processes.
+//config:	Blocks are independent and have their sizes in their headers,
+//config:	so they can be decompressed in parallel as well.
+
+//applet:IF_FEATURE_XZ_COMPRESS(APPLET(xz, BB_DIR_USR_BIN, BB_SUID_DROP))
+
+//kbuild:lib-$(CONFIG_FEATURE_XZ_COMPRESS) += xz.o
+
+//usage:#if ENABLE_FEATURE_XZ_COMPRESS
+//usage:#define xz_trivial_usage
+//usage:       "[-cfkdt0123456789]" IF_FEATURE_XZ_PARALLEL(" [-T N]") " [FILE]..."
+//usage:#define xz_full_usage "\n\n"
+//usage:       "Compress FILEs (or stdin) with xz algorithm\n"
+//usage:     "\n	-0..9	Compression level"
+//usage:     "\n	-d	Decompress"
+//usage:     "\n	-c	Write to stdout"
+//usage:     "\n	-f	Force"
+//usage:     "\n	-k	Keep input files"
+//usage:     "\n	-t	Test integrity"
+//usage:	IF_FEATURE_XZ_PARALLEL(
+//usage:     "\n	-T N	Use N processes (0: one per CPU)"
+//usage:	)
+//usage:#endif
+
+#include "libbb.h"
+#include "bb_archive.h"
+
+enum {
+	LC = 3, /* literal context bits */
+	LP = 0, /* literal position bits */
+	PB = 2, /* position bits */
+	POS_STATES = 1 << PB,
+
+	MATCH_LEN_MIN = 2,
+	MATCH_LEN_MAX = 273,
+	REPS = 4,
+	STATES = 12,
+	LIT_STATES = 7,
+	LEN_LOW_BITS = 3,
+	LEN_MID_BITS = 3,
+	LEN_HIGH_BITS = 8,
+	LEN_LOW_SYMBOLS = 1 << LEN_LOW_BITS,
+	LEN_MID_SYMBOLS = 1 << LEN_MID_BITS,
+	DIST_STATES = 4,
+	DIST_SLOT_BITS = 6,
+	DIST_MODEL_START = 4,
+	DIST_MODEL_END = 14,
+	FULL_DISTANCES = 1 << (DIST_MODEL_END / 2),
+	ALIGN_BITS = 4,
+	ALIGN_MASK = (1 << ALIGN_BITS) - 1,
+
+	RC_TOP = 1 << 24,
+	RC_BIT_MODEL_TOTAL_BITS = 11,
+	RC_BIT_MODEL_TOTAL = 1 << RC_BIT_MODEL_TOTAL_BITS,
+	RC_MOVE_BITS = 5,
+
+	/* LZMA2 chunk limits */
+	CHUNK_UNCOMPRESSED_MAX = 1 << 21,
+	CHUNK_COMPRESSED_MAX = 1 << 16,
+	/* room for one more symbol and for flushing the range coder */
+	CHUNK_MARGIN = 64,
+
+	HASH2_SIZE = 1 << 10,
+	HASH3_SIZE = 1 << 16,
+	/* when positions get this big, renumber them */
+	POS_LIMIT = 0xf0000000,
+
+	CHECK_CRC32 = 1,
+	CHECK_SIZE = 4,
+	FILTER_LZMA2 = 0x21,
+};
+
+typedef uint16_t prob_t;
+
+struct len_enc {
+	prob_t choice;
+	prob_t choice2;
+	prob_t low[POS_STATES][LEN_LOW_SYMBOLS];
+	prob_t mid[POS_STATES][LEN_MID_SYMBOLS];
+	prob_t high[1 << LEN_HIGH_BITS];
+};
+
+/* All of this is reset to "probability 1/2" on a state reset */
+struct lzma_probs {
+	prob_t is_match[STATES][POS_STATES];
+	prob_t is_rep[STATES];
+	prob_t is_rep0[STATES];
+	prob_t is_rep1[STATES];
+	prob_t is_rep2[STATES];
+	prob_t is_rep0_long[STATES][POS_STATES];
+	prob_t dist_slot[DIST_STATES][1 << DIST_SLOT_BITS];
+	/* [0] is unused, the reverse bit trees index from 1 */
+	prob_t dist_special[1 + FULL_DISTANCES - DIST_MODEL_END];
+	prob_t dist_align[1 << ALIGN_BITS];
+	struct len_enc match_len;
+	struct len_enc rep_len;
+	prob_t literal[1 << (LC + LP)][0x300];
+};
+
+struct lz_match {
+	uint32_t len;
+	uint32_t dist;
+};
+
+struct xz_enc {
+	/* Range coder, writes to out[] */
+	uint64_t low;
+	uint32_t range;
+	uint32_t cache_size;
+	uint8_t cache;
+	unsigned out_pos;
+
+	/* LZMA */
+	unsigned state;
+	uint32_t reps[REPS];
+	uint32_t position; /* uncompressed bytes in block, mod 2^32 */
+	struct lzma_probs p;
+
+	/* Match finder. buf[read_pos] is the next byte it looks at,
+	 * the encoder is read_ahead bytes behind it */
+	uint8_t *buf;
+	uint32_t buf_size;
+	uint32_t read_pos;
+	uint32_t write_pos;
+	uint32_t read_ahead;
+	uint32_t pos; /* position numbers stored in hash[] and son[] */
+	uint32_t cyclic_pos;
+	uint32_t cyclic_size;
+	uint32_t dict_size;
+	uint32_t nice_len;
+	uint32_t depth;
+	uint32_t hash_mask;
+	uint32_t hash_count;
+	uint32_t *hash;
+	uint32_t *son;
+	smallint bt;
+	smallint eof;
+	unsigned matches_count;
+	uint32_t longest_match_len;
+	struct lz_match matches[MATCH_LEN_MAX + 1];
+
+	/* Input: fd, or all of buf[] if -1 */
+	int in_fd;
+	uint32_t crc; /* of input, not inverted yet */
+	uint64_t in_size;
+
+	/* Output of compressed data: fd, or obuf[] if -1 */
+	int out_fd;
+	uint8_t *obuf;
+	size_t olen, osize;
+	uint64_t out_size;
+	smallint write_error;
+
+	uint8_t out[CHUNK_COMPRESSED_MAX + CHUNK_MARGIN];
+};
+
+static const struct {
+	uint8_t dict_log;
+	uint8_t bt;
+	uint16_t nice_len;
+	uint16_t depth;
+} xz_levels[10] = {
+	{ 18, 0, 128,  4 },
+	{ 20, 0, 128,  8 },
+	{ 21, 0, 273, 24 },
+	{ 22, 0, 273, 48 },
+	{ 22, 1,  32, 32 },
+	{ 23, 1,  64, 48 },
+	{ 23, 1, 128, 80 },
+	{ 24, 1, 128, 80 },
+	{ 25, 1, 192, 112 },
+	{ 26, 1, 273, 152 },
+};
+
+#if ENABLE_FEATURE_XZ_PARALLEL || ENABLE_FEATURE_UNXZ_PARALLEL
+static unsigned xz_jobs = 1; /* -T N, xz -d takes it too */
+#endif
+
+
+/* ======================================================================
+ * Output
+ */
+
+static void xz_write(struct xz_enc *e, const void *buf, size_t len)
+{
+	if (e->out_fd < 0) {
+		if (e->olen + len > e->osize) {
+			e->osize = e->olen + len + e->osize / 2;
+			e->obuf = xrealloc(e->obuf, e->osize);
+		}
+		memcpy(e->obuf + e->olen, buf, len);
+		e->olen += len;
+	} else if (!e->write_error) {
+		if (full_write(e->out_fd, buf, len) != (ssize_t)len) {
+			bb_simple_perror_msg(bb_msg_write_error);
+			e->write_error = 1;
+		}
+	}
+	e->out_size += len;
+}
+
+/* Variable length integer: 7 bits per byte, low bits first */
+static unsigned put_vli(uint8_t *p, uint64_t v)
+{
+	unsigned n = 0;
+
+	while (v >= 0x80) {
+		p[n++] = (uint8_t)v | 0x80;
+		v >>= 7;
+	}
+	p[n++] = v;
+	return n;
+}
+
+static uint32_t xz_crc32(const void *buf, unsigned len)
+{
+	return ~crc32_block_endian0(0xffffffff, buf, len, global_crc32_table);
+}
+
+
+/* ======================================================================
+ * Range coder
+ */
+
+static void rc_reset(struct xz_enc *e)
+{
+	e->low = 0;
+	e->range = 0xffffffff;
+	e->cache_size = 1;
+	e->cache = 0;
+	e->out_pos = 0;
+}
+
+static void rc_shift_low(struct xz_enc *e)
+{
+	if ((uint32_t)e->low < 0xff000000 || (uint32_t)(e->low >> 32) != 0) {
+		uint8_t carry = e->low >> 32;
+		uint8_t c = e->cache;
+
+		do {
+			e->out[e->out_pos++] = c + carry;
+			c = 0xff;
+		} while (--e->cache_size != 0);
+		e->cache = (e->low >> 24) & 0xff;
+	}
+	e->cache_size++;
+	e->low = (e->low & 0x00ffffff) << 8;
+}
+
+static ALWAYS_INLINE void rc_bit(struct xz_enc *e, prob_t *prob, unsigned bit)
+{
+	uint32_t bound = (e->range >> RC_BIT_MODEL_TOTAL_BITS) * *prob;
+
+	if (!bit) {
+		e->range = bound;
+		*prob += (RC_BIT_MODEL_TOTAL - *prob) >> RC_MOVE_BITS;
+	} else {
+		e->low += bound;
+		e->range -= bound;
+		*prob -= *prob >> RC_MOVE_BITS;
+	}
+	if (e->range < RC_TOP) {
+		e->range <<= 8;
+		rc_shift_low(e);
+	}
+}
+
+static void rc_bittree(struct xz_enc *e, prob_t *probs, int nbits, uint32_t symbol)
+{
+	uint32_t model = 1;
+
+	do {
+		unsigned bit = (symbol >> --nbits) & 1;
+		rc_bit(e, &probs[model], bit);
+		model = (model << 1) | bit;
+	} while (nbits != 0);
+}
+
+static void rc_bittree_reverse(struct xz_enc *e, prob_t *probs, int nbits, uint32_t symbol)
+{
+	uint32_t model = 1;
+
+	do {
+		unsigned bit = symbol & 1;
+		symbol >>= 1;
+		rc_bit(e, &probs[model], bit);
+		model = (model << 1) | bit;
+	} while (--nbits != 0);
+}
+
+static void rc_direct(struct xz_enc *e, uint32_t value, int nbits)
+{
+	do {
+		e->range >>= 1;
+		nbits--;
+		e->low += e->range & (0 - ((value >> nbits) & 1));
+		if (e->range < RC_TOP) {
+			e->range <<= 8;
+			rc_shift_low(e);
+		}
+	} while (nbits != 0);
+}
+
+static void rc_flush(struct xz_enc *e)
+{
+	int i;
+	for (i = 0; i < 5; i++)
+		rc_shift_low(e);
+}
+
+
+/* ======================================================================
+ * Match finder
+ */
+
+static uint32_t memcmplen(const uint8_t *a, const uint8_t *b, uint32_t len, uint32_t limit)
+{
+	while (len < limit && a[len] == b[len])
+		len++;
+	return len;
+}
+
+/* Renumber positions so that they don't overflow */
+static void mf_normalize(struct xz_enc *e)
+{
+	uint32_t sub = e->pos - e->cyclic_size;
+	uint32_t i, n;
+
+	n = e->hash_count;
+	for (i = 0; i < n; i++)
+		e->hash[i] = e->hash[i] < sub ? 0 : e->hash[i] - sub;
+	n = e->cyclic_size << e->bt;
+	for (i = 0; i < n; i++)
+		e->son[i] = e->son[i] < sub ? 0 : e->son[i] - sub;
+	e->pos -= sub;
+}
+
+static void mf_move_pos(struct xz_enc *e)
+{
+	if (++e->cyclic_pos == e->cyclic_size)
+		e->cyclic_pos = 0;
+	e->read_pos++;
+	if (++e->pos >= POS_LIMIT)
+		mf_normalize(e);
+}
+
+/* Hash the 2, 3 and 4 bytes at cur, return the old heads of
+ * the chains and make the current position the new head */
+static uint32_t mf_hash(struct xz_enc *e, const uint8_t *cur,
+		uint32_t *delta2, uint32_t *delta3)
+{
+	uint32_t *hash = e->hash;
+	uint32_t t, h2, h3, h4, cur_match;
+
+	t = global_crc32_table[cur[0]] ^ cur[1];
+	h2 = t & (HASH2_SIZE - 1);
+	t ^= (uint32_t)cur[2] << 8;
+	h3 = HASH2_SIZE + (t & (HASH3_SIZE - 1));
+	h4 = HASH2_SIZE + HASH3_SIZE
+		+ ((t ^ (global_crc32_table[cur[3]] << 5)) & e->hash_mask);
+
+	*delta2 = e->pos - hash[h2];
+	*delta3 = e->pos - hash[h3];
+	cur_match = hash[h4];
+	hash[h2] = hash[h3] = hash[h4] = e->pos;
+	return cur_match;
+}
+
+static struct lz_match *hc_find(struct xz_enc *e, uint32_t len_limit,
+		const uint8_t *cur, uint32_t cur_match,
+		struct lz_match *m, uint32_t len_best)
+{
+	uint32_t depth = e->depth;
+
+	e->son[e->cyclic_pos] = cur_match;
+	for (;;) {
+		uint32_t delta = e->pos - cur_match;
+		const uint8_t *pb;
+
+		if (depth-- == 0 || delta >= e->cyclic_size)
+			return m;
+		pb = cur - delta;
+		cur_match = e->son[e->cyclic_pos - delta
+				+ (delta > e->cyclic_pos ? e->cyclic_size : 0)];
+		if (pb[len_best] == cur[len_best] && pb[0] == cur[0]) {
+			uint32_t len = memcmplen(pb, cur, 1, len_limit);
+			if (len_best < len) {
+				len_best = len;
+				m->len = len;
+				m->dist = delta - 1;
+				m++;
+				if (len == len_limit)
+					return m;
+			}
+		}
+	}
+}
+
+/* Binary tree: son[] has two links for every position, to the previous
+ * positions whose strings compare smaller and larger. The tree is
+ * rebuilt along the search path with the current position as the root.
+ * If m is NULL, only the tree is updated */
+static struct lz_match *bt_find(struct xz_enc *e, uint32_t len_limit,
+		const uint8_t *cur, uint32_t cur_match,
+		struct lz_match *m, uint32_t len_best)
+{
+	uint32_t *ptr0 = e->son + (e->cyclic_pos << 1) + 1;
+	uint32_t *ptr1 = e->son + (e->cyclic_pos << 1);
+	uint32_t len0 = 0, len1 = 0;
+	uint32_t depth = e->depth;
+
+	for (;;) {
+		uint32_t delta = e->pos - cur_match;
+		uint32_t *pair;
+		const uint8_t *pb;
+		uint32_t len;
+
+		if (depth-- == 0 || delta >= e->cyclic_size) {
+			*ptr0 = 0;
+			*ptr1 = 0;
+			return m;
+		}
+		pair = e->son + ((e->cyclic_pos - delta
+				+ (delta > e->cyclic_pos ? e->cyclic_size : 0)) << 1);
+		pb = cur - delta;
+		len = MIN(len0, len1);
+		if (pb[len] == cur[len]) {
+			len = memcmplen(pb, cur, len + 1, len_limit);
+			if (len_best < len) {
+				len_best = len;
+				if (m) {
+					m->len = len;
+					m->dist = delta - 1;
+					m++;
+				}
+				if (len == len_limit) {
+					*ptr1 = pair[0];
+					*ptr0 = pair[1];
+					return m;
+				}
+			}
+		}
+		if (pb[len] < cur[len]) {
+			*ptr1 = cur_match;
+			ptr1 = pair + 1;
+			cur_match = *ptr1;
+			len1 = len;
+		} else {
+			*ptr0 = cur_match;
+			ptr0 = pair;
+			cur_match = *ptr0;
+			len0 = len;
+		}
+	}
+}
+
+/* Find matches at read_pos, longest last, and move on */
+static unsigned mf_find_matches(struct xz_enc *e)
+{
+	const uint8_t *cur = e->buf + e->read_pos;
+	uint32_t len_limit = e->write_pos - e->read_pos;
+	uint32_t delta2, delta3, cur_match;
+	uint32_t len_best = 1;
+	struct lz_match *m = e->matches;
+	unsigned count = 0;
+
+	if (e->nice_len <= len_limit)
+		len_limit = e->nice_len;
+	else if (len_limit < 4) {
+		/* end of input */
+		mf_move_pos(e);
+		return 0;
+	}
+
+	cur_match = mf_hash(e, cur, &delta2, &delta3);
+	if (delta2 < e->cyclic_size && *(cur - delta2) == *cur) {
+		len_best = 2;
+		m[0].len = 2;
+		m[0].dist = delta2 - 1;
+		count = 1;
+	}
+	if (delta2 != delta3 && delta3 < e->cyclic_size && *(cur - delta3) == *cur) {
+		len_best = 3;
+		m[count++].dist = delta3 - 1;
+		delta2 = delta3;
+	}
+	if (count != 0) {
+		len_best = memcmplen(cur - delta2, cur, len_best, len_limit);
+		m[count - 1].len = len_best;
+		if (len_best == len_limit) {
+			/* long enough, just add the position */
+			if (e->bt)
+				bt_find(e, len_limit, cur, cur_match, NULL, 0);
+			else
+				e->son[e->cyclic_pos] = cur_match;
+			mf_move_pos(e);
+			return count;
+		}
+	}
+	if (len_best < 3)
+		len_best = 3;
+	if (e->bt)
+		count = bt_find(e, len_limit, cur, cur_match, m + count, len_best) - m;
+	else
+		count = hc_find(e, len_limit, cur, cur_match, m + count, len_best) - m;
+	mf_move_pos(e);
+	return count;
+}
+
+/* Returns the length of the longest match */
+static uint32_t mf_find(struct xz_enc *e)
+{
+	unsigned count = mf_find_matches(e);
+	uint32_t len_best = 0;
+
+	if (count != 0) {
+		len_best = e->matches[count - 1].len;
+		if (len_best == e->nice_len) {
+			/* The finder stops at nice_len, the match may go on */
+			uint32_t limit = MIN(e->write_pos - e->read_pos + 1, MATCH_LEN_MAX);
+			const uint8_t *p1 = e->buf + e->read_pos - 1;
+			len_best = memcmplen(p1, p1 - e->matches[count - 1].dist - 1, len_best, limit);
+		}
+	}
+	e->matches_count = count;
+	e->read_ahead++;
+	return len_best;
+}
+
+static void mf_skip(struct xz_enc *e, uint32_t amount)
+{
+	e->read_ahead += amount;
+	while (amount-- != 0) {
+		const uint8_t *cur = e->buf + e->read_pos;
+		uint32_t len_limit = e->write_pos - e->read_pos;
+		uint32_t delta2, delta3, cur_match;
+
+		if (e->nice_len <= len_limit)
+			len_limit = e->nice_len;
+		else if (len_limit < 4) {
+			mf_move_pos(e);
+			continue;
+		}
+		cur_match = mf_hash(e, cur, &delta2, &delta3);
+		if (e->bt)
+			bt_find(e, len_limit, cur, cur_match, NULL, 0);
+		else
+			e->son[e->cyclic_pos] = cur_match;
+		mf_move_pos(e);
+	}
+}
+
+#define KEEP_SIZE(e) MAX((e)->dict_size + 1, (uint32_t)CHUNK_UNCOMPRESSED_MAX)
+
+/* Have at least two maximum length matches of lookahead, unless
+ * at the end of input. Returns 0 on read error */
+static int mf_fill(struct xz_enc *e)
+{
+	while (!e->eof && e->write_pos - e->read_pos < 2 * MATCH_LEN_MAX) {
+		ssize_t n;
+
+		if (e->write_pos == e->buf_size) {
+			/* Keep a dictionary and the current chunk (it may
+			 * have to be stored) before the encoder */
+			uint32_t keep = e->read_pos - e->read_ahead;
+			keep = keep > KEEP_SIZE(e) ? keep - KEEP_SIZE(e) : 0;
+			e->write_pos -= keep;
+			e->read_pos -= keep;
+			memmove(e->buf, e->buf + keep, e->write_pos);
+		}
+		n = safe_read(e->in_fd, e->buf + e->write_pos, e->buf_size - e->write_pos);
+		if (n < 0) {
+			bb_simple_perror_msg(bb_msg_read_error);
+			return 0;
+		}
+		if (n == 0)
+			e->eof = 1;
+		e->crc = crc32_block_endian0(e->crc, e->buf + e->write_pos, n, global_crc32_table);
+		e->in_size += n;
+		e->write_pos += n;
+	}
+	return 1;
+}
+
+
+/* ======================================================================
+ * LZMA
+ */
+
+#define change_pair(small_dist, big_dist) (((big_dist) >> 7) > (small_dist))
+
+static void lzma_reset_state(struct xz_enc *e)
+{
+	prob_t *p = (prob_t *)&e->p;
+	unsigned i;
+
+	for (i = 0; i < sizeof(e->p) / sizeof(prob_t); i++)
+		p[i] = RC_BIT_MODEL_TOTAL / 2;
+	e->state = 0;
+	memset(e->reps, 0, sizeof(e->reps));
+}
+
+static void encode_length(struct xz_enc *e, struct len_enc *lc, unsigned pos_state, uint32_t len)
+{
+	len -= MATCH_LEN_MIN;
+	if (len < LEN_LOW_SYMBOLS) {
+		rc_bit(e, &lc->choice, 0);
+		rc_bittree(e, lc->low[pos_state], LEN_LOW_BITS, len);
+		return;
+	}
+	rc_bit(e, &lc->choice, 1);
+	len -= LEN_LOW_SYMBOLS;
+	if (len < LEN_MID_SYMBOLS) {
+		rc_bit(e, &lc->choice2, 0);
+		rc_bittree(e, lc->mid[pos_state], LEN_MID_BITS, len);
+		return;
+	}
+	rc_bit(e, &lc->choice2, 1);
+	rc_bittree(e, lc->high, LEN_HIGH_BITS, len - LEN_MID_SYMBOLS);
+}
+
+static void encode_literal(struct xz_enc *e)
+{
+	uint32_t idx = e->read_pos - e->read_ahead;
+	uint32_t symbol = e->buf[idx] | 0x100;
+	unsigned prev = e->position ? e->buf[idx - 1] : 0;
+	prob_t *probs = e->p.literal[prev >> (8 - LC)];
+
+	if (e->state < LIT_STATES) {
+		rc_bittree(e, probs, 8, symbol & 0xff);
+	} else {
+		/* After a match: code the byte together with
+		 * the one at the last match distance */
+		uint32_t match_byte = e->buf[idx - e->reps[0] - 1];
+		uint32_t offset = 0x100;
+
+		do {
+			uint32_t match_bit;
+
+			match_byte <<= 1;
+			match_bit = match_byte & offset;
+			rc_bit(e, &probs[offset + match_bit + (symbol >> 8)], (symbol >> 7) & 1);
+			symbol <<= 1;
+			offset &= ~(match_byte ^ symbol);
+		} while (symbol < 0x10000);
+	}
+	e->state = e->state < 4 ? 0 : (e->state < 10 ? e->state - 3 : e->state - 6);
+}
+
+static void encode_match(struct xz_enc *e, unsigned pos_state, uint32_t dist, uint32_t len)
+{
+	unsigned dist_slot, n;
+
+	e->state = e->state < LIT_STATES ? 7 : 10;
+	encode_length(e, &e->p.match_len, pos_state, len);
+
+	if (dist < DIST_MODEL_START) {
+		dist_slot = dist;
+	} else {
+		n = 31 - __builtin_clz(dist);
+		dist_slot = (n << 1) | ((dist >> (n - 1)) & 1);
+	}
+	rc_bittree(e, e->p.dist_slot[MIN(len - MATCH_LEN_MIN, DIST_STATES - 1)],
+			DIST_SLOT_BITS, dist_slot);
+	if (dist_slot >= DIST_MODEL_START) {
+		unsigned footer_bits = (dist_slot >> 1) - 1;
+		uint32_t base = (2 | (dist_slot & 1)) << footer_bits;
+		uint32_t reduced = dist - base;
+
+		if (dist_slot < DIST_MODEL_END) {
+			rc_bittree_reverse(e, e->p.dist_special + base - dist_slot,
+					footer_bits, reduced);
+		} else {
+			rc_direct(e, reduced >> ALIGN_BITS, footer_bits - ALIGN_BITS);
+			rc_bittree_reverse(e, e->p.dist_align, ALIGN_BITS, reduced & ALIGN_MASK);
+		}
+	}
+	e->reps[3] = e->reps[2];
+	e->reps[2] = e->reps[1];
+	e->reps[1] = e->reps[0];
+	e->reps[0] = dist;
+}
+
+static void encode_rep_match(struct xz_enc *e, unsigned pos_state, unsigned rep, uint32_t len)
+{
+	if (rep == 0) {
+		rc_bit(e, &e->p.is_rep0[e->state], 0);
+		rc_bit(e, &e->p.is_rep0_long[e->state][pos_state], len != 1);
+	} else {
+		uint32_t dist = e->reps[rep];
+
+		rc_bit(e, &e->p.is_rep0[e->state], 1);
+		if (rep == 1) {
+			rc_bit(e, &e->p.is_rep1[e->state], 0);
+		} else {
+			rc_bit(e, &e->p.is_rep1[e->state], 1);
+			rc_bit(e, &e->p.is_rep2[e->state], rep - 2);
+			if (rep == 3)
+				e->reps[3] = e->reps[2];
+			e->reps[2] = e->reps[1];
+		}
+		e->reps[1] = e->reps[0];
+		e->reps[0] = dist;
+	}
+	if (len == 1) {
+		e->state = e->state < LIT_STATES ? 9 : 11;
+	} else {
+		encode_length(e, &e->p.rep_len, pos_state, len);
+		e->state = e->state < LIT_STATES ? 8 : 11;
+	}
+}
+
+/* back: UINT32_MAX for a literal, 0..3 for a repeated match,
+ * REPS + distance for a match */
+static void encode_symbol(struct xz_enc *e, uint32_t back, uint32_t len)
+{
+	unsigned pos_state = e->position & (POS_STATES - 1);
+
+	if (back == UINT32_MAX) {
+		rc_bit(e, &e->p.is_match[e->state][pos_state], 0);
+		encode_literal(e);
+	} else {
+		rc_bit(e, &e->p.is_match[e->state][pos_state], 1);
+		if (back < REPS) {
+			rc_bit(e, &e->p.is_rep[e->state], 1);
+			encode_rep_match(e, pos_state, back, len);
+		} else {
+			rc_bit(e, &e->p.is_rep[e->state], 0);
+			encode_match(e, pos_state, back - REPS, len);
+		}
+	}
+	e->read_ahead -= len;
+	e->position += len;
+}
+
+/* Choose what to code at the current position: prefer repeated
+ * distances, then the longest match, but code a literal instead
+ * if the next position has a clearly better match */
+static uint32_t choose_symbol(struct xz_enc *e, uint32_t *len_res)
+{
+	uint32_t nice_len = e->nice_len;
+	uint32_t len_main, back_main, rep_len, rep_index;
+	uint32_t buf_avail, limit, i;
+	unsigned count;
+	const uint8_t *buf;
+
+	if (e->read_ahead == 0)
+		e->longest_match_len = mf_find(e);
+	len_main = e->longest_match_len;
+	count = e->matches_count;
+
+	buf = e->buf + e->read_pos - 1;
+	buf_avail = MIN(e->write_pos - e->read_pos + 1, MATCH_LEN_MAX);
+	*len_res = 1;
+	if (buf_avail < 2)
+		return UINT32_MAX;
+
+	rep_len = rep_index = 0;
+	for (i = 0; i < REPS; i++) {
+		const uint8_t *buf_back = buf - e->reps[i] - 1;
+		uint32_t len;
+
+		if (buf[0] != buf_back[0] || buf[1] != buf_back[1])
+			continue;
+		len = memcmplen(buf, buf_back, 2, buf_avail);
+		if (len >= nice_len) {
+			*len_res = len;
+			mf_skip(e, len - 1);
+			return i;
+		}
+		if (len > rep_len) {
+			rep_index = i;
+			rep_len = len;
+		}
+	}
+
+	if (len_main >= nice_len) {
+		*len_res = len_main;
+		mf_skip(e, len_main - 1);
+		return e->matches[count - 1].dist + REPS;
+	}
+
+	back_main = 0;
+	if (len_main >= 2) {
+		back_main = e->matches[count - 1].dist;
+		/* A slightly shorter match may be much closer */
+		while (count > 1 && len_main == e->matches[count - 2].len + 1) {
+			if (!change_pair(e->matches[count - 2].dist, back_main))
+				break;
+			count--;
+			len_main = e->matches[count - 1].len;
+			back_main = e->matches[count - 1].dist;
+		}
+		if (len_main == 2 && back_main >= 0x80)
+			len_main = 1;
+	}
+
+	if (rep_len >= 2) {
+		if (rep_len + 1 >= len_main
+		 || (rep_len + 2 >= len_main && back_main > (1 << 9))
+		 || (rep_len + 3 >= len_main && back_main > (1 << 15))
+		) {
+			*len_res = rep_len;
+			mf_skip(e, rep_len - 1);
+			return rep_index;
+		}
+	}
+
+	if (len_main < 2 || buf_avail <= 2)
+		return UINT32_MAX;
+
+	/* Look at the next position */
+	e->longest_match_len = mf_find(e);
+	if (e->longest_match_len >= 2) {
+		uint32_t new_dist = e->matches[e->matches_count - 1].dist;
+
+		if ((e->longest_match_len >= len_main && new_dist < back_main)
+		 || (e->longest_match_len == len_main + 1 && !change_pair(back_main, new_dist))
+		 || (e->longest_match_len > len_main + 1)
+		 || (e->longest_match_len + 1 >= len_main && len_main >= 3
+		    && change_pair(new_dist, back_main))
+		) {
+			return UINT32_MAX;
+		}
+	}
+
+	buf++;
+	limit = MAX(2, len_main - 1);
+	for (i = 0; i < REPS; i++) {
+		if (memcmp(buf, buf - e->reps[i] - 1, limit) == 0)
+			return UINT32_MAX;
+	}
+
+	*len_res = len_main;
+	mf_skip(e, len_main - 2);
+	return back_main + REPS;
+}
+
+
+/* ======================================================================
+ * LZMA2 chunks
+ */
+
+/* Props byte of the smallest LZMA2 dictionary that is at least size */
+static unsigned dict_props(uint32_t size)
+{
+	unsigned b = 0;
+
+	while (((uint64_t)(2 | (b & 1)) << (b / 2 + 11)) < size)
+		b++;
+	return b;
+}
+
+/* Compress all input as LZMA2, returns 0 on errors */
+static int lzma2_encode(struct xz_enc *e)
+{
+	smallint need_props = 1, need_dict_reset = 1, need_state_reset = 0;
+	uint8_t hdr[6];
+
+	lzma_reset_state(e);
+	for (;;) {
+		uint32_t unc = 0;
+
+		if (e->write_error)
+			return 0;
+		rc_reset(e);
+		if (need_state_reset)
+			lzma_reset_state(e);
+		while (unc <= CHUNK_UNCOMPRESSED_MAX - MATCH_LEN_MAX
+		 && e->out_pos + e->cache_size + CHUNK_MARGIN <= CHUNK_COMPRESSED_MAX
+		) {
+			uint32_t back, len;
+
+			if (!mf_fill(e))
+				return 0;
+			if (e->read_pos == e->write_pos && e->read_ahead == 0)
+				break; /* all input is coded */
+			if (e->position == 0) {
+				/* Nothing to match yet */
+				mf_skip(e, 1);
+				back = UINT32_MAX;
+				len = 1;
+			} else {
+				back = choose_symbol(e, &len);
+			}
+			encode_symbol(e, back, len);
+			unc += len;
+		}
+		if (unc == 0)
+			break;
+		rc_flush(e);
+
+		if (e->out_pos >= unc) {
+			/* Didn't compress, store it */
+			const uint8_t *p = e->buf + e->read_pos - e->read_ahead - unc;
+			do {
+				uint32_t n = MIN(unc, 0x10000);
+				hdr[0] = need_dict_reset ? 1 : 2;
+				hdr[1] = (n - 1) >> 8;
+				hdr[2] = (n - 1);
+				xz_write(e, hdr, 3);
+				xz_write(e, p, n);
+				p += n;
+				unc -= n;
+				need_dict_reset = 0;
+			} while (unc != 0);
+			/* The state has seen data the decoder won't */
+			need_state_reset = 1;
+			continue;
+		}
+
+		hdr[0] = 0x80 | ((unc - 1) >> 16);
+		if (need_props)
+			hdr[0] |= need_dict_reset ? 0x60 : 0x40;
+		else if (need_state_reset)
+			hdr[0] |= 0x20;
+		hdr[1] = (unc - 1) >> 8;
+		hdr[2] = (unc - 1);
+		hdr[3] = (e->out_pos - 1) >> 8;
+		hdr[4] = (e->out_pos - 1);
+		hdr[5] = (PB * 5 + LP) * 9 + LC;
+		xz_write(e, hdr, 5 + need_props);
+		xz_write(e, e->out, e->out_pos);
+		need_props = need_dict_reset = need_state_reset = 0;
+	}
+	hdr[0] = 0x00; /* end of LZMA2 data */
+	xz_write(e, hdr, 1);
+	return 1;
+}
+
+static struct xz_enc *xz_enc_new(unsigned level, uint32_t dict_size)
+{
+	struct xz_enc *e = xzalloc(sizeof(*e));
+	uint32_t hs;
+
+	e->dict_size = dict_size;
+	e->bt = xz_levels[level].bt;
+	e->nice_len = xz_levels[level].nice_len;
+	e->depth = xz_levels[level].depth;
+
+	/* hash of 4 bytes: about dict_size / 2 entries, power of 2 */
+	hs = dict_size - 1;
+	hs |= hs >> 1;
+	hs |= hs >> 2;
+	hs |= hs >> 4;
+	hs |= hs >> 8;
+	hs |= hs >> 16;
+	hs >>= 1;
+	hs |= 0xffff;
+	if (hs > (1 << 24))
+		hs >>= 1;
+	e->hash_mask = hs;
+	e->hash_count = HASH2_SIZE + HASH3_SIZE + hs + 1;
+	e->hash = xzalloc(e->hash_count * sizeof(e->hash[0]));
+
+	e->cyclic_size = dict_size + 1;
+	e->son = xzalloc((e->cyclic_size << e->bt) * sizeof(e->son[0]));
+	/* 0 in hash[] and son[] is "none": too far back from here */
+	e->pos = e->cyclic_size;
+	e->crc = 0xffffffff;
+	return e;
+}
+
+static void xz_enc_free(struct xz_enc *e)
+{
+	free(e->hash);
+	free(e->son);
+	free(e->obuf);
+	free(e);
+}
+
+
+/* ======================================================================
+ * .xz container
+ */
+
+struct xz_index_rec {
+	uint64_t unpadded;
+	uint64_t uncompressed;
+};
+
+static void write_stream_header(struct xz_enc *e)
+{
+	uint8_t h[12] = { 0xfd, '7', 'z', 'X', 'Z', 0x00, 0x00, CHECK_CRC32 };
+
+	put_unaligned_le32(xz_crc32(h + 6, 2), h + 8);
+	xz_write(e, h, 12);
+}
+
+/* Block header, with sizes if known */
+static unsigned make_block_header(uint8_t *h, uint32_t dict_size,
+		uint64_t compressed, uint64_t uncompressed)
+{
+	unsigned n = 2;
+
+	h[1] = 0x00; /* one filter */
+	if (uncompressed != 0) {
+		h[1] |= 0xc0;
+		n += put_vli(h + n, compressed);
+		n += put_vli(h + n, uncompressed);
+	}
+	h[n++] = FILTER_LZMA2;
+	h[n++] = 1; /* size of properties */
+	h[n++] = dict_props(dict_size);
+	while (n & 3)
+		h[n++] = 0;
+	h[0] = n / 4; /* (n + 4) / 4 - 1 */
+	put_unaligned_le32(xz_crc32(h, n), h + n);
+	return n + 4;
+}
+
+/* Padding and check after the compressed data of a block */
+static void finish_block(struct xz_enc *e, uint64_t unpadded)
+{
+	uint8_t check[4 + CHECK_SIZE] = { 0 };
+	unsigned pad = (-unpadded) & 3;
+
+	put_unaligned_le32(~e->crc, check + pad);
+	xz_write(e, check, pad + CHECK_SIZE);
+}
+
+static void write_index_and_footer(struct xz_enc *e,
+		struct xz_index_rec *rec, unsigned nrec)
+{
+	uint8_t *idx, *p;
+	uint8_t footer[12];
+	uint32_t size;
+	unsigned i;
+
+	p = idx = xmalloc(16 + nrec * 20);
+	*p++ = 0x00; /* index indicator */
+	p += put_vli(p, nrec);
+	for (i = 0; i < nrec; i++) {
+		p += put_vli(p, rec[i].unpadded);
+		p += put_vli(p, rec[i].uncompressed);
+	}
+	while ((p - idx) & 3)
+		*p++ = 0;
+	size = p - idx;
+	put_unaligned_le32(xz_crc32(idx, size), p);
+	xz_write(e, idx, size + 4);
+	free(idx);
+
+	put_unaligned_le32((size + 4) / 4 - 1, footer + 4);
+	footer[8] = 0x00;
+	footer[9] = CHECK_CRC32;
+	put_unaligned_le32(xz_crc32(footer + 4, 6), footer);
+	footer[10] = 'Y';
+	footer[11] = 'Z';
+	xz_write(e, footer, 12);
+}
+
+#if ENABLE_FEATURE_XZ_PARALLEL
+/* -T N: blocks of three dictionaries (like xz) are compressed by child
+ * processes, up to N at once. A child writes the unpadded size of its
+ * block (for the index), then the whole block. */
+enum {
+	MAX_JOBS = 64,
+};
+
+struct xz_job {
+	pid_t pid;
+	int fd;
+	uint64_t uncompressed;
+};
+
+/* Runs in the child */
+static void compress_block(unsigned level, uint32_t dict_size,
+		uint8_t *data, uint32_t len, int fd) NORETURN;
+static void compress_block(unsigned level, uint32_t dict_size,
+		uint8_t *data, uint32_t len, int fd)
+{
+	struct xz_enc *e;
+	uint8_t h[32];
+	unsigned hlen;
+	uint64_t unpadded;
+
+	if (dict_size > len)
+		dict_size = MAX(len, 4096);
+	e = xz_enc_new(level, dict_size);
+	e->buf = data;
+	e->write_pos = e->buf_size = len;
+	e->eof = 1;
+	e->in_fd = -1;
+	e->crc = crc32_block_endian0(e->crc, data, len, global_crc32_table);
+
+	e->out_fd = -1;
+	e->osize = len / 2 + 1024;
+	e->obuf = xmalloc(e->osize);
+	lzma2_encode(e);
+
+	hlen = make_block_header(h, dict_size, e->olen, len);
+	unpadded = hlen + e->olen + CHECK_SIZE;
+	xwrite(fd, &unpadded, sizeof(unpadded));
+	xwrite(fd, h, hlen);
+	xwrite(fd, e->obuf, e->olen);
+	e->out_fd = fd;
+	finish_block(e, unpadded);
+	_exit(e->write_error);
+}
+
+/* Copy the block made by a job to ofd, returns 0 on errors */
+static int finish_job(struct xz_enc *e, struct xz_job *job, struct xz_index_rec *rec)
+{
+	int status;
+	off_t n = -1;
+
+	rec->uncompressed = job->uncompressed;
+	if (full_read(job->fd, &rec->unpadded, sizeof(rec->unpadded)) == sizeof(rec->unpadded))
+		n = bb_copyfd_eof(job->fd, e->out_fd);
+	close(job->fd);
+	if (n < 0)
+		kill(job->pid, SIGKILL);
+	if (safe_waitpid(job->pid, &status, 0) < 0
+	 || !WIFEXITED(status) || WEXITSTATUS(status) != 0
+	) {
+		n = -1; /* the child has said why */
+	}
+	if (n < 0)
+		return 0;
+	e->out_size += n;
+	return 1;
+}
+
+static int compress_parallel(struct xz_enc *e, unsigned level, uint32_t dict_size,
+		struct xz_index_rec **rec, unsigned *nrec)
+{
+	struct xz_job job[MAX_JOBS];
+	unsigned first = 0, running = 0;
+	unsigned njobs = MIN(xz_jobs, MAX_JOBS);
+	uint32_t size = MAX(3 * dict_size, 1024 * 1024);
+	uint8_t *buf = xmalloc(size);
+	int ok = 1;
+
+	while (ok) {
+		struct xz_job *j;
+		int p[2];
+		ssize_t len = full_read(STDIN_FILENO, buf, size);
+
+		if (len < 0) {
+			bb_simple_perror_msg(bb_msg_read_error);
+			ok = 0;
+			break;
+		}
+		if (len == 0)
+			break;
+
+		if (running == njobs) {
+			*rec = xrealloc_vector(*rec, 4, *nrec);
+			ok = finish_job(e, &job[first], &(*rec)[(*nrec)++]);
+			first = (first + 1) % njobs;
+			running--;
+			if (!ok)
+				break;
+		}
+		j = &job[(first + running) % njobs];
+		j->uncompressed = len;
+		xpipe(p);
+		j->pid = xfork();
+		if (j->pid == 0) {
+			close(p[0]);
+			compress_block(level, dict_size, buf, len, p[1]);
+		}
+		close(p[1]);
+		j->fd = p[0];
+		running++;
+	}
+	while (running != 0) {
+		if (!ok) {
+			/* we are failing anyway, don't wait for the work */
+			kill(job[first].pid, SIGKILL);
+			close(job[first].fd);
+			safe_waitpid(job[first].pid, NULL, 0);
+		} else {
+			*rec = xrealloc_vector(*rec, 4, *nrec);
+			ok = finish_job(e, &job[first], &(*rec)[(*nrec)++]);
+		}
+		first = (first + 1) % njobs;
+		running--;
+	}
+	free(buf);
+	return ok;
+}
+#endif
+
+static
+IF_DESKTOP(long long) int FAST_FUNC compressStream(transformer_state_t *xstate UNUSED_PARAM)
+{
+	IF_DESKTOP(long long) int total;
+	struct xz_index_rec *rec = NULL;
+	unsigned nrec = 0;
+	struct xz_enc *e;
+	unsigned opt, level;
+	uint32_t dict_size;
+	struct stat st;
+	int ok = 1;
+
+	/* skip BBUNPK_OPTSTR, "dt" and "ze" bits */
+	opt = (option_mask32 >> (BBUNPK_OPTSTRLEN + 2 + 2)) & 0x3ff;
+	level = opt ? ffs(opt) - 1 : 6;
+	dict_size = (uint32_t)1 << xz_levels[level].dict_log;
+	/* Don't make a bigger dictionary than the whole input */
+	if (fstat(STDIN_FILENO, &st) == 0 && S_ISREG(st.st_mode) && st.st_size < dict_size)
+		dict_size = MAX(st.st_size, 4096);
+
+	if (!global_crc32_table)
+		global_crc32_new_table_le();
+
+#if ENABLE_FEATURE_XZ_PARALLEL
+	if (xz_jobs != 1) {
+		e = xzalloc(sizeof(*e));
+		e->out_fd = STDOUT_FILENO;
+		write_stream_header(e);
+		ok = !e->write_error && compress_parallel(e, level, dict_size, &rec, &nrec);
+	} else
+#endif
+	{
+		e = xz_enc_new(level, dict_size);
+		e->out_fd = STDOUT_FILENO;
+		e->in_fd = STDIN_FILENO;
+		/* dictionary, then room to read more input */
+		e->buf_size = KEEP_SIZE(e) + dict_size / 2 + 512 * 1024;
+		e->buf = xmalloc(e->buf_size);
+		write_stream_header(e);
+
+		ok = mf_fill(e);
+		if (ok && e->write_pos != 0) {
+			uint8_t h[32];
+			unsigned hlen = make_block_header(h, dict_size, 0, 0);
+			uint64_t start;
+
+			xz_write(e, h, hlen);
+			start = e->out_size;
+			ok = lzma2_encode(e);
+			rec = xzalloc(sizeof(*rec));
+			rec->unpadded = hlen + (e->out_size - start) + CHECK_SIZE;
+			rec->uncompressed = e->in_size;
+			nrec = 1;
+			finish_block(e, rec->unpadded);
+		}
+		free(e->buf);
+	}
+	if (ok)
+		write_index_and_footer(e, rec, nrec);
+	total = ok && !e->write_error ? 0 IF_DESKTOP(+ e->out_size) : -1;
+
+	free(rec);
+	xz_enc_free(e);
+	return total;
+}
+
+int xz_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
+int xz_main(int argc UNUSED_PARAM, char **argv)
+{
+	unsigned opt;
+
+	/* -z: compress (the default), -e ("extreme") is ignored */
+	opt = getopt32(argv,
+		/* Must match BBUNPK_foo constants! */
+		BBUNPK_OPTSTR "dt" "ze0123456789"
+#if ENABLE_FEATURE_XZ_PARALLEL || ENABLE_FEATURE_UNXZ_PARALLEL
+		"T:+", &xz_jobs
+#endif
+	);
+	if (opt & (BBUNPK_OPT_DECOMPRESS|BBUNPK_OPT_TEST)) /* -d and/or -t */
+		return unxz_main(argc, argv);
+#if ENABLE_FEATURE_XZ_PARALLEL
+	if (xz_jobs == 0)
+		xz_jobs = get_cpu_count();
+#endif
+
+	argv += optind;
+	return bbunpack(argv, compressStream, append_ext, "xz");
+}
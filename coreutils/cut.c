@@ -67,129 +67,177 @@ static int cmpfunc(const void *a, const void *b)
 			((struct cut_list *) b)->startpos);
 }
 
-static void cut_file(FILE *file, char delim, const struct cut_list *cut_lists, unsigned nlists)
+/* Input is read and output is gathered in blocks of this size */
+#define CUT_BUFSIZE (64 * 1024)
+
+struct cut_out {
+	unsigned len;
+	char buf[CUT_BUFSIZE];
+};
+
+static void flush_out(struct cut_out *o)
 {
-	char *line;
-	unsigned linenum = 0;	/* keep these zero-based to be consistent */
+	if (o->len) {
+		xwrite(STDOUT_FILENO, o->buf, o->len);
+		o->len = 0;
+	}
+}
+
+static void put_span(struct cut_out *o, const char *s, size_t n)
+{
+	if (n > sizeof(o->buf) - o->len) {
+		flush_out(o);
+		if (n > sizeof(o->buf)) {
+			xwrite(STDOUT_FILENO, s, n);
+			return;
+		}
+	}
+	memcpy(o->buf + o->len, s, n);
+	o->len += n;
+}
+
+static void put_char(struct cut_out *o, char c)
+{
+	if (o->len == sizeof(o->buf))
+		flush_out(o);
+	o->buf[o->len++] = c;
+}
+
+/* cut_lists[] is sorted, merged and has no NON_RANGE entries here,
+ * so every list is an interval with a gap of at least one after it
+ * and spans of consecutive fields can be copied with their delimiters.
+ * line[len] is the newline (or the end of the last line).
+ */
+static void cut_line(struct cut_out *o, const char *line, size_t len,
+		char delim, const struct cut_list *cut_lists, unsigned nlists)
+{
+	const char *end = line + len;
+	unsigned cl_pos;
+
+	if (option_mask32 & (CUT_OPT_CHAR_FLGS | CUT_OPT_BYTE_FLGS)) {
+		for (cl_pos = 0; cl_pos < nlists; cl_pos++) {
+			size_t s = cut_lists[cl_pos].startpos;
+			size_t e = cut_lists[cl_pos].endpos;
+
+			if (s >= len)
+				break;
+			if (e >= len)
+				e = len - 1;
+			put_span(o, line + s, e - s + 1);
+		}
+	} else {
+		const char *pos = line;
+		const char *next = memchr(line, delim, len);
+		int field = 0;
+		int printed = 0;
+
+		/* does this line contain any delimiters? */
+		if (!next) {
+			if (option_mask32 & CUT_OPT_SUPPRESS_FLGS)
+				return;
+			put_span(o, line, len);
+			goto eol;
+		}
+
+		for (cl_pos = 0; cl_pos < nlists; cl_pos++) {
+			const char *start;
 
-	/* go through every line in the file */
-	while ((line = xmalloc_fgetline(file)) != NULL) {
-
-		/* set up a list so we can keep track of what's been printed */
-		int linelen = strlen(line);
-		char *printed = xzalloc(linelen + 1);
-		char *orig_line = line;
-		unsigned cl_pos = 0;
-		int spos;
-
-		/* cut based on chars/bytes XXX: only works when sizeof(char) == byte */
-		if (option_mask32 & (CUT_OPT_CHAR_FLGS | CUT_OPT_BYTE_FLGS)) {
-			/* print the chars specified in each cut list */
-			for (; cl_pos < nlists; cl_pos++) {
-				spos = cut_lists[cl_pos].startpos;
-				while (spos < linelen) {
-					if (!printed[spos]) {
-						printed[spos] = 'X';
-						putchar(line[spos]);
-					}
-					spos++;
-					if (spos > cut_lists[cl_pos].endpos
-					/* NON_RANGE is -1, so if below is true,
-					 * the above was true too (spos is >= 0) */
-					/* || cut_lists[cl_pos].endpos == NON_RANGE */
-					) {
-						break;
-					}
-				}
+			/* skip to the first field of this list */
+			while (field < cut_lists[cl_pos].startpos) {
+				if (!next)
+					goto eol;
+				pos = next + 1;
+				next = memchr(pos, delim, end - pos);
+				field++;
 			}
-		} else if (delim == '\n') {	/* cut by lines */
-			spos = cut_lists[cl_pos].startpos;
-
-			/* get out if we have no more lists to process or if the lines
-			 * are lower than what we're interested in */
-			if (((int)linenum < spos) || (cl_pos >= nlists))
-				goto next_line;
-
-			/* if the line we're looking for is lower than the one we were
-			 * passed, it means we displayed it already, so move on */
-			while (spos < (int)linenum) {
-				spos++;
-				/* go to the next list if we're at the end of this one */
-				if (spos > cut_lists[cl_pos].endpos
-				 || cut_lists[cl_pos].endpos == NON_RANGE
-				) {
-					cl_pos++;
-					/* get out if there's no more lists to process */
-					if (cl_pos >= nlists)
-						goto next_line;
-					spos = cut_lists[cl_pos].startpos;
-					/* get out if the current line is lower than the one
-					 * we just became interested in */
-					if ((int)linenum < spos)
-						goto next_line;
-				}
+			/* and copy it along with the rest of the list */
+			start = pos;
+			while (field < cut_lists[cl_pos].endpos && next) {
+				pos = next + 1;
+				next = memchr(pos, delim, end - pos);
+				field++;
 			}
+			if (printed)
+				put_char(o, delim);
+			printed = 1;
+			put_span(o, start, (next ? next : end) - start);
+			if (!next)
+				break;
+		}
+	}
+ eol:
+	put_char(o, '\n');
+}
 
-			/* If we made it here, it means we've found the line we're
-			 * looking for, so print it */
-			puts(line);
-			goto next_line;
-		} else {		/* cut by fields */
-			int ndelim = -1;	/* zero-based / one-based problem */
-			int nfields_printed = 0;
-			char *field = NULL;
-			char delimiter[2];
-
-			delimiter[0] = delim;
-			delimiter[1] = 0;
-
-			/* does this line contain any delimiters? */
-			if (strchr(line, delim) == NULL) {
-				if (!(option_mask32 & CUT_OPT_SUPPRESS_FLGS))
-					puts(line);
-				goto next_line;
+static int cut_file(int fd, const char *fname, struct cut_out *o,
+		char delim, const struct cut_list *cut_lists, unsigned nlists)
+{
+	char *buf;
+	size_t size = CUT_BUFSIZE;
+	size_t start = 0, end = 0;
+	unsigned linenum = 0;	/* keep these zero-based to be consistent */
+	unsigned cl_pos = 0;
+	int retval = EXIT_SUCCESS;
+	smallint last = 0;
+
+	buf = xmalloc(size);
+	while (!last) {
+		char *line = buf + start;
+		char *eol = memchr(line, '\n', end - start);
+
+		if (!eol) {
+			ssize_t n;
+
+			/* keep the partial line, grow the buffer if it is all one line */
+			if (start) {
+				end -= start;
+				memmove(buf, line, end);
+				start = 0;
+			} else if (end == size) {
+				size *= 2;
+				buf = xrealloc(buf, size);
 			}
-
-			/* process each list on this line, for as long as we've got
-			 * a line to process */
-			for (; cl_pos < nlists && line; cl_pos++) {
-				spos = cut_lists[cl_pos].startpos;
-				do {
-					/* find the field we're looking for */
-					while (line && ndelim < spos) {
-						field = strsep(&line, delimiter);
-						ndelim++;
-					}
-
-					/* we found it, and it hasn't been printed yet */
-					if (field && ndelim == spos && !printed[ndelim]) {
-						/* if this isn't our first time through, we need to
-						 * print the delimiter after the last field that was
-						 * printed */
-						if (nfields_printed > 0)
-							putchar(delim);
-						fputs_stdout(field);
-						printed[ndelim] = 'X';
-						nfields_printed++;	/* shouldn't overflow.. */
-					}
-
-					spos++;
-
-					/* keep going as long as we have a line to work with,
-					 * this is a list, and we're not at the end of that
-					 * list */
-				} while (spos <= cut_lists[cl_pos].endpos && line
-						&& cut_lists[cl_pos].endpos != NON_RANGE);
+			/* don't sit on output while we may block */
+			flush_out(o);
+			n = safe_read(fd, buf + end, size - end);
+			if (n > 0) {
+				end += n;
+				continue;
 			}
+			if (n < 0) {
+				bb_simple_perror_msg(fname);
+				retval = EXIT_FAILURE;
+			}
+			if (end == 0)
+				break;
+			/* last line without a newline */
+			line = buf;
+			eol = buf + end;
+			last = 1;
+		} else {
+			start = eol + 1 - buf;
+		}
+#if ENABLE_PLATFORM_MINGW32
+		/* xmalloc_fgetline() strips CR of CRLF */
+		if (eol > line && eol[-1] == '\r')
+			eol--;
+#endif
+
+		if (delim == '\n' && (option_mask32 & CUT_OPT_FIELDS_FLGS)) {
+			/* cut by lines */
+			while (cl_pos < nlists && cut_lists[cl_pos].endpos < (int)linenum)
+				cl_pos++;
+			if (cl_pos < nlists && cut_lists[cl_pos].startpos <= (int)linenum) {
+				put_span(o, line, eol - line);
+				put_char(o, '\n');
+			}
+		} else {
+			cut_line(o, line, eol - line, delim, cut_lists, nlists);
 		}
-		/* if we printed anything at all, we need to finish it with a
-		 * newline cuz we were handed a chomped line */
-		putchar('\n');
- next_line:
 		linenum++;
-		free(printed);
-		free(orig_line);
 	}
+	free(buf);
+	return retval;
 }
 
 int cut_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
@@ -295,26 +343,50 @@ int cut_main(int argc UNUSED_PARAM, char **argv)
 		 * easier on us when it comes time to print the chars / fields / lines
 		 */
 		qsort(cut_lists, nlists, sizeof(cut_lists[0]), cmpfunc);
+
+		/* what gets printed is the union of the lists, in order:
+		 * merge overlapping and adjacent ones. "N" is "N-N",
+		 * and so is the decreasing "N-M" */
+		e = 0;
+		for (s = 0; s < (int)nlists; s++) {
+			struct cut_list *cl = &cut_lists[s];
+
+			if (cl->endpos < cl->startpos)
+				cl->endpos = cl->startpos;
+			if (e != 0 && cl->startpos - 1 <= cut_lists[e - 1].endpos) {
+				if (cut_lists[e - 1].endpos < cl->endpos)
+					cut_lists[e - 1].endpos = cl->endpos;
+				continue;
+			}
+			cut_lists[e++] = *cl;
+		}
+		nlists = e;
 	}
 
 	{
+		struct cut_out *out = xmalloc(sizeof(*out));
 		int retval = EXIT_SUCCESS;
 
+		out->len = 0;
 		if (!*argv)
 			*--argv = (char *)"-";
 
 		do {
-			FILE *file = fopen_or_warn_stdin(*argv);
-			if (!file) {
+			int fd = open_or_warn_stdin(*argv);
+			if (fd < 0) {
 				retval = EXIT_FAILURE;
 				continue;
 			}
-			cut_file(file, delim, cut_lists, nlists);
-			fclose_if_not_stdin(file);
+			retval |= cut_file(fd, *argv, out, delim, cut_lists, nlists);
+			if (fd != STDIN_FILENO)
+				close(fd);
 		} while (*++argv);
+		flush_out(out);
 
-		if (ENABLE_FEATURE_CLEAN_UP)
+		if (ENABLE_FEATURE_CLEAN_UP) {
+			free(out);
 			free(cut_lists);
+		}
 		fflush_stdout_and_exit(retval);
 	}
 }
@@ -46,6 +46,14 @@
 //config:	Enabling the -c options allows files to be checked
 //config:	against pre-calculated hash values.
 //config:	-s and -w are useful options when verifying checksums.
+//config:
+//config:config FEATURE_MD5_SHA1_SUM_PARALLEL
+//config:	bool "Enable -j N (hash N files in parallel)"
+//config:	default y
+//config:	depends on (MD5SUM || SHA1SUM || SHA256SUM || SHA512SUM || SHA3SUM) && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	Hash several files at once in child processes.
+//config:	Output is in the same order as without -j.
 
 //applet:IF_MD5SUM(APPLET_NOEXEC(md5sum, md5_sha1_sum, BB_DIR_USR_BIN, BB_SUID_DROP, md5sum))
 //applet:IF_SHA1SUM(APPLET_NOEXEC(sha1sum, md5_sha1_sum, BB_DIR_USR_BIN, BB_SUID_DROP, sha1sum))
@@ -60,7 +68,7 @@
 //kbuild:lib-$(CONFIG_SHA3SUM)   += md5_sha1_sum.o
 
 //usage:#define md5sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define md5sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " MD5 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -68,6 +76,9 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel (0: one per CPU)"
+//usage:	)
 //usage:
 //usage:#define md5sum_example_usage
 //usage:       "$ md5sum < busybox\n"
@@ -80,7 +91,7 @@
 //usage:       "^D\n"
 //usage:
 //usage:#define sha1sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha1sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA1 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -88,9 +99,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel (0: one per CPU)"
+//usage:	)
 //usage:
 //usage:#define sha256sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha256sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA256 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -98,9 +112,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel (0: one per CPU)"
+//usage:	)
 //usage:
 //usage:#define sha512sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[FILE]..."
 //usage:#define sha512sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA512 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -108,9 +125,12 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel (0: one per CPU)"
+//usage:	)
 //usage:
 //usage:#define sha3sum_trivial_usage
-//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")"[-a BITS] [FILE]..."
+//usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK("[-c[sw]] ")IF_FEATURE_MD5_SHA1_SUM_PARALLEL("[-j N] ")"[-a BITS] [FILE]..."
 //usage:#define sha3sum_full_usage "\n\n"
 //usage:       "Print" IF_FEATURE_MD5_SHA1_SUM_CHECK(" or check") " SHA3 checksums"
 //usage:	IF_FEATURE_MD5_SHA1_SUM_CHECK( "\n"
@@ -118,6 +138,9 @@
 //usage:     "\n	-s	Don't output anything, status code shows success"
 //usage:     "\n	-w	Warn about improperly formatted checksum lines"
 //usage:	)
+//usage:	IF_FEATURE_MD5_SHA1_SUM_PARALLEL(
+//usage:     "\n	-j N	Hash N files in parallel (0: one per CPU)"
+//usage:	)
 //usage:     "\n	-a BITS	224 (default), 256, 384, 512"
 
 //FIXME: GNU coreutils 8.25 has no -s option, it has only these two long opts:
@@ -248,13 +271,211 @@ static uint8_t *hash_file(const char *filename, unsigned sha3_width)
 	return hash_value;
 }
 
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+/* With -j N, files are hashed by N worker processes. Names are handed
+ * to them round-robin and results are read back in the same order,
+ * so the output is ordered as without -j. Up to JOB_DEPTH files per
+ * worker are in flight: enough to keep them busy, too few to fill
+ * a pipe and deadlock.
+ */
+enum {
+	MAX_WORKERS = 64,
+	JOB_DEPTH = 8,
+};
+
+struct hash_worker {
+	pid_t pid;
+	int req_fd;     /* names go there */
+	FILE *res;      /* hashes come from there, "\n" on error */
+};
+
+struct hash_job {
+	char *name;
+	char *line;     /* -c: line of the list to be freed, with expected hash */
+};
+
+struct globals {
+	unsigned nworkers;
+	unsigned job_first;
+	unsigned job_count;
+	struct hash_worker workers[MAX_WORKERS];
+	struct hash_job jobs[MAX_WORKERS * JOB_DEPTH]; /* ring */
+} FIX_ALIASING;
+#define G (*ptr_to_globals)
+#define INIT_G() do { \
+	SET_PTR_TO_GLOBALS(xzalloc(sizeof(G))); \
+} while (0)
+
+static void NORETURN hash_worker(int req_fd, int res_fd, unsigned sha3_width)
+{
+	char *name = NULL;
+	unsigned len;
+
+	while (full_read(req_fd, &len, sizeof(len)) == sizeof(len)) {
+		uint8_t *hash_value;
+
+		name = xrealloc(name, len + 1);
+		if (full_read(req_fd, name, len) != len)
+			break;
+		name[len] = '\0';
+		hash_value = hash_file(name, sha3_width);
+		if (hash_value) {
+			full_write(res_fd, hash_value, strlen((char*)hash_value));
+			free(hash_value);
+		}
+		xwrite(res_fd, "\n", 1);
+	}
+	_exit(EXIT_SUCCESS);
+}
+
+static void start_workers(unsigned n, unsigned sha3_width)
+{
+	unsigned i;
+
+	if (n == 0)
+		n = get_cpu_count();
+	if (n > MAX_WORKERS)
+		n = MAX_WORKERS;
+	if (n < 2)
+		return;
+	/* children must not inherit unflushed output */
+	fflush_all();
+	for (i = 0; i < n; i++) {
+		struct hash_worker *w = &G.workers[i];
+		int req[2], res[2];
+
+		xpipe(req);
+		xpipe(res);
+		w->pid = xfork();
+		if (w->pid == 0) {
+			/* not to keep other workers' pipes open */
+			while (i != 0) {
+				i--;
+				close(G.workers[i].req_fd);
+				fclose(G.workers[i].res);
+			}
+			close(req[1]);
+			close(res[0]);
+			hash_worker(req[0], res[1], sha3_width);
+		}
+		close(req[0]);
+		close(res[1]);
+		close_on_exec_on(req[1]);
+		close_on_exec_on(res[0]);
+		w->req_fd = req[1];
+		w->res = xfdopen_for_read(res[0]);
+	}
+	G.nworkers = n;
+}
+
+static void stop_workers(void)
+{
+	unsigned i;
+
+	for (i = 0; i < G.nworkers; i++) {
+		close(G.workers[i].req_fd);
+		if (ENABLE_FEATURE_CLEAN_UP)
+			fclose(G.workers[i].res);
+		safe_waitpid(G.workers[i].pid, NULL, 0);
+	}
+}
+#else
+# define start_workers(n, w) ((void)0)
+#endif
+
+/* Print the result of hashing a file, return 1 if it failed */
+static int hash_done(const char *name, const char *expected, uint8_t *hash_value, unsigned flags)
+{
+	int ok = (hash_value != NULL);
+
+	if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK && expected) {
+		ok = ok && strcmp((char*)hash_value, expected) == 0;
+		if (!(flags & FLAG_SILENT))
+			printf(ok ? "%s: OK\n" : "%s: FAILED\n", name);
+	} else if (ok) {
+		printf("%s  %s\n", hash_value, name);
+	}
+	/* possible free(NULL) */
+	free(hash_value);
+	return !ok;
+}
+
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+/* Wait for the oldest job, return 1 if it failed */
+static int finish_job(unsigned flags)
+{
+	struct hash_job *job = &G.jobs[G.job_first];
+	struct hash_worker *w = &G.workers[G.job_first % G.nworkers];
+	char *hash_value;
+	int failed;
+
+	hash_value = xmalloc_fgetline(w->res);
+	if (!hash_value)
+		bb_simple_error_msg_and_die("worker process died");
+	if (!hash_value[0]) {
+		free(hash_value);
+		hash_value = NULL;
+	}
+	failed = hash_done(job->name, job->line, (uint8_t*)hash_value, flags);
+	free(job->line);
+	G.job_first = (G.job_first + 1) % (G.nworkers * JOB_DEPTH);
+	G.job_count--;
+	return failed;
+}
+
+/* Wait for all jobs, return the number of failed ones */
+static int finish_jobs(unsigned flags)
+{
+	int failed = 0;
+	while (G.job_count != 0)
+		failed += finish_job(flags);
+	return failed;
+}
+#else
+# define finish_jobs(flags) 0
+#endif
+
+/* Hash a file and print the result, now or later with -j.
+ * line (with -c) is freed when done. Return 1 if it failed
+ * (with -j: an earlier file whose result is printed now).
+ */
+static int hash_and_print(char *name, char *line, unsigned sha3_width, unsigned flags)
+{
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+	if (G.nworkers) {
+		unsigned size = G.nworkers * JOB_DEPTH;
+		unsigned idx, len;
+		int failed = 0;
+
+		if (G.job_count == size)
+			failed = finish_job(flags);
+		idx = (G.job_first + G.job_count) % size;
+		G.jobs[idx].name = name;
+		G.jobs[idx].line = line;
+		G.job_count++;
+		len = strlen(name);
+		xwrite(G.workers[idx % G.nworkers].req_fd, &len, sizeof(len));
+		xwrite(G.workers[idx % G.nworkers].req_fd, name, len);
+		return failed;
+	}
+#endif
+	{
+		int failed = hash_done(name, line, hash_file(name, sha3_width), flags);
+		free(line);
+		return failed;
+	}
+}
+
 int md5_sha1_sum_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 {
 	int return_value = EXIT_SUCCESS;
 	unsigned flags;
-#if ENABLE_SHA3SUM
 	unsigned sha3_width = 224;
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+	unsigned njobs = 1;
+
+	INIT_G();
 #endif
 
 	if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK) {
@@ -262,23 +483,32 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 		/* -s and -w require -c */
 #if ENABLE_SHA3SUM
 		if (applet_name[3] == HASH_SHA3)
-			flags = getopt32(argv, "^" "scwbta:+" "\0" "s?c:w?c", &sha3_width);
+			flags = getopt32(argv, "^" "scwbta:+" IF_FEATURE_MD5_SHA1_SUM_PARALLEL("j:+")
+					"\0" "s?c:w?c",
+					&sha3_width IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &njobs));
 		else
 #endif
-			flags = getopt32(argv, "^" "scwbt" "\0" "s?c:w?c");
+			flags = getopt32(argv, "^" "scwbt" IF_FEATURE_MD5_SHA1_SUM_PARALLEL("j:+")
+					"\0" "s?c:w?c"
+					IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &njobs));
 	} else {
+		flags = 0;
 #if ENABLE_SHA3SUM
 		if (applet_name[3] == HASH_SHA3)
-			getopt32(argv, "a:+", &sha3_width);
+			getopt32(argv, "a:+" IF_FEATURE_MD5_SHA1_SUM_PARALLEL("j:+"),
+					&sha3_width IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &njobs));
 		else
 #endif
-			getopt32(argv, "");
+			getopt32(argv, "" IF_FEATURE_MD5_SHA1_SUM_PARALLEL("j:+")
+					IF_FEATURE_MD5_SHA1_SUM_PARALLEL(, &njobs));
 	}
 	argv += optind;
 	//argc -= optind;
 	if (!*argv)
 		*--argv = (char*)"-";
 
+	start_workers(njobs, sha3_width);
+
 	do {
 		if (ENABLE_FEATURE_MD5_SHA1_SUM_CHECK && (flags & FLAG_CHECK)) {
 			FILE *pre_computed_stream;
@@ -289,7 +519,6 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 			pre_computed_stream = xfopen_stdin(*argv);
 
 			while ((line = xmalloc_fgetline(pre_computed_stream)) != NULL) {
-				uint8_t *hash_value;
 				char *filename_ptr;
 
 				count_total++;
@@ -310,21 +539,12 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 				*filename_ptr = '\0';
 				filename_ptr += 2;
 
-				hash_value = hash_file(filename_ptr, sha3_width);
-
-				if (hash_value && (strcmp((char*)hash_value, line) == 0)) {
-					if (!(flags & FLAG_SILENT))
-						printf("%s: OK\n", filename_ptr);
-				} else {
-					if (!(flags & FLAG_SILENT))
-						printf("%s: FAILED\n", filename_ptr);
-					count_failed++;
-					return_value = EXIT_FAILURE;
-				}
-				/* possible free(NULL) */
-				free(hash_value);
-				free(line);
+				count_failed += hash_and_print(filename_ptr, line, sha3_width, flags);
 			}
+			/* all results must be in before the summary */
+			count_failed += finish_jobs(flags);
+			if (count_failed)
+				return_value = EXIT_FAILURE;
 			if (count_failed && !(flags & FLAG_SILENT)) {
 				bb_error_msg("WARNING: %d of %d computed checksums did NOT match",
 						count_failed, count_total);
@@ -339,15 +559,15 @@ int md5_sha1_sum_main(int argc UNUSED_PARAM, char **argv)
 			}
 			fclose_if_not_stdin(pre_computed_stream);
 		} else {
-			uint8_t *hash_value = hash_file(*argv, sha3_width);
-			if (hash_value == NULL) {
+			if (hash_and_print(*argv, NULL, sha3_width, flags))
 				return_value = EXIT_FAILURE;
-			} else {
-				printf("%s  %s\n", hash_value, *argv);
-				free(hash_value);
-			}
 		}
 	} while (*++argv);
 
+	if (finish_jobs(flags))
+		return_value = EXIT_FAILURE;
+#if ENABLE_FEATURE_MD5_SHA1_SUM_PARALLEL
+	stop_workers();
+#endif
 	return return_value;
 }
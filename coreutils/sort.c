@@ -36,6 +36,24 @@
 //config:	help
 //config:	Attempt to use less memory (by storing only one copy
 //config:	of duplicated lines, and such). Useful if you work on huge files.
+//config:
+//config:config FEATURE_SORT_EXTERNAL
+//config:	bool "Support -S and -T (sort files larger than memory)"
+//config:	default y
+//config:	depends on FEATURE_SORT_BIG
+//config:	help
+//config:	With -S SIZE, sort holds at most about SIZE bytes of input
+//config:	in memory. Sorted runs are written to temporary files
+//config:	in -T DIR (or $TMPDIR, or /tmp) and merged at the end.
+//config:
+//config:config FEATURE_SORT_PARALLEL
+//config:	bool "Support --parallel=N (sort on several CPUs)"
+//config:	default y
+//config:	depends on FEATURE_SORT_EXTERNAL && LONG_OPTS && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	Large inputs are split into N slices which are sorted
+//config:	by N processes at once, then merged.
+//config:	N defaults to the number of CPUs, but at most 8.
 
 //applet:IF_SORT(APPLET_NOEXEC(sort, sort, BB_DIR_USR_BIN, BB_SUID_DROP, sort))
 
@@ -69,8 +87,13 @@
 //usage:     "\n	-u	Suppress duplicate lines"
 //usage:     "\n	-z	NUL terminated input and output"
 ///////:     "\n	-m	Ignored for GNU compatibility"
-///////:     "\n	-S BUFSZ Ignored for GNU compatibility"
-///////:     "\n	-T TMPDIR Ignored for GNU compatibility"
+//usage:	IF_FEATURE_SORT_EXTERNAL(
+//usage:     "\n	-S SIZE	Use at most SIZE bytes of memory (default unit KiB)"
+//usage:     "\n	-T DIR	Directory for temporary files"
+//usage:	)
+//usage:	IF_FEATURE_SORT_PARALLEL(
+//usage:     "\n	--parallel=N	Sort using N processes"
+//usage:	)
 //usage:
 //usage:#define sort_example_usage
 //usage:       "$ echo -e \"e\\nf\\nb\\nd\\nc\\na\" | sort\n"
@@ -108,18 +131,25 @@ enum {
 	FLAG_f  = 1 << 11,      /* Force uppercase */
 	FLAG_i  = 1 << 12,      /* Ignore !isprint() */
 	FLAG_m  = 1 << 13,      /* ignored: merge already sorted files; do not sort */
-	FLAG_S  = 1 << 14,      /* ignored: -S, --buffer-size=SIZE */
-	FLAG_T  = 1 << 15,      /* ignored: -T, --temporary-directory=DIR */
+	FLAG_S  = 1 << 14,      /* -S, --buffer-size=SIZE */
+	FLAG_T  = 1 << 15,      /* -T, --temporary-directory=DIR */
 	FLAG_o  = 1 << 16,
 	FLAG_k  = 1 << 17,
 	FLAG_t  = 1 << 18,
+	FLAG_parallel = (1 << 19) * ENABLE_FEATURE_SORT_PARALLEL,
 	FLAG_bb = 0x80000000,   /* Ignore trailing blanks  */
 	FLAG_no_tie_break = 0x40000000,
 };
 
 static const char sort_opt_str[] ALIGN1 = "^"
 			"ngMVucszbrdfimS:T:o:k:*t:"
+			IF_FEATURE_SORT_PARALLEL("\xfe:+")
 			"\0" "o--o:t--t"/*-t, -o: at most one of each*/;
+#if ENABLE_FEATURE_SORT_PARALLEL
+static const char sort_longopts[] ALIGN1 =
+	"parallel\0" Required_argument "\xfe"
+	;
+#endif
 /*
  * OPT_STR must not be string literal, needs to have stable address:
  * code uses "strchr(OPT_STR,c) - OPT_STR" idiom.
@@ -139,6 +169,12 @@ static struct sort_key {
 /* This is a NOEXEC applet. Be very careful! */
 
 
+static int key_is_whole_line(struct sort_key *key, int flags)
+{
+	return key->range[0] == 1 && !key->range[1] && !key->range[2] && !key->range[3]
+		&& !(flags & (FLAG_b | FLAG_d | FLAG_f | FLAG_i | FLAG_bb));
+}
+
 static char *get_key(char *str, struct sort_key *key, int flags)
 {
 	int start = start; /* for compiler */
@@ -147,11 +183,8 @@ static char *get_key(char *str, struct sort_key *key, int flags)
 	unsigned i;
 
 	/* Special case whole string, so we don't have to make a copy */
-	if (key->range[0] == 1 && !key->range[1] && !key->range[2] && !key->range[3]
-	 && !(flags & (FLAG_b | FLAG_d | FLAG_f | FLAG_i | FLAG_bb))
-	) {
+	if (key_is_whole_line(key, flags))
 		return str;
-	}
 
 	/* Find start of key on first pass, end on second pass */
 	len = strlen(str);
@@ -253,6 +286,43 @@ static struct sort_key *add_key(void)
 #define GET_LINE(fp) xmalloc_fgetline(fp)
 #endif
 
+/* Tie break lines which compare equal by keys, apply -r */
+static int finish_compare(char *xline, char *yline, int retval, int flags)
+{
+	if (retval == 0) {
+		/* So far lines are "the same" */
+
+		if (option_mask32 & FLAG_s) {
+			/* "Stable sort": later line is "greater than",
+			 * IOW: do not allow qsort() to swap equal lines.
+			 */
+			uint32_t *p32;
+			uint32_t x32, y32;
+			unsigned len;
+
+			len = (strlen(xline) + 4) & (~3u);
+			p32 = (void*)(xline + len);
+			x32 = *p32;
+			len = (strlen(yline) + 4) & (~3u);
+			p32 = (void*)(yline + len);
+			y32 = *p32;
+
+			/* If x > y, 1, else -1 */
+			retval = (x32 > y32) * 2 - 1;
+		} else
+		if (!(option_mask32 & FLAG_no_tie_break)) {
+			/* fallback sort */
+			flags = option_mask32;
+			retval = strcmp(xline, yline);
+		}
+	}
+
+	if (flags & FLAG_r)
+		return -retval;
+
+	return retval;
+}
+
 /* Iterate through keys list and perform comparisons */
 static int compare_keys(const void *xarg, const void *yarg)
 {
@@ -357,41 +427,175 @@ static int compare_keys(const void *xarg, const void *yarg)
 #endif
 	} /* for */
 
-	if (retval == 0) {
-		/* So far lines are "the same" */
+	return finish_compare(*(char **)xarg, *(char **)yarg, retval, flags);
+}
 
-		if (option_mask32 & FLAG_s) {
-			/* "Stable sort": later line is "greater than",
-			 * IOW: do not allow qsort() to swap equal lines.
-			 */
-			uint32_t *p32;
-			uint32_t x32, y32;
-			char *line;
-			unsigned len;
+#if ENABLE_FEATURE_SORT_BIG
+/* Decorate-sort-undecorate: compare_keys() extracts keys and parses
+ * numbers and month names on every call, O(n log n) times.
+ * Instead, every key of every line is extracted once into a record,
+ * and records are sorted by comparing the prepared values.
+ */
+struct sort_val {
+	union {
+		char *str;      /* string keys */
+		double num;     /* -n, -g */
+	} u;
+	int cls;                /* -g: 0 not a number, 1 NaN, 2 number. -M: month or -1 */
+};
 
-			line = *(char**)xarg;
-			len = (strlen(line) + 4) & (~3u);
-			p32 = (void*)(line + len);
-			x32 = *p32;
-			line = *(char**)yarg;
-			len = (strlen(line) + 4) & (~3u);
-			p32 = (void*)(line + len);
-			y32 = *p32;
+struct sort_rec {
+	char *line;
+	struct sort_val val[];
+};
 
-			/* If x > y, 1, else -1 */
-			retval = (x32 > y32) * 2 - 1;
-		} else
-		if (!(option_mask32 & FLAG_no_tie_break)) {
-			/* fallback sort */
-			flags = option_mask32;
-			retval = strcmp(*(char **)xarg, *(char **)yarg);
+static int compare_recs(const void *xarg, const void *yarg)
+{
+	const struct sort_rec *xrec = xarg;
+	const struct sort_rec *yrec = yarg;
+	const struct sort_val *x = xrec->val;
+	const struct sort_val *y = yrec->val;
+	struct sort_key *key;
+	int flags = option_mask32, retval = 0;
+
+	for (key = key_list; !retval && key; key = key->next_key, x++, y++) {
+		flags = key->flags ? key->flags : option_mask32;
+		switch (flags & (FLAG_n | FLAG_g | FLAG_M | FLAG_V)) {
+#if defined(HAVE_STRVERSCMP) && HAVE_STRVERSCMP == 1
+		case FLAG_V:
+			retval = strverscmp(x->u.str, y->u.str);
+			break;
+#endif
+		case 0:
+#if ENABLE_LOCALE_SUPPORT
+			retval = strcoll(x->u.str, y->u.str);
+#else
+			retval = strcmp(x->u.str, y->u.str);
+#endif
+			break;
+		case FLAG_g:
+			/* not numbers < NaN < -infinity < numbers < +infinity */
+			retval = x->cls - y->cls;
+			if (retval || x->cls != 2)
+				break;
+			/* fall through */
+		case FLAG_n:
+			retval = (x->u.num > y->u.num) ? 1 : ((x->u.num < y->u.num) ? -1 : 0);
+			break;
+		case FLAG_M:
+			retval = x->cls - y->cls;
+			break;
 		}
 	}
 
-	if (flags & FLAG_r)
-		return -retval;
+	return finish_compare(xrec->line, yrec->line, retval, flags);
+}
 
-	return retval;
+/* Returns 0 if sorting has to be done by compare_keys() */
+static int sort_decorated(char **lines, int linecount)
+{
+	struct sort_key *key;
+	struct sort_rec *rec;
+	char *recs;
+	unsigned nkeys, rec_size;
+	int i;
+
+	nkeys = 0;
+	for (key = key_list; key; key = key->next_key) {
+		int flags = key->flags ? key->flags : option_mask32;
+		switch (flags & (FLAG_n | FLAG_g | FLAG_M | FLAG_V)) {
+#if defined(HAVE_STRVERSCMP) && HAVE_STRVERSCMP == 1
+		case FLAG_V:
+#endif
+		case 0:
+		case FLAG_g:
+		case FLAG_M:
+		case FLAG_n:
+			break;
+		default:
+			/* Let compare_keys() complain */
+			return 0;
+		}
+		nkeys++;
+	}
+	/* Plain whole line sort: keys are lines themselves,
+	 * nothing to precompute */
+	key = key_list;
+	if (nkeys == 1) {
+		int flags = key->flags ? key->flags : option_mask32;
+		if (key_is_whole_line(key, flags)
+		 && !(flags & (FLAG_n | FLAG_g | FLAG_M))
+		) {
+			return 0;
+		}
+	}
+
+	rec_size = sizeof(*rec) + nkeys * sizeof(rec->val[0]);
+	recs = xmalloc((size_t)linecount * rec_size);
+	for (i = 0; i < linecount; i++) {
+		struct sort_val *v;
+
+		rec = (void*)(recs + (size_t)i * rec_size);
+		rec->line = lines[i];
+		v = rec->val;
+		for (key = key_list; key; key = key->next_key, v++) {
+			int flags = key->flags ? key->flags : option_mask32;
+			char *str = get_key(lines[i], key, flags);
+
+			switch (flags & (FLAG_n | FLAG_g | FLAG_M | FLAG_V)) {
+			case FLAG_g: {
+				char *end;
+				v->u.num = strtod(str, &end);
+				v->cls = (str == end) ? 0 : ((v->u.num != v->u.num) ? 1 : 2);
+				goto free_key;
+			}
+			case FLAG_M: {
+				struct tm thyme;
+				v->cls = strptime(str, "%b", &thyme) ? thyme.tm_mon : -1;
+				goto free_key;
+			}
+			case FLAG_n:
+				v->u.num = atof(str);
+ free_key:
+				if (str != lines[i])
+					free(str);
+				break;
+			default:
+				v->u.str = str;
+			}
+		}
+	}
+
+	qsort(recs, linecount, rec_size, compare_recs);
+
+	/* Undecorate */
+	for (i = 0; i < linecount; i++) {
+		struct sort_val *v;
+
+		rec = (void*)(recs + (size_t)i * rec_size);
+		lines[i] = rec->line;
+		v = rec->val;
+		for (key = key_list; key; key = key->next_key, v++) {
+			int flags = key->flags ? key->flags : option_mask32;
+			if (!(flags & (FLAG_n | FLAG_g | FLAG_M))
+			 && v->u.str != rec->line
+			) {
+				free(v->u.str);
+			}
+		}
+	}
+	free(recs);
+	return 1;
+}
+#endif
+
+static void sort_line_array(char **lines, int linecount)
+{
+#if ENABLE_FEATURE_SORT_BIG
+	if (linecount > 1 && sort_decorated(lines, linecount))
+		return;
+#endif
+	qsort(lines, linecount, sizeof(lines[0]), compare_keys);
 }
 
 #if ENABLE_FEATURE_SORT_BIG
@@ -407,15 +611,384 @@ static unsigned str2u(char **str)
 }
 #endif
 
+/* For stable sort, store original line position beyond terminating NUL */
+static void mark_line_positions(char **lines, int linecount)
+{
+	int i;
+
+	for (i = 0; i < linecount; i++) {
+		uint32_t *p32;
+		char *line;
+		unsigned len;
+
+		line = lines[i];
+		len = (strlen(line) + 4) & (~3u);
+		lines[i] = line = xrealloc(line, len + 4);
+		p32 = (void*)(line + len);
+		*p32 = i;
+	}
+	/*option_mask32 |= FLAG_no_tie_break;*/
+	/* ^^^redundant: if FLAG_s, compare_keys() does no tie break */
+}
+
+/* Sort lines[], handle -s and -u. Returns new line count */
+static int sort_lines(char **lines, int linecount)
+{
+	int i;
+
+	if (option_mask32 & FLAG_s)
+		mark_line_positions(lines, linecount);
+
+	/* Perform the actual sort */
+	sort_line_array(lines, linecount);
+
+	/* Handle -u */
+	if (option_mask32 & FLAG_u) {
+		int j = 0;
+		/* coreutils 6.3 drop lines for which only key is the same
+		 * -- disabling last-resort compare, or else compare_keys()
+		 * will be the same only for completely identical lines.
+		 */
+		option_mask32 |= FLAG_no_tie_break;
+		for (i = 1; i < linecount; i++) {
+			if (compare_keys(&lines[j], &lines[i]) == 0)
+				free(lines[i]);
+			else
+				lines[++j] = lines[i];
+		}
+		option_mask32 &= ~FLAG_no_tie_break;
+		if (linecount)
+			linecount = j+1;
+	}
+	return linecount;
+}
+
+#if ENABLE_FEATURE_SORT_EXTERNAL
+/* -S: lines are collected until the memory budget is used up,
+ * then sorted and written out to a temporary file ("run").
+ * At EOF all runs are merged. To bound the number of open files,
+ * MERGE_FANIN runs of the same level are merged into one run
+ * of the next level as soon as they accumulate.
+ */
+enum { MERGE_FANIN = 16 };
+
+struct sort_run {
+	FILE *fp;       /* spilled run, or NULL for the in-memory one */
+	char **lines;   /* in-memory run */
+	unsigned count;
+	unsigned level;
+	char *line;     /* current head line of the run */
+#if ENABLE_PLATFORM_MINGW32
+	char *name;     /* can't unlink open files on Windows */
+#endif
+};
+
+static const struct suffix_mult sort_size_suffixes[] ALIGN_SUFFIX = {
+	{ "b", 1 },
+	{ "k", 1024 },
+	{ "K", 1024 },
+	{ "M", 1024*1024 },
+	{ "G", 1024*1024*1024 },
+	{ "", 0 }
+};
+
+static const char *tmpdir;
+static size_t mem_limit;
+static struct sort_run *runs;
+static unsigned nruns;
+
+static void put_line(FILE *fp, const char *line)
+{
+	fputs(line, fp);
+	putc((option_mask32 & FLAG_z) ? '\0' : '\n', fp);
+}
+
+static FILE *new_run_file(struct sort_run *run)
+{
+	char *name;
+	int fd;
+
+	memset(run, 0, sizeof(*run));
+	name = xasprintf("%s/sortXXXXXX", tmpdir);
+	fd = xmkstemp(name);
+#if !ENABLE_PLATFORM_MINGW32
+	unlink(name);
+	free(name);
+#else
+	run->name = name;
+#endif
+	run->fp = fdopen(fd, "w+");
+	if (!run->fp)
+		bb_simple_perror_msg_and_die(tmpdir);
+	return run->fp;
+}
+
+static void rewind_run_file(struct sort_run *run)
+{
+	if (fflush(run->fp) != 0 || ferror(run->fp))
+		bb_simple_perror_msg_and_die(tmpdir);
+	rewind(run->fp);
+}
+
+static void close_run(struct sort_run *run)
+{
+	if (run->fp) {
+		fclose(run->fp);
+#if ENABLE_PLATFORM_MINGW32
+		unlink(run->name);
+		free(run->name);
+#endif
+	}
+}
+
+/* Advance run to its next line, return it or NULL at the end */
+static char *next_run_line(struct sort_run *run, unsigned idx)
+{
+	char *line;
+
+	if (run->fp) {
+		line = GET_LINE(run->fp);
+	} else {
+		line = NULL;
+		if (run->count) {
+			run->count--;
+			line = *run->lines++;
+		}
+	}
+	/* Stable sort: lines of earlier runs came first in input,
+	 * break ties by run index (it replaces the line position
+	 * which sort_lines() stored beyond terminating NUL).
+	 */
+	if (line && (option_mask32 & FLAG_s)) {
+		uint32_t *p32;
+		unsigned len = (strlen(line) + 4) & (~3u);
+		if (run->fp)
+			line = xrealloc(line, len + 4);
+		p32 = (void*)(line + len);
+		*p32 = idx;
+	}
+	return (run->line = line);
+}
+
+static void sift_down(struct sort_run **heap, unsigned cnt, unsigned i)
+{
+	struct sort_run *top = heap[i];
+
+	for (;;) {
+		unsigned c = 2*i + 1;
+		if (c >= cnt)
+			break;
+		if (c + 1 < cnt && compare_keys(&heap[c+1]->line, &heap[c]->line) < 0)
+			c++;
+		if (compare_keys(&top->line, &heap[c]->line) <= 0)
+			break;
+		heap[i] = heap[c];
+		i = c;
+	}
+	heap[i] = top;
+}
+
+/* Merge runs r[0..n-1] into fp, closing them */
+static void merge_runs(struct sort_run *r, unsigned n, FILE *fp)
+{
+	struct sort_run **heap;
+	char *prev = NULL;
+	unsigned cnt, i;
+
+	heap = xmalloc(n * sizeof(heap[0]));
+	cnt = 0;
+	for (i = 0; i < n; i++) {
+		if (next_run_line(&r[i], i))
+			heap[cnt++] = &r[i];
+	}
+	for (i = cnt / 2; i-- != 0;)
+		sift_down(heap, cnt, i);
+
+	while (cnt) {
+		struct sort_run *run = heap[0];
+		char *line = run->line;
+
+		if (option_mask32 & FLAG_u) {
+			int same = 0;
+			if (prev) {
+				option_mask32 |= FLAG_no_tie_break;
+				same = (compare_keys(&prev, &line) == 0);
+				option_mask32 &= ~FLAG_no_tie_break;
+			}
+			if (same) {
+				free(line);
+			} else {
+				put_line(fp, line);
+				free(prev);
+				prev = line;
+			}
+		} else {
+			put_line(fp, line);
+			free(line);
+		}
+		if (!next_run_line(run, run - r))
+			heap[0] = heap[--cnt];
+		sift_down(heap, cnt, 0);
+	}
+	free(prev);
+	free(heap);
+
+	for (i = 0; i < n; i++)
+		close_run(&r[i]);
+}
+
+static void add_mem_run(char **lines, int linecount)
+{
+	struct sort_run *run;
+
+	runs = xrealloc_vector(runs, 4, nruns);
+	run = &runs[nruns++];
+	memset(run, 0, sizeof(*run));
+	run->lines = lines;
+	run->count = linecount;
+}
+
+#if ENABLE_FEATURE_SORT_PARALLEL
+/* --parallel: lines[] is cut into slices which are sorted by child
+ * processes. The pointer array is copied into a shared mapping:
+ * after fork() children see the very same strings at the same
+ * addresses, so only the sorted order of pointers travels back.
+ * Sorted slices become in-memory runs for merge_runs().
+ */
+enum {
+	PARALLEL_MIN_SLICE = 8 * 1024, /* lines */
+	PARALLEL_MAX = 64,
+};
+
+static unsigned nparallel;
+static char **shm_lines;
+static size_t shm_size;
+
+static unsigned parallel_slices(int linecount)
+{
+	unsigned n = linecount / PARALLEL_MIN_SLICE;
+
+	if (n < 2)
+		return 0;
+	if (!nparallel) {
+		nparallel = get_cpu_count();
+		if (nparallel > 8)
+			nparallel = 8;
+		if (nparallel == 0)
+			nparallel = 1;
+	}
+	return MIN(n, MIN(nparallel, PARALLEL_MAX));
+}
+
+static int sort_parallel(char **lines, int linecount)
+{
+	pid_t pids[PARALLEL_MAX];
+	unsigned n, k;
+	size_t size;
+
+	n = parallel_slices(linecount);
+	if (n < 2)
+		return 0;
+	size = linecount * sizeof(lines[0]);
+	if (size > shm_size) {
+		void *p;
+		if (shm_lines)
+			munmap(shm_lines, shm_size);
+		shm_lines = NULL;
+		shm_size = 0;
+		p = mmap(NULL, size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+		if (p == MAP_FAILED)
+			return 0; /* sort serially */
+		shm_lines = p;
+		shm_size = size;
+	}
+
+	/* Positions must be stored before fork: it reallocates lines */
+	if (option_mask32 & FLAG_s)
+		mark_line_positions(lines, linecount);
+	memcpy(shm_lines, lines, size);
+
+	/* Slice 0 is sorted by us */
+	for (k = n; --k != 0;) {
+		char **slice = shm_lines + (size_t)linecount * k / n;
+		unsigned count = (size_t)linecount * (k + 1) / n - (slice - shm_lines);
+
+		pids[k] = xfork();
+		if (pids[k] == 0) {
+			sort_line_array(slice, count);
+			_exit(EXIT_SUCCESS);
+		}
+	}
+	sort_line_array(shm_lines, linecount / n);
+
+	for (k = 0; k < n; k++) {
+		char **slice = shm_lines + (size_t)linecount * k / n;
+		unsigned count = (size_t)linecount * (k + 1) / n - (slice - shm_lines);
+
+		if (k != 0 && wait_for_exitstatus(pids[k]) != 0)
+			xfunc_die();
+		/* -u duplicates are dropped by merge_runs() */
+		add_mem_run(slice, count);
+	}
+	return 1;
+}
+#endif
+
+/* Sort lines[] into in-memory run(s) */
+static void add_sorted_runs(char **lines, int linecount)
+{
+#if ENABLE_FEATURE_SORT_PARALLEL
+	if (sort_parallel(lines, linecount))
+		return;
+#endif
+	linecount = sort_lines(lines, linecount);
+	add_mem_run(lines, linecount);
+}
+
+/* Sort lines[] and write them out as a new run */
+static void spill_run(char **lines, int linecount)
+{
+	struct sort_run run;
+	unsigned first = nruns;
+
+	add_sorted_runs(lines, linecount);
+	new_run_file(&run);
+	merge_runs(&runs[first], nruns - first, run.fp);
+	rewind_run_file(&run);
+	nruns = first;
+	runs = xrealloc_vector(runs, 4, nruns);
+	runs[nruns++] = run;
+
+	/* Levels are non-increasing along runs[]: if the last MERGE_FANIN
+	 * runs start and end with the same level, they all have it */
+	while (nruns >= MERGE_FANIN
+	 && runs[nruns - MERGE_FANIN].level == runs[nruns - 1].level
+	) {
+		struct sort_run merged;
+
+		new_run_file(&merged);
+		merged.level = runs[nruns - 1].level + 1;
+		nruns -= MERGE_FANIN;
+		merge_runs(&runs[nruns], MERGE_FANIN, merged.fp);
+		rewind_run_file(&merged);
+		runs[nruns++] = merged;
+	}
+}
+#endif
+
 int sort_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int sort_main(int argc UNUSED_PARAM, char **argv)
 {
 	char **lines;
-	char *str_ignored, *str_o, *str_t;
+	char *str_S, *str_T, *str_o, *str_t;
 	llist_t *lst_k = NULL;
 	int i;
 	int linecount;
 	unsigned opts;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	size_t mem_used = 0;
+#endif
 #if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
 	bool can_drop_dups;
 	size_t prev_len = 0;
@@ -429,10 +1002,19 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	xfunc_error_retval = 2;
 
 	/* Parse command line options */
+#if ENABLE_FEATURE_SORT_PARALLEL
+	opts = getopt32long(argv,
+			sort_opt_str, sort_longopts,
+			&str_S, &str_T, &str_o, &lst_k, &str_t, &nparallel
+	);
+	if ((opts & FLAG_parallel) && nparallel == 0)
+		bb_simple_error_msg_and_die("bad --parallel");
+#else
 	opts = getopt32(argv,
 			sort_opt_str,
-			&str_ignored, &str_ignored, &str_o, &lst_k, &str_t
+			&str_S, &str_T, &str_o, &lst_k, &str_t
 	);
+#endif
 #if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
 	/* Can drop dups only if -u but no "complicating" options,
 	 * IOW: if we do a full line compares. Safe options:
@@ -517,6 +1099,31 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 			}
 		}
 	}
+	/* If no key, perform alphabetic sort */
+	if (!key_list)
+		add_key()->range[0] = 1;
+#endif
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	if ((option_mask32 & (FLAG_S|FLAG_c)) == FLAG_S) {
+		mem_limit = xatoul_sfx(str_S, sort_size_suffixes);
+		if (isdigit(str_S[strlen(str_S) - 1]))
+			mem_limit *= 1024; /* default unit is KiB */
+		tmpdir = str_T;
+		if (!(option_mask32 & FLAG_T)) {
+			tmpdir = getenv("TMPDIR");
+			if (!tmpdir)
+				tmpdir = "/tmp";
+		}
+# if ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
+		/* Spilled lines are freed one by one, can't share tails */
+		count_to_optimize_dups = (size_t)-1L;
+# endif
+	}
+# if ENABLE_FEATURE_SORT_PARALLEL && ENABLE_FEATURE_SORT_OPTIMIZE_MEMORY
+	/* So are lines of parallel sort, if it can be done at all */
+	if (!(option_mask32 & FLAG_c) && parallel_slices(INT_MAX) > 1)
+		count_to_optimize_dups = (size_t)-1L;
+# endif
 #endif
 
 	/* Open input files and read data */
@@ -573,14 +1180,24 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 #endif
 			lines = xrealloc_vector(lines, 6, linecount);
 			lines[linecount++] = line;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+			if (mem_limit) {
+				/* Line, its NUL, the pointer to it and malloc overhead */
+				mem_used += strlen(line) + 1 + 3 * sizeof(line);
+				if (mem_used >= mem_limit) {
+					spill_run(lines, linecount);
+					free(lines);
+					lines = NULL;
+					linecount = 0;
+					mem_used = 0;
+				}
+			}
+#endif
 		}
 		fclose_if_not_stdin(fp);
 	} while (*++argv);
 
 #if ENABLE_FEATURE_SORT_BIG
-	/* If no key, perform alphabetic sort */
-	if (!key_list)
-		add_key()->range[0] = 1;
 	/* Handle -c */
 	if (option_mask32 & FLAG_c) {
 		int j = (option_mask32 & FLAG_u) ? -1 : 0;
@@ -594,43 +1211,17 @@ int sort_main(int argc UNUSED_PARAM, char **argv)
 	}
 #endif
 
-	/* For stable sort, store original line position beyond terminating NUL */
-	if (option_mask32 & FLAG_s) {
-		for (i = 0; i < linecount; i++) {
-			uint32_t *p32;
-			char *line;
-			unsigned len;
-
-			line = lines[i];
-			len = (strlen(line) + 4) & (~3u);
-			lines[i] = line = xrealloc(line, len + 4);
-			p32 = (void*)(line + len);
-			*p32 = i;
-		}
-		/*option_mask32 |= FLAG_no_tie_break;*/
-		/* ^^^redundant: if FLAG_s, compare_keys() does no tie break */
-	}
-
-	/* Perform the actual sort */
-	qsort(lines, linecount, sizeof(lines[0]), compare_keys);
-
-	/* Handle -u */
-	if (option_mask32 & FLAG_u) {
-		int j = 0;
-		/* coreutils 6.3 drop lines for which only key is the same
-		 * -- disabling last-resort compare, or else compare_keys()
-		 * will be the same only for completely identical lines.
-		 */
-		option_mask32 |= FLAG_no_tie_break;
-		for (i = 1; i < linecount; i++) {
-			if (compare_keys(&lines[j], &lines[i]) == 0)
-				free(lines[i]);
-			else
-				lines[++j] = lines[i];
-		}
-		if (linecount)
-			linecount = j+1;
+#if ENABLE_FEATURE_SORT_EXTERNAL
+	if (nruns IF_FEATURE_SORT_PARALLEL(|| parallel_slices(linecount) > 1)) {
+		/* Merge remaining lines with spilled ones */
+		add_sorted_runs(lines, linecount);
+		if (option_mask32 & FLAG_o)
+			xmove_fd(xopen(str_o, O_WRONLY|O_CREAT|O_TRUNC), STDOUT_FILENO);
+		merge_runs(runs, nruns, stdout);
+		fflush_stdout_and_exit(EXIT_SUCCESS);
 	}
+#endif
+	linecount = sort_lines(lines, linecount);
 
 	/* Print it */
 #if ENABLE_FEATURE_SORT_BIG
@@ -31,18 +31,137 @@
 
 /* This is a NOEXEC applet. Be very careful! */
 
-struct lstring {
-	int size;
-	char buf[1];
+/* Files are read backwards in blocks of this size (or bigger,
+ * if they have longer lines), lines are printed from the buffer */
+#define TAC_BUFSIZE (64 * 1024)
+/* Up to this much of non-seekable input is kept in memory,
+ * the rest goes to a temporary file */
+#define TAC_MEMSIZE (1024 * 1024)
+
+struct tac_buf {
+	char *buf;
+	size_t size;
 };
 
+static void grow_buf(struct tac_buf *b, size_t size)
+{
+	if (b->size < size) {
+		b->size = size;
+		b->buf = xrealloc(b->buf, size);
+	}
+}
+
+/* Print lines of buf[0..len) in reverse order, except the first one
+ * which may be incomplete. Return its length (with the '\n').
+ */
+static size_t put_lines(char *buf, size_t len)
+{
+	char *e = buf + len;
+	char *q = e - 1; /* '\n' at the very end belongs to the last line */
+
+	while (q > buf && (q = memrchr(buf, '\n', q - buf)) != NULL) {
+		fwrite(q + 1, 1, e - (q + 1), stdout);
+		e = q + 1;
+	}
+	return e - buf;
+}
+
+/* Print fd's data from start to end in reverse, reading it backwards */
+static int tac_seekable(int fd, off_t start, off_t end, struct tac_buf *b)
+{
+	size_t len = 0; /* not printed yet, they are at b->buf[0..len) */
+	ssize_t r;
+
+	while (end > start) {
+		size_t n = len > TAC_BUFSIZE ? len : TAC_BUFSIZE;
+
+		if (n > end - start)
+			n = end - start;
+		grow_buf(b, len + n);
+		memmove(b->buf + n, b->buf, len);
+		end -= n;
+		if (lseek(fd, end, SEEK_SET) < 0)
+			return -1;
+		r = full_read(fd, b->buf, n);
+		if (r != n) {
+			if (r >= 0) /* file was truncated meanwhile */
+				errno = EIO;
+			return -1;
+		}
+		len = put_lines(b->buf, len + n);
+	}
+	fwrite(b->buf, 1, len, stdout);
+	return 0;
+}
+
+static int tac_fd(int fd, struct tac_buf *b)
+{
+	struct stat st;
+	off_t start;
+	size_t len;
+	char *name;
+	int tmp_fd;
+	int r;
+
+	/* Don't trust sizes up to st_blksize, files in /proc and /sys
+	 * lie about them. Reading starts from the current position:
+	 * (read x; tac) <file
+	 */
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+	 && st.st_size > st.st_blksize
+	) {
+		start = lseek(fd, 0, SEEK_CUR);
+		if (start >= 0)
+			return tac_seekable(fd, start, st.st_size, b);
+	}
+
+	/* Not seekable (or small): read it in */
+	grow_buf(b, TAC_BUFSIZE);
+	len = 0;
+	for (;;) {
+		ssize_t n;
+
+		if (len == b->size) {
+			if (len >= TAC_MEMSIZE)
+				break;
+			grow_buf(b, len * 2);
+		}
+		n = safe_read(fd, b->buf + len, b->size - len);
+		if (n < 0)
+			return -1;
+		if (n == 0) {
+			len = put_lines(b->buf, len);
+			fwrite(b->buf, 1, len, stdout);
+			return 0;
+		}
+		len += n;
+	}
+
+	/* It's big, store it in a file */
+	name = xasprintf("%s/tacXXXXXX", getenv("TMPDIR") ? : "/tmp");
+	tmp_fd = xmkstemp(name);
+#if !ENABLE_PLATFORM_MINGW32
+	unlink(name);
+#endif
+	do {
+		xwrite(tmp_fd, b->buf, len);
+		len = safe_read(fd, b->buf, b->size);
+	} while ((ssize_t)len > 0);
+	r = -1;
+	if ((ssize_t)len == 0)
+		r = tac_seekable(tmp_fd, 0, xlseek(tmp_fd, 0, SEEK_CUR), b);
+	close(tmp_fd);
+#if ENABLE_PLATFORM_MINGW32
+	unlink(name);
+#endif
+	free(name);
+	return r;
+}
+
 int tac_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int tac_main(int argc UNUSED_PARAM, char **argv)
 {
-	char **name;
-	FILE *f;
-	struct lstring *line = NULL;
-	llist_t *list = NULL;
+	struct tac_buf b;
 	int retval = EXIT_SUCCESS;
 
 #if ENABLE_DESKTOP
@@ -62,56 +181,25 @@ We support none, but at least we will complain or handle "--":
 #endif
 	if (!*argv)
 		*--argv = (char *)"-";
-	/* We will read from last file to first */
-	name = argv;
-	while (*name)
-		name++;
 
+	b.buf = NULL;
+	b.size = 0;
 	do {
-		int ch, i;
-
-		name--;
-		f = fopen_or_warn_stdin(*name);
-		if (f == NULL) {
-			/* error message is printed by fopen_or_warn_stdin */
+		int fd = open_or_warn_stdin(*argv);
+		if (fd < 0) {
+			/* error message is printed by open_or_warn_stdin */
 			retval = EXIT_FAILURE;
 			continue;
 		}
-
-		errno = i = 0;
-		do {
-			ch = fgetc(f);
-			if (ch != EOF) {
-				if (!(i & 0x7f))
-					/* Grow on every 128th char */
-					line = xrealloc(line, i + 0x7f + sizeof(int) + 1);
-				line->buf[i++] = ch;
-			}
-			if (ch == '\n' || (ch == EOF && i != 0)) {
-				line = xrealloc(line, i + sizeof(int));
-				line->size = i;
-				llist_add_to(&list, line);
-				line = NULL;
-				i = 0;
-			}
-		} while (ch != EOF);
-		/* fgetc sets errno to ENOENT on EOF, we don't want
-		 * to warn on this non-error! */
-		if (errno && errno != ENOENT) {
-			bb_simple_perror_msg(*name);
+		if (tac_fd(fd, &b) != 0) {
+			bb_simple_perror_msg(*argv);
 			retval = EXIT_FAILURE;
 		}
-	} while (name != argv);
-
-	while (list) {
-		line = (struct lstring *)list->data;
-		xwrite(STDOUT_FILENO, line->buf, line->size);
-		if (ENABLE_FEATURE_CLEAN_UP) {
-			free(llist_pop(&list));
-		} else {
-			list = list->link;
-		}
-	}
+		if (fd != STDIN_FILENO)
+			close(fd);
+	} while (*++argv);
 
-	return retval;
+	if (ENABLE_FEATURE_CLEAN_UP)
+		free(b.buf);
+	fflush_stdout_and_exit(retval);
 }
@@ -36,6 +36,16 @@
 //config:		-s SEC  Wait SEC seconds between reads with -f
 //config:		-v      Always output headers giving file names
 //config:		-F      Same as -f, but keep retrying
+//config:
+//config:config FEATURE_TAIL_INOTIFY
+//config:	bool "Use inotify to wait for changes with -f and -F"
+//config:	default y
+//config:	depends on TAIL && PLATFORM_POSIX
+//config:	help
+//config:	Instead of waking up every -s SECONDS to check all files,
+//config:	sleep until the kernel reports that one of them was written to,
+//config:	truncated, replaced or created, and look only at those.
+//config:	Falls back to polling if inotify is not available.
 
 //applet:IF_TAIL(APPLET(tail, BB_DIR_USR_BIN, BB_SUID_DROP))
 
@@ -70,10 +80,21 @@
 
 #include "libbb.h"
 #include "common_bufsiz.h"
+#if ENABLE_FEATURE_TAIL_INOTIFY
+# include <sys/inotify.h>
+#endif
 
 struct globals {
 	bool from_top;
 	bool exitcode;
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	bool rewatch;     /* (re)add watches before waiting */
+	bool polling;     /* something can't be watched, wake up anyway */
+	int inotify_fd;
+	int *wd;          /* per file: watch of the file */
+	int *dir_wd;      /* per file: watch of its directory (-F) */
+	char *dirty;      /* per file: 1: may have changed, 2: has changed */
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
 #define INIT_G() do { setup_common_bufsiz(); } while (0)
@@ -99,6 +120,97 @@ static ssize_t tail_read(int fd, char *buf, size_t count)
 
 #define header_fmt_str "\n==> %s <==\n"
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+# define FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF)
+# define DIR_EVENTS  (IN_CREATE | IN_MOVED_TO | IN_DELETE | IN_MOVED_FROM)
+
+/* -f follows the open file: watch it via /proc/self/fd, whatever its
+ * name is now. -F follows the name: watch the file by name, and its
+ * directory to see it created or replaced.
+ * Sets G.polling if some file can't be watched.
+ */
+static void tail_watch(char **argv, int *fds, unsigned nfiles, int retry)
+{
+	unsigned i;
+
+	G.polling = 0;
+	for (i = 0; i < nfiles; i++) {
+		int wd;
+
+		if (retry) {
+			if (G.dir_wd[i] < 0) {
+				char *dir = xstrdup(argv[i]);
+				G.dir_wd[i] = inotify_add_watch(G.inotify_fd,
+						dirname(dir), DIR_EVENTS);
+				free(dir);
+			}
+			wd = inotify_add_watch(G.inotify_fd, argv[i], FILE_EVENTS);
+			if (G.dir_wd[i] < 0)
+				G.polling = 1;
+		} else {
+			char path[sizeof("/proc/self/fd/%d") + sizeof(int)*3];
+
+			if (fds[i] < 0)
+				continue;
+			sprintf(path, "/proc/self/fd/%d", fds[i]);
+			wd = inotify_add_watch(G.inotify_fd, path, FILE_EVENTS);
+			if (wd < 0)
+				G.polling = 1;
+		}
+		G.wd[i] = wd;
+	}
+}
+
+/* Sleep until a followed file may have changed, mark it in G.dirty[] */
+static void tail_wait(char **argv, int *fds, unsigned nfiles,
+		unsigned sleep_period, int retry)
+{
+	union {
+		struct inotify_event ev;
+		char buf[4096];
+	} u;
+	struct pollfd pfd;
+	ssize_t len;
+	char *p;
+
+	if (G.inotify_fd >= 0 && G.rewatch) {
+		G.rewatch = 0;
+		tail_watch(argv, fds, nfiles, retry);
+		/* anything written before the watches were added? */
+		memset(G.dirty, 1, nfiles);
+		return;
+	}
+	if (G.inotify_fd < 0) {
+		sleep(sleep_period);
+		memset(G.dirty, 1, nfiles);
+		return;
+	}
+
+	pfd.fd = G.inotify_fd;
+	pfd.events = POLLIN;
+	if (safe_poll(&pfd, 1, G.polling ? sleep_period * 1000 : -1) <= 0) {
+		memset(G.dirty, 1, nfiles);
+		return;
+	}
+	len = safe_read(G.inotify_fd, u.buf, sizeof(u.buf));
+	for (p = u.buf; p < u.buf + len; ) {
+		struct inotify_event *ev = (void *)p;
+		unsigned i;
+
+		if (ev->mask & IN_Q_OVERFLOW)
+			memset(G.dirty, 1, nfiles);
+		for (i = 0; i < nfiles; i++) {
+			if (ev->wd == G.wd[i] || ev->wd == G.dir_wd[i])
+				G.dirty[i] = 2;
+		}
+		/* file gone or replaced: watch whatever has the name now */
+		if (ev->mask & (DIR_EVENTS | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED))
+			G.rewatch = 1;
+		p += sizeof(*ev) + ev->len;
+	}
+}
+#endif
+
 static unsigned eat_num(const char *p)
 {
 	if (*p == '-')
@@ -338,8 +450,26 @@ int tail_main(int argc, char **argv)
 
 	fmt = NULL;
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+	if (FOLLOW) {
+		G.inotify_fd = inotify_init();
+		if (G.inotify_fd >= 0)
+			close_on_exec_on(G.inotify_fd);
+		G.wd = xmalloc(sizeof(G.wd[0]) * nfiles * 2);
+		G.dir_wd = G.wd + nfiles;
+		for (i = 0; i < (int)nfiles * 2; i++)
+			G.wd[i] = -1;
+		G.dirty = xzalloc(nfiles);
+		G.rewatch = 1;
+	}
+#endif
+
 	if (FOLLOW) while (1) {
+#if ENABLE_FEATURE_TAIL_INOTIFY
+		tail_wait(argv, fds, nfiles, sleep_period, FOLLOW_RETRY);
+#else
 		sleep(sleep_period);
+#endif
 
 		i = 0;
 		do {
@@ -348,7 +478,15 @@ int tail_main(int argc, char **argv)
 			int fd = fds[i];
 			int new_fd = -1;
 			struct stat sbuf;
+			smallint changed = 0;
 
+#if ENABLE_FEATURE_TAIL_INOTIFY
+			if (!G.dirty[i])
+				continue;
+			/* the kernel said so: then it isn't in /proc */
+			changed = (G.dirty[i] == 2);
+			G.dirty[i] = 0;
+#endif
 			if (FOLLOW_RETRY) {
 				struct stat fsbuf;
 
@@ -385,7 +523,7 @@ int tail_main(int argc, char **argv)
 				/* /proc files report zero st_size, don't lseek them */
 				if (fstat(fd, &sbuf) == 0
 				 /* && S_ISREG(sbuf.st_mode) TODO? */
-				 && sbuf.st_size > 0
+				 && (sbuf.st_size > 0 || changed)
 				) {
 					off_t current = lseek(fd, 0, SEEK_CUR);
 					if (sbuf.st_size < current) {
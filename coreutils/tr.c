@@ -61,6 +61,9 @@
 //usage:       "hello world\n"
 
 #include "libbb.h"
+#if defined(__SSE2__)
+# include <emmintrin.h>
+#endif
 
 enum {
 	ASCII = 256,
@@ -69,6 +72,8 @@ enum {
 	 * even for smallest patterns, let's avoid that by using *2:
 	 */
 	TR_BUFSIZ = (BUFSIZ > ASCII*2) ? BUFSIZ : ASCII*2,
+	/* I/O buffer of the specialized loops below */
+	TR_FAST_BUFSIZ = 64 * 1024,
 };
 
 static void map(char *pvector,
@@ -267,6 +272,143 @@ static int complement(char *buffer, int buffer_len)
 	return len;
 }
 
+/*
+ * Specialized loops for the common simple cases. They work in place
+ * on big buffers and have no per-byte option tests.
+ */
+enum {
+	TR_GENERIC,
+	TR_MAP,		/* 1:1 mapping only */
+	TR_DELETE,	/* -d without STRING2 */
+	TR_SQUEEZE,	/* -s without STRING2 */
+};
+
+/* A mapping that adds delta to chars lo..lo+span and keeps all others
+ * (tr A-Z a-z, [:upper:] [:lower:]) is done without the table,
+ * 16 bytes at a time if we can.
+ */
+static void map_range(unsigned char *buf, size_t n,
+		unsigned char lo, unsigned char span, unsigned char delta)
+{
+	size_t i = 0;
+#if defined(__SSE2__)
+	const __m128i vlo = _mm_set1_epi8(lo);
+	/* unsigned <= via signed compare with the sign bits flipped */
+	const __m128i vlim = _mm_set1_epi8(span ^ 0x80);
+	const __m128i vsign = _mm_set1_epi8(0x80);
+	const __m128i vdelta = _mm_set1_epi8(delta);
+
+	for (; i + 16 <= n; i += 16) {
+		__m128i x = _mm_loadu_si128((__m128i*)(buf + i));
+		__m128i y = _mm_xor_si128(_mm_sub_epi8(x, vlo), vsign);
+		__m128i out = _mm_cmpgt_epi8(y, vlim);
+		x = _mm_add_epi8(x, _mm_andnot_si128(out, vdelta));
+		_mm_storeu_si128((__m128i*)(buf + i), x);
+	}
+#endif
+	for (; i < n; i++) {
+		unsigned char c = buf[i];
+		if ((unsigned char)(c - lo) <= span)
+			buf[i] = c + delta;
+	}
+}
+
+static void tr_fast(int kind, const char *vector, const char *invec)
+{
+	unsigned char *buf = xmalloc(TR_FAST_BUFSIZ);
+	unsigned last = UCHAR_MAX + 1; /* not equal to any char */
+	int ndel = 0, delch = 0;
+	int lo = -1, hi = -1, delta = 0;
+	int i;
+
+	if (kind == TR_MAP) {
+		/* is it the identity plus one shifted range? */
+		for (i = 0; i < ASCII; i++) {
+			if ((unsigned char)vector[i] != i) {
+				if (lo < 0) {
+					lo = i;
+					delta = (unsigned char)(vector[i] - i);
+				}
+				hi = i;
+			}
+		}
+		for (i = lo; lo >= 0 && i <= hi; i++) {
+			if ((unsigned char)vector[i] != (unsigned char)(i + delta)) {
+				lo = -2; /* no */
+				break;
+			}
+		}
+	}
+	if (kind == TR_DELETE) {
+		/* single char: memchr() is faster than any loop of ours */
+		for (i = 0; i < ASCII; i++) {
+			if (invec[i]) {
+				ndel++;
+				delch = i;
+			}
+		}
+	}
+
+	for (;;) {
+		ssize_t n = safe_read(STDIN_FILENO, buf, TR_FAST_BUFSIZ);
+		size_t j;
+
+		if (n <= 0) {
+			if (n < 0)
+				bb_simple_perror_msg_and_die(bb_msg_read_error);
+			break;
+		}
+		j = n;
+		if (kind == TR_MAP) {
+			if (lo >= 0)
+				map_range(buf, n, lo, hi - lo, delta);
+			else if (lo == -2) {
+				for (j = 0; j < (size_t)n; j++)
+					buf[j] = vector[buf[j]];
+			}
+		} else if (kind == TR_DELETE && ndel == 1) {
+			unsigned char *p = memchr(buf, delch, n);
+			unsigned char *end = buf + n;
+
+			j = n;
+			if (p) {
+				unsigned char *d = p;
+				while (p < end) { /* *p is to be deleted */
+					unsigned char *q;
+					p++;
+					q = memchr(p, delch, end - p);
+					if (!q)
+						q = end;
+					memmove(d, p, q - p);
+					d += q - p;
+					p = q;
+				}
+				j = d - buf;
+			}
+		} else if (kind == TR_DELETE) {
+			ssize_t k;
+			for (j = k = 0; k < n; k++) {
+				unsigned char c = buf[k];
+				buf[j] = c;
+				j += !invec[c];
+			}
+		} else { /* TR_SQUEEZE */
+			ssize_t k;
+			for (j = k = 0; k < n; k++) {
+				unsigned char c = buf[k];
+				buf[j] = c;
+				j += !(c == last && invec[c]);
+				last = c;
+			}
+		}
+		if (j)
+			xwrite(STDOUT_FILENO, buf, j);
+	}
+
+	if (ENABLE_FEATURE_CLEAN_UP)
+		free(buf);
+}
+
 int tr_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int tr_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -318,6 +460,16 @@ int tr_main(int argc UNUSED_PARAM, char **argv)
 	for (i = 0; i < str2_length; i++)
 		outvec[(unsigned char)(str2[i])] = TRUE;
 
+	i = TR_GENERIC;
+	if (!(opts & TR_OPT_squeeze_reps))
+		i = (opts & TR_OPT_delete) ? (str2_length ? TR_GENERIC : TR_DELETE) : TR_MAP;
+	else if (!(opts & TR_OPT_delete) && !str2_length)
+		i = TR_SQUEEZE;
+	if (i != TR_GENERIC) {
+		tr_fast(i, vector, invec);
+		goto done;
+	}
+
 	goto start_from;
 
 	/* In this loop, str1 space is reused as input buffer,
@@ -349,7 +501,7 @@ int tr_main(int argc UNUSED_PARAM, char **argv)
 		}
 		str2[out_index++] = last = coded;
 	}
-
+ done:
 	if (ENABLE_FEATURE_CLEAN_UP) {
 		free(vector);
 		free(str2);
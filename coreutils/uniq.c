@@ -11,6 +11,15 @@
 //config:	default y
 //config:	help
 //config:	uniq is used to remove duplicate lines from a sorted file.
+//config:
+//config:config FEATURE_UNIQ_UNSORTED
+//config:	bool "Support --unsorted (remove duplicates without sorting)"
+//config:	default y
+//config:	depends on UNIQ && LONG_OPTS
+//config:	help
+//config:	With --unsorted, uniq remembers every distinct line it has seen
+//config:	in a hash table, so the input does not have to be sorted first.
+//config:	-S SIZE limits the memory used for this.
 
 //applet:IF_UNIQ(APPLET(uniq, BB_DIR_USR_BIN, BB_SUID_DROP))
 
@@ -20,7 +29,7 @@
 /* http://www.opengroup.org/onlinepubs/007904975/utilities/uniq.html */
 
 //usage:#define uniq_trivial_usage
-//usage:       "[-cduiz] [-f,s,w N] [FILE [OUTFILE]]"
+//usage:       "[-cduiz] [-f,s,w N] "IF_FEATURE_UNIQ_UNSORTED("[--unsorted [-S SIZE]] ")"[FILE [OUTFILE]]"
 //usage:#define uniq_full_usage "\n\n"
 //usage:       "Discard duplicate lines\n"
 //usage:     "\n	-c	Prefix lines by the number of occurrences"
@@ -31,6 +40,12 @@
 //usage:     "\n	-f N	Skip first N fields"
 //usage:     "\n	-s N	Skip first N chars (after any skipped fields)"
 //usage:     "\n	-w N	Compare N characters in line"
+//usage:	IF_FEATURE_UNIQ_UNSORTED(
+//usage:     "\n	--unsorted	Also discard non-adjacent duplicates, keeping"
+//usage:     "\n			the first one (input needn't be sorted)"
+//usage:     "\n	-S SIZE	Use at most SIZE bytes of memory for --unsorted"
+//usage:     "\n		(default unit KiB)"
+//usage:	)
 //usage:
 //usage:#define uniq_example_usage
 //usage:       "$ echo -e \"a\\na\\nb\\nc\\nc\\na\" | sort | uniq\n"
@@ -40,6 +55,232 @@
 
 #include "libbb.h"
 
+enum {
+	OPT_c = 1 << 0,
+	OPT_d = 1 << 1, /* print only dups */
+	OPT_u = 1 << 2, /* print only uniq */
+	OPT_f = 1 << 3,
+	OPT_s = 1 << 4,
+	OPT_w = 1 << 5,
+	OPT_i = 1 << 6,
+	OPT_z = 1 << 7,
+	OPT_S = (1 << 8) * ENABLE_FEATURE_UNIQ_UNSORTED,
+	OPT_unsorted = (1 << 9) * ENABLE_FEATURE_UNIQ_UNSORTED,
+};
+
+/* Read next line into *buf (reused and grown as needed), without
+ * the terminating eol char. Returns -1 on EOF.
+ */
+static ssize_t get_line(char **buf, size_t *size, char eol)
+{
+	ssize_t len = getdelim(buf, size, eol, stdin);
+
+	/* gnu uniq ignores newlines */
+	if (len > 0 && (*buf)[len - 1] == eol)
+		(*buf)[--len] = '\0';
+#if ENABLE_PLATFORM_MINGW32
+	if (len > 0 && (*buf)[len - 1] == '\r')
+		(*buf)[--len] = '\0';
+#endif
+	return len;
+}
+
+static const char *compare_start(const char *line, unsigned skip_fields, unsigned skip_chars)
+{
+	unsigned i;
+
+	for (i = skip_fields; i; i--) {
+		line = skip_whitespace(line);
+		line = skip_non_whitespace(line);
+	}
+	for (i = skip_chars; *line && i; i--) {
+		++line;
+	}
+	return line;
+}
+
+#if ENABLE_FEATURE_UNIQ_UNSORTED
+/* Every distinct key (the compared part of a line) seen so far.
+ * Entries are appended to big chunks in input order, the hash chains
+ * link them. Without -c/-d/-u, lines are printed as soon as they are
+ * first seen and only the keys are kept.
+ */
+struct uniq_ent {
+	struct uniq_ent *next;
+	unsigned long count;
+	unsigned hash;
+	unsigned len;	/* of line[] */
+	unsigned key;	/* offset of the key in line[] */
+	unsigned klen;
+	char line[];
+};
+#define ENT_SIZE(len) \
+	((offsetof(struct uniq_ent, line) + (len) + 1 + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+struct uniq_chunk {
+	struct uniq_chunk *next;
+	size_t used, size;
+	char data[];
+};
+#define UNIQ_CHUNK_SIZE (1024 * 1024 - 64)
+
+struct uniq_set {
+	struct uniq_ent **tab;
+	unsigned mask;
+	unsigned count;
+	struct uniq_chunk *first, *last;
+	size_t mem_used, mem_limit;
+};
+
+static void charge(struct uniq_set *set, size_t n)
+{
+	set->mem_used += n;
+	if (set->mem_limit && set->mem_used > set->mem_limit)
+		bb_error_msg_and_die("memory limit of %lu bytes exceeded, sort the input",
+				(unsigned long)set->mem_limit);
+}
+
+static void grow_table(struct uniq_set *set)
+{
+	unsigned newmask = set->mask * 2 + 1;
+	struct uniq_ent **newtab;
+	unsigned i;
+
+	charge(set, (newmask + 1) * sizeof(newtab[0]));
+	newtab = xzalloc((newmask + 1) * sizeof(newtab[0]));
+	for (i = 0; i <= set->mask; i++) {
+		struct uniq_ent *e = set->tab[i];
+		while (e) {
+			struct uniq_ent *next = e->next;
+			e->next = newtab[e->hash & newmask];
+			newtab[e->hash & newmask] = e;
+			e = next;
+		}
+	}
+	free(set->tab);
+	set->mem_used -= (set->mask + 1) * sizeof(newtab[0]);
+	set->tab = newtab;
+	set->mask = newmask;
+}
+
+static struct uniq_ent *new_ent(struct uniq_set *set, unsigned len)
+{
+	struct uniq_chunk *c = set->last;
+	size_t need = ENT_SIZE(len);
+	struct uniq_ent *e;
+
+	if (!c || c->size - c->used < need) {
+		size_t size = need > UNIQ_CHUNK_SIZE ? need : UNIQ_CHUNK_SIZE;
+
+		charge(set, sizeof(*c) + size);
+		c = xmalloc(sizeof(*c) + size);
+		c->next = NULL;
+		c->used = 0;
+		c->size = size;
+		if (set->last)
+			set->last->next = c;
+		else
+			set->first = c;
+		set->last = c;
+	}
+	e = (struct uniq_ent *)(c->data + c->used);
+	c->used += need;
+	return e;
+}
+
+static void uniq_unsorted(unsigned opt, unsigned skip_fields, unsigned skip_chars,
+		unsigned max_chars, char eol, size_t mem_limit)
+{
+	struct uniq_set set;
+	struct uniq_chunk *c;
+	char *line = NULL;
+	size_t size = 0;
+	ssize_t len;
+	/* need the counts before anything can be printed? */
+	int keep_lines = opt & (OPT_c | OPT_d | OPT_u);
+
+	memset(&set, 0, sizeof(set));
+	set.mem_limit = mem_limit;
+	set.mask = 1023;
+	charge(&set, (set.mask + 1) * sizeof(set.tab[0]));
+	set.tab = xzalloc((set.mask + 1) * sizeof(set.tab[0]));
+
+	while ((len = get_line(&line, &size, eol)) >= 0) {
+		const char *key = compare_start(line, skip_fields, skip_chars);
+		unsigned klen = strnlen(key, max_chars);
+		unsigned hash = 0x811c9dc5;
+		struct uniq_ent *e;
+		unsigned i;
+
+		for (i = 0; i < klen; i++) {
+			unsigned char ch = key[i];
+			if (opt & OPT_i)
+				ch = tolower(ch);
+			hash = (hash ^ ch) * 0x01000193;
+		}
+
+		for (e = set.tab[hash & set.mask]; e; e = e->next) {
+			if (e->hash == hash && e->klen == klen
+			 && ((opt & OPT_i)
+				? strncasecmp(e->line + e->key, key, klen)
+				: memcmp(e->line + e->key, key, klen)
+			    ) == 0
+			) {
+				break;
+			}
+		}
+		if (e) {
+			e->count++;
+			continue;
+		}
+
+		if (keep_lines) {
+			e = new_ent(&set, len);
+			memcpy(e->line, line, len + 1);
+			e->len = len;
+			e->key = key - line;
+		} else {
+			printf("%s%c", line, eol);
+			e = new_ent(&set, klen);
+			memcpy(e->line, key, klen);
+			e->line[klen] = '\0';
+			e->len = klen;
+			e->key = 0;
+		}
+		e->klen = klen;
+		e->hash = hash;
+		e->count = 1;
+		e->next = set.tab[hash & set.mask];
+		set.tab[hash & set.mask] = e;
+		if (++set.count > set.mask)
+			grow_table(&set);
+	}
+
+	for (c = set.first; c; ) {
+		struct uniq_chunk *next = c->next;
+		size_t pos;
+
+		for (pos = 0; keep_lines && pos < c->used; ) {
+			struct uniq_ent *e = (struct uniq_ent *)(c->data + pos);
+
+			if (!(opt & (OPT_d << (e->count > 1)))) {
+				if (opt & OPT_c)
+					printf("%7lu ", e->count);
+				printf("%s%c", e->line, eol);
+			}
+			pos += ENT_SIZE(e->len);
+		}
+		if (ENABLE_FEATURE_CLEAN_UP)
+			free(c);
+		c = next;
+	}
+	if (ENABLE_FEATURE_CLEAN_UP) {
+		free(set.tab);
+		free(line);
+	}
+}
+#endif
+
 int uniq_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int uniq_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -47,24 +288,27 @@ int uniq_main(int argc UNUSED_PARAM, char **argv)
 	unsigned skip_fields, skip_chars, max_chars;
 	unsigned opt;
 	char eol;
-	char *cur_line;
+	char *line[2];
+	size_t size[2];
+	ssize_t len;
+	unsigned cur;
 	const char *cur_compare;
-
-	enum {
-		OPT_c = 1 << 0,
-		OPT_d = 1 << 1, /* print only dups */
-		OPT_u = 1 << 2, /* print only uniq */
-		OPT_f = 1 << 3,
-		OPT_s = 1 << 4,
-		OPT_w = 1 << 5,
-		OPT_i = 1 << 6,
-		OPT_z = 1 << 7,
-	};
+#if ENABLE_FEATURE_UNIQ_UNSORTED
+	static const char uniq_longopts[] ALIGN1 =
+		"unsorted\0" No_argument "\xff"
+		;
+	const char *str_S = NULL;
+#endif
 
 	skip_fields = skip_chars = 0;
 	max_chars = INT_MAX;
 
+#if ENABLE_FEATURE_UNIQ_UNSORTED
+	opt = getopt32long(argv, "cduf:+s:+w:+izS:\xff", uniq_longopts,
+			&skip_fields, &skip_chars, &max_chars, &str_S);
+#else
 	opt = getopt32(argv, "cduf:+s:+w:+iz", &skip_fields, &skip_chars, &max_chars);
+#endif
 	argv += optind;
 
 	input_filename = argv[0];
@@ -88,55 +332,63 @@ int uniq_main(int argc UNUSED_PARAM, char **argv)
 		}
 	}
 
-	cur_compare = cur_line = NULL; /* prime the pump */
 	eol = (opt & OPT_z) ? 0 : '\n';
 
-	do {
-		unsigned i;
-		unsigned long dups;
-		char *old_line;
-		const char *old_compare;
-
-		old_line = cur_line;
-		old_compare = cur_compare;
-		dups = 0;
-
-		/* gnu uniq ignores newlines */
-		while ((cur_line = xmalloc_fgetline(stdin)) != NULL) {
-			cur_compare = cur_line;
-			for (i = skip_fields; i; i--) {
-				cur_compare = skip_whitespace(cur_compare);
-				cur_compare = skip_non_whitespace(cur_compare);
-			}
-			for (i = skip_chars; *cur_compare && i; i--) {
-				++cur_compare;
-			}
+#if ENABLE_FEATURE_UNIQ_UNSORTED
+	if (opt & OPT_unsorted) {
+		size_t mem_limit = 0;
 
-			if (!old_line)
-				break;
+		if (opt & OPT_S) {
+			mem_limit = xatoul_sfx(str_S, kmg_i_suffixes);
+			if (isdigit(str_S[strlen(str_S) - 1]))
+				mem_limit *= 1024; /* default unit is KiB */
+		}
+		uniq_unsorted(opt, skip_fields, skip_chars, max_chars, eol, mem_limit);
+		goto done;
+	}
+#endif
+
+	/* Two line buffers, reused: the first line of the current run
+	 * of duplicates, and the line just read */
+	line[0] = line[1] = NULL;
+	size[0] = size[1] = 0;
+	cur = 0;
+	cur_compare = NULL;
+	len = get_line(&line[0], &size[0], eol); /* prime the pump */
+	if (len >= 0)
+		cur_compare = compare_start(line[0], skip_fields, skip_chars);
+
+	while (len >= 0) {
+		unsigned long dups = 0;
+		unsigned old = cur;
+		const char *old_compare = cur_compare;
+
+		cur ^= 1;
+		while ((len = get_line(&line[cur], &size[cur], eol)) >= 0) {
+			cur_compare = compare_start(line[cur], skip_fields, skip_chars);
 			if ((opt & OPT_i)
 				? strncasecmp(old_compare, cur_compare, max_chars)
 				: strncmp(old_compare, cur_compare, max_chars)
 			) {
 				break;
 			}
-
-			free(cur_line);
 			++dups;  /* testing for overflow seems excessive */
 		}
 
-		if (old_line) {
-			if (!(opt & (OPT_d << !!dups))) { /* (if dups, opt & OPT_u) */
-				if (opt & OPT_c) {
-					/* %7lu matches GNU coreutils 6.9 */
-					printf("%7lu ", dups + 1);
-				}
-				printf("%s%c", old_line, eol);
+		if (!(opt & (OPT_d << !!dups))) { /* (if dups, opt & OPT_u) */
+			if (opt & OPT_c) {
+				/* %7lu matches GNU coreutils 6.9 */
+				printf("%7lu ", dups + 1);
 			}
-			free(old_line);
+			printf("%s%c", line[old], eol);
 		}
-	} while (cur_line);
+	}
+	if (ENABLE_FEATURE_CLEAN_UP) {
+		free(line[0]);
+		free(line[1]);
+	}
 
+ IF_FEATURE_UNIQ_UNSORTED(done:)
 	die_if_ferror(stdin, input_filename);
 
 	fflush_stdout_and_exit(EXIT_SUCCESS);
@@ -31,6 +31,8 @@
  *      (dd ibs=1k skip=1 count=0 &> /dev/null; wc -c) < /tmp/testfile
  *
  * for which 'wc -c' should output '0'.
+ *
+ * Now it is done (see skip_by_size), taking the position into account.
  */
 //config:config WC
 //config:	bool "wc (4.5 kb)"
@@ -105,6 +107,60 @@ enum {
 	NUM_WCS     = 5,
 };
 
+#define WC_BUFSIZE (64 * 1024)
+
+/* Byte classes for -w without -L: bit 0 - byte is a part of a word,
+ * bit 1 - byte doesn't end a word (non-printable, non-whitespace) */
+enum {
+	CL_SPACE = 0,
+	CL_WORD  = 1,
+	CL_OTHER = 2,
+};
+
+static void fill_classes(uint8_t *cls)
+{
+	unsigned c = 0;
+	do {
+		if (isprint_asciionly(c)) /* FIXME: not unicode-aware */
+			cls[c] = isspace(c) ? CL_SPACE : CL_WORD;
+		else if ((c - 9) <= 4) /* \t \n \v \f \r */
+			cls[c] = CL_SPACE;
+		else
+			cls[c] = CL_OTHER;
+	} while (++c < 256);
+}
+
+static unsigned count_newlines(const char *p, const char *end)
+{
+	unsigned n = 0;
+	/* memchr is vectorized in libc, much faster than byte by byte */
+	while ((p = memchr(p, '\n', end - p)) != NULL) {
+		n++;
+		if (++p == end)
+			break;
+	}
+	return n;
+}
+
+/* With pure -c on a regular file, seek to the last block and read
+ * only the rest. Sizes up to st_blksize are not trusted at all:
+ * files in /proc and /sys lie about their size. The current position
+ * matters too: (dd ibs=1k skip=1 count=0; wc -c) <file
+ */
+static COUNT_T skip_by_size(int fd)
+{
+	struct stat st;
+	off_t pos, hi;
+
+	if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+		return 0;
+	hi = st.st_size - st.st_size % ((off_t)st.st_blksize + 1);
+	pos = lseek(fd, 0, SEEK_CUR);
+	if (pos < 0 || pos >= hi || lseek(fd, hi, SEEK_SET) < 0)
+		return 0;
+	return hi - pos;
+}
+
 int wc_main(int argc, char **argv) MAIN_EXTERNALLY_VISIBLE;
 int wc_main(int argc UNUSED_PARAM, char **argv)
 {
@@ -114,9 +170,12 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 	COUNT_T *pcounts;
 	COUNT_T counts[NUM_WCS];
 	COUNT_T totals[NUM_WCS];
+	char *buf;
+	uint8_t cls[256];
 	int num_files;
 	smallint status = EXIT_SUCCESS;
 	unsigned print_type;
+	unsigned unichars;
 
 	init_unicode();
 
@@ -125,6 +184,10 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 	if (print_type == 0) {
 		print_type = (1 << WC_LINES) | (1 << WC_WORDS) | (1 << WC_BYTES);
 	}
+	/* Is -m different from -c? */
+	unichars = (unicode_status == UNICODE_ON) << WC_UNICHARS;
+	if (print_type & ((1 << WC_WORDS) | unichars))
+		fill_classes(cls);
 
 	argv += optind;
 	if (!argv[0]) {
@@ -139,18 +202,19 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 	memset(totals, 0, sizeof(totals));
 
 	pcounts = counts;
+	buf = xmalloc(WC_BUFSIZE);
 
 	num_files = 0;
 	while ((arg = *argv++) != NULL) {
-		FILE *fp;
 		const char *s;
 		unsigned u;
 		unsigned linepos;
 		smallint in_word;
+		int fd;
 
 		++num_files;
-		fp = fopen_or_warn_stdin(arg);
-		if (!fp) {
+		fd = open_or_warn_stdin(arg);
+		if (fd < 0) {
 			status = EXIT_FAILURE;
 			continue;
 		}
@@ -159,66 +223,103 @@ int wc_main(int argc UNUSED_PARAM, char **argv)
 		linepos = 0;
 		in_word = 0;
 
+		if (!(print_type & ~((1 << WC_BYTES) | ((1 << WC_UNICHARS) & ~unichars))))
+			counts[WC_BYTES] = skip_by_size(fd);
+
 		while (1) {
-			int c;
-			/* Our -w doesn't match GNU wc exactly... oh well */
+			const char *p, *end;
+			ssize_t n;
 
-			c = getc(fp);
-			if (c == EOF) {
-				if (ferror(fp)) {
+			n = safe_read(fd, buf, WC_BUFSIZE);
+			if (n <= 0) {
+				if (n < 0) {
 					bb_simple_perror_msg(arg);
 					status = EXIT_FAILURE;
 				}
-				goto DO_EOF;  /* Treat an EOF as '\r'. */
+				break;
 			}
+			counts[WC_BYTES] += n;
+			p = buf;
+			end = buf + n;
 
-			/* Cater for -c and -m */
-			++counts[WC_BYTES];
-			if (unicode_status != UNICODE_ON /* every byte is a new char */
-			 || (c & 0xc0) != 0x80 /* it isn't a 2nd+ byte of a Unicode char */
-			) {
-				++counts[WC_UNICHARS];
-			}
+			if (print_type & (1 << WC_LENGTH)) {
+				/* The general case, byte by byte */
+				do {
+					unsigned c = (unsigned char)*p;
 
-			if (isprint_asciionly(c)) { /* FIXME: not unicode-aware */
-				++linepos;
-				if (!isspace(c)) {
-					in_word = 1;
-					continue;
-				}
-			} else if ((unsigned)(c - 9) <= 4) {
-				/* \t  9
-				 * \n 10
-				 * \v 11
-				 * \f 12
-				 * \r 13
-				 */
-				if (c == '\t') {
-					linepos = (linepos | 7) + 1;
-				} else {  /* '\n', '\r', '\f', or '\v' */
- DO_EOF:
-					if (linepos > counts[WC_LENGTH]) {
-						counts[WC_LENGTH] = linepos;
+					if (unichars /* not every byte is a new char */
+					 && (c & 0xc0) == 0x80 /* it is a 2nd+ byte of a Unicode char */
+					) {
+						counts[WC_UNICHARS]--;
 					}
-					if (c == '\n') {
-						++counts[WC_LINES];
+					/* Our -w doesn't match GNU wc exactly... oh well */
+					if (isprint_asciionly(c)) { /* FIXME: not unicode-aware */
+						++linepos;
+						if (!isspace(c)) {
+							in_word = 1;
+							continue;
+						}
+					} else if ((c - 9) <= 4) {
+						/* \t  9
+						 * \n 10
+						 * \v 11
+						 * \f 12
+						 * \r 13
+						 */
+						if (c == '\t') {
+							linepos = (linepos | 7) + 1;
+						} else {  /* '\n', '\r', '\f', or '\v' */
+							if (linepos > counts[WC_LENGTH]) {
+								counts[WC_LENGTH] = linepos;
+							}
+							if (c == '\n') {
+								++counts[WC_LINES];
+							}
+							if (c != '\v') {
+								linepos = 0;
+							}
+						}
+					} else {
+						continue;
 					}
-					if (c != '\v') {
-						linepos = 0;
-					}
-				}
-			} else {
-				continue;
-			}
+					counts[WC_WORDS] += in_word;
+					in_word = 0;
+				} while (++p != end);
+			} else if (print_type & ((1 << WC_WORDS) | unichars)) {
+				/* Count word starts rather than ends,
+				 * it's the same at EOF and needs no branches */
+				COUNT_T words = 0, lines = 0, cont = 0;
+				do {
+					unsigned c = (unsigned char)*p;
+					unsigned k = cls[c];
+					unsigned w = (k & CL_WORD) | (in_word & (k >> 1));
 
-			counts[WC_WORDS] += in_word;
-			in_word = 0;
-			if (c == EOF) {
-				break;
+					words += w & ~in_word;
+					in_word = w;
+					lines += (c == '\n');
+					cont += ((c & 0xc0) == 0x80);
+				} while (++p != end);
+				counts[WC_WORDS] += words;
+				counts[WC_LINES] += lines;
+				if (unichars)
+					counts[WC_UNICHARS] -= cont;
+			} else if (print_type & (1 << WC_LINES)) {
+				counts[WC_LINES] += count_newlines(p, end);
 			}
 		}
 
-		fclose_if_not_stdin(fp);
+		if (fd != STDIN_FILENO)
+			close(fd);
+
+		/* Treat an EOF as '\r' */
+		if (linepos > counts[WC_LENGTH]) {
+			counts[WC_LENGTH] = linepos;
+		}
+		if (print_type & (1 << WC_LENGTH)) {
+			counts[WC_WORDS] += in_word;
+		}
+		/* Every byte is a char, except 2nd+ bytes of Unicode chars */
+		counts[WC_UNICHARS] += counts[WC_BYTES];
 
 		if (totals[WC_LENGTH] < counts[WC_LENGTH]) {
 			totals[WC_LENGTH] = counts[WC_LENGTH];
@@ -159,16 +159,26 @@ typedef struct hash_item_s {
 		struct rstream_s rs;    /* redirect streams hash */
 		struct func_s f;        /* functions hash */
 	} data;
-	struct hash_item_s *next;       /* next in chain */
+	struct hash_item_s *next, *prev; /* in order of insertion */
+	unsigned hval;                  /* hashidx(name) */
 	char name[1];                   /* really it's longer */
 } hash_item;
 
+/* Open addressing with linear probing, slots[] point to items
+ * (NULL: empty, HASH_DELETED: deleted). When the table fills up,
+ * a bigger one is allocated and the items are moved there a few
+ * at a time by following operations, until then both are searched.
+ */
 typedef struct xhash_s {
 	unsigned nel;           /* num of elements */
-	unsigned csize;         /* current hash size */
-	unsigned nprime;        /* next hash size in PRIMES[] */
 	unsigned glen;          /* summary length of item names */
-	struct hash_item_s **items;
+	unsigned mask;          /* size of slots[] - 1 */
+	unsigned used;          /* non-empty slots[] */
+	struct hash_item_s **slots;
+	struct hash_item_s **old_slots; /* being moved to slots[] */
+	unsigned old_mask;
+	unsigned old_pos;       /* old_slots[] before it are moved */
+	struct hash_item_s *first, *last;
 } xhash;
 
 /* Tree node */
@@ -190,13 +200,48 @@ typedef struct node_s {
 	union {
 		struct node_s *n;
 	} a;
+	char *re_literal; /* TI_REGEXP: lines without it can't match */
+	struct vm_code_s *code; /* compiled on first evaluate() */
 } node;
 
 typedef struct tsplitter_s {
 	node n;
 	regex_t re[2];
+	char *str; /* separator n was made from */
 } tsplitter;
 
+/* Bytecode instruction, see vm_compile() */
+typedef struct vm_insn_s {
+	uint8_t op;
+	uint8_t sub;      /* operation or flags */
+	uint16_t cnt;     /* number of arguments on the stack */
+	unsigned lineno;
+	unsigned target;  /* jumps */
+	union {
+		var *v;
+		node *n;
+		func *f;
+		int aidx;
+		const char *s;
+	} a;
+} vm_insn;
+
+typedef struct vm_code_s {
+	unsigned depth;   /* stack slots it needs */
+	vm_insn insn[1];  /* really it's longer */
+} vm_code;
+
+/* VM stack slot: a number (v == NULL, field == 0), a field
+ * or a var. Fields are kept as index, Fields[] may move
+ * while the slot is live.
+ */
+typedef struct vm_slot_s {
+	var *v;
+	int field;
+	double d;
+	var tmp;          /* value computed into this slot */
+} vm_slot;
+
 /* simple token classes */
 /* order and hex values are very important!!!  See next_token() */
 #define	TC_LPAREN	(1 << 0)		/* ( */
@@ -531,10 +576,26 @@ static const char vValues[] ALIGN1 =
 	"\n\0"      "\n\0"      "\0"        "\0"
 	"\034\0"    "\0"        "\377";
 
-/* hash size may grow to these values */
-#define FIRST_PRIME 61
-static const uint16_t PRIMES[] ALIGN2 = { 251, 1021, 4093, 16381, 65521 };
+#define HASH_FIRST_SIZE 64
+#define HASH_MOVE_STEP  16 /* old slots moved per hash operation */
+#define HASH_DELETED ((hash_item*)(uintptr_t)1)
 
+/* hash items are carved from big blocks, freed ones are kept
+ * in per-size lists for reuse */
+#define HI_GRAIN   8
+#define HI_CLASSES 32
+#define HI_BLOCK   (64 * 1024)
+
+
+enum { REGEX_CACHE_SIZE = 16 };
+
+/* Chunk of the VM stack */
+typedef struct vm_stack_s {
+	struct vm_stack_s *prev, *next;
+	unsigned used;
+	unsigned size;
+	vm_slot s[1];     /* really it's longer */
+} vm_stack;
 
 /* Globals. Split in two parts so that first one is addressed
  * with (mostly short) negative offsets.
@@ -589,9 +650,22 @@ struct globals2 {
 
 	unsigned evaluate__seed;
 	var *evaluate__fnargs;
-	regex_t evaluate__sreg;
 
-	var ptest__tmpvar;
+	/* most recently used dynamic regexps */
+	struct regex_cache_s {
+		char *str;
+		unsigned stamp;
+		smallint ignorecase;
+		regex_t re;
+	} as_regex__cache[REGEX_CACHE_SIZE];
+	unsigned as_regex__stamp;
+
+	vm_stack *vm_stack_top;
+
+	char *hi_block;
+	unsigned hi_block_left;
+	hash_item *hi_free[HI_CLASSES];
+
 	var awk_printf__tmpvar;
 	var as_regex__tmpvar;
 	var exit__tmpvar;
@@ -680,118 +754,213 @@ static unsigned hashidx(const char *name)
 
 	while (*name)
 		idx = *name++ + (idx << 6) - idx;
+	/* Mix high bits into low ones, table index is hval & mask */
+	idx ^= idx >> 16;
+	idx *= 0x45d9f3b;
+	idx ^= idx >> 16;
 	return idx;
 }
 
+static unsigned hash_item_size(const char *name)
+{
+	return sizeof(hash_item) + strlen(name) + 1;
+}
+
+static hash_item *hash_item_alloc(unsigned size)
+{
+	unsigned cls = (size - 1) / HI_GRAIN;
+	hash_item *hi;
+
+	if (cls >= HI_CLASSES)
+		return xzalloc(size);
+	hi = G.hi_free[cls];
+	if (hi) {
+		G.hi_free[cls] = hi->next;
+	} else {
+		size = (cls + 1) * HI_GRAIN;
+		if (G.hi_block_left < size) {
+			G.hi_block = xmalloc(HI_BLOCK);
+			G.hi_block_left = HI_BLOCK;
+		}
+		hi = (hash_item*)G.hi_block;
+		G.hi_block += size;
+		G.hi_block_left -= size;
+	}
+	memset(hi, 0, (cls + 1) * HI_GRAIN);
+	return hi;
+}
+
+static void hash_item_free(hash_item *hi)
+{
+	unsigned cls = (hash_item_size(hi->name) - 1) / HI_GRAIN;
+
+	if (cls >= HI_CLASSES) {
+		free(hi);
+		return;
+	}
+	hi->next = G.hi_free[cls];
+	G.hi_free[cls] = hi;
+}
+
 /* create new hash */
 static xhash *hash_init(void)
 {
 	xhash *newhash;
 
 	newhash = xzalloc(sizeof(*newhash));
-	newhash->csize = FIRST_PRIME;
-	newhash->items = xzalloc(FIRST_PRIME * sizeof(newhash->items[0]));
+	newhash->mask = HASH_FIRST_SIZE - 1;
+	newhash->slots = xzalloc(HASH_FIRST_SIZE * sizeof(newhash->slots[0]));
 
 	return newhash;
 }
 
 static void hash_clear(xhash *hash)
 {
-	unsigned i;
 	hash_item *hi, *thi;
 
-	for (i = 0; i < hash->csize; i++) {
-		hi = hash->items[i];
-		while (hi) {
-			thi = hi;
-			hi = hi->next;
+	hi = hash->first;
+	while (hi) {
+		thi = hi;
+		hi = hi->next;
 //FIXME: this assumes that it's a hash of *variables*:
-			free(thi->data.v.string);
-			free(thi);
-		}
-		hash->items[i] = NULL;
+		free(thi->data.v.string);
+		hash_item_free(thi);
 	}
+	free(hash->old_slots);
+	hash->old_slots = NULL;
+	memset(hash->slots, 0, (hash->mask + 1) * sizeof(hash->slots[0]));
+	hash->used = 0;
+	hash->first = hash->last = NULL;
 	hash->glen = hash->nel = 0;
 }
 
-#if 0 //UNUSED
 static void hash_free(xhash *hash)
 {
 	hash_clear(hash);
-	free(hash->items);
+	free(hash->slots);
 	free(hash);
 }
-#endif
 
-/* find item in hash, return ptr to data, NULL if not found */
-static NOINLINE void *hash_search3(xhash *hash, const char *name, unsigned idx)
+static hash_item **hash_probe(hash_item **slots, unsigned mask, const char *name, unsigned hval)
 {
-	hash_item *hi;
+	hash_item **sl;
+	unsigned i = hval;
 
-	hi = hash->items[idx % hash->csize];
-	while (hi) {
-		if (strcmp(hi->name, name) == 0)
-			return &hi->data;
-		hi = hi->next;
+	for (;;) {
+		sl = &slots[i & mask];
+		if (!*sl)
+			return NULL;
+		if (*sl != HASH_DELETED && (*sl)->hval == hval
+		 && strcmp((*sl)->name, name) == 0
+		) {
+			return sl;
+		}
+		i++;
 	}
-	return NULL;
 }
 
-static void *hash_search(xhash *hash, const char *name)
+static hash_item **hash_slot_of(xhash *hash, const char *name, unsigned hval)
 {
-	return hash_search3(hash, name,	hashidx(name));
+	hash_item **sl = hash_probe(hash->slots, hash->mask, name, hval);
+	if (!sl && hash->old_slots)
+		sl = hash_probe(hash->old_slots, hash->old_mask, name, hval);
+	return sl;
 }
 
-/* grow hash if it becomes too big */
-static void hash_rebuild(xhash *hash)
+/* put item which is not in the hash into slots[] */
+static void hash_put(xhash *hash, hash_item *hi)
 {
-	unsigned newsize, i, idx;
-	hash_item **newitems, *hi, *thi;
+	hash_item **sl;
+	unsigned i = hi->hval;
 
-	if (hash->nprime == ARRAY_SIZE(PRIMES))
-		return;
-
-	newsize = PRIMES[hash->nprime++];
-	newitems = xzalloc(newsize * sizeof(newitems[0]));
+	for (;;) {
+		sl = &hash->slots[i & hash->mask];
+		if (!*sl || *sl == HASH_DELETED)
+			break;
+		i++;
+	}
+	if (!*sl)
+		hash->used++;
+	*sl = hi;
+}
 
-	for (i = 0; i < hash->csize; i++) {
-		hi = hash->items[i];
-		while (hi) {
-			thi = hi;
-			hi = thi->next;
-			idx = hashidx(thi->name) % newsize;
-			thi->next = newitems[idx];
-			newitems[idx] = thi;
+/* move a few items from old_slots[] */
+static void hash_move_some(xhash *hash)
+{
+	unsigned n = HASH_MOVE_STEP;
+
+	while (hash->old_pos <= hash->old_mask) {
+		hash_item **sl = &hash->old_slots[hash->old_pos++];
+		if (*sl && *sl != HASH_DELETED) {
+			hash_put(hash, *sl);
+			/* not NULL: that would cut probe chains in old_slots[] */
+			*sl = HASH_DELETED;
 		}
+		if (--n == 0)
+			return;
 	}
+	free(hash->old_slots);
+	hash->old_slots = NULL;
+}
 
-	free(hash->items);
-	hash->csize = newsize;
-	hash->items = newitems;
+/* start moving items to a new table if slots[] fills up */
+static void hash_grow(xhash *hash)
+{
+	unsigned newsize;
+
+	if ((hash->used + 1) * 4 <= (hash->mask + 1) * 3)
+		return;
+	/* Keep the size if most of used slots are deleted ones */
+	newsize = hash->mask + 1;
+	while (hash->nel * 2 >= newsize)
+		newsize *= 2;
+	hash->old_slots = hash->slots;
+	hash->old_mask = hash->mask;
+	hash->old_pos = 0;
+	hash->slots = xzalloc(newsize * sizeof(hash->slots[0]));
+	hash->mask = newsize - 1;
+	hash->used = 0;
+}
+
+/* find item in hash, return ptr to data, NULL if not found */
+static void *hash_search(xhash *hash, const char *name)
+{
+	hash_item **sl = hash_slot_of(hash, name, hashidx(name));
+	return sl ? &(*sl)->data : NULL;
 }
 
 /* find item in hash, add it if necessary. Return ptr to data */
 static void *hash_find(xhash *hash, const char *name)
 {
+	hash_item **sl;
 	hash_item *hi;
-	unsigned idx;
+	unsigned hval;
 	int l;
 
-	idx = hashidx(name);
-	hi = hash_search3(hash, name, idx);
-	if (!hi) {
-		if (++hash->nel > hash->csize * 8)
-			hash_rebuild(hash);
-
-		l = strlen(name) + 1;
-		hi = xzalloc(sizeof(*hi) + l);
-		strcpy(hi->name, name);
-
-		idx = idx % hash->csize;
-		hi->next = hash->items[idx];
-		hash->items[idx] = hi;
-		hash->glen += l;
-	}
+	hval = hashidx(name);
+	sl = hash_slot_of(hash, name, hval);
+	if (sl)
+		return &(*sl)->data;
+
+	if (hash->old_slots)
+		hash_move_some(hash);
+	else
+		hash_grow(hash);
+
+	l = strlen(name) + 1;
+	hi = hash_item_alloc(sizeof(*hi) + l);
+	memcpy(hi->name, name, l);
+	hi->hval = hval;
+	hash_put(hash, hi);
+
+	hi->prev = hash->last;
+	if (hash->last)
+		hash->last->next = hi;
+	else
+		hash->first = hi;
+	hash->last = hi;
+	hash->nel++;
+	hash->glen += l;
 	return &hi->data;
 }
 
@@ -802,20 +971,25 @@ static void *hash_find(xhash *hash, const char *name)
 
 static void hash_remove(xhash *hash, const char *name)
 {
-	hash_item *hi, **phi;
+	hash_item **sl;
+	hash_item *hi;
 
-	phi = &hash->items[hashidx(name) % hash->csize];
-	while (*phi) {
-		hi = *phi;
-		if (strcmp(hi->name, name) == 0) {
-			hash->glen -= (strlen(name) + 1);
-			hash->nel--;
-			*phi = hi->next;
-			free(hi);
-			break;
-		}
-		phi = &hi->next;
-	}
+	sl = hash_slot_of(hash, name, hashidx(name));
+	if (!sl)
+		return;
+	hi = *sl;
+	*sl = HASH_DELETED;
+	if (hi->prev)
+		hi->prev->next = hi->next;
+	else
+		hash->first = hi->next;
+	if (hi->next)
+		hi->next->prev = hi->prev;
+	else
+		hash->last = hi->prev;
+	hash->glen -= (strlen(name) + 1);
+	hash->nel--;
+	hash_item_free(hi);
 }
 
 /* ------ some useful functions ------ */
@@ -1326,6 +1500,7 @@ static void mk_re_node(const char *s, node *n, regex_t *re)
 	n->r.ire = re + 1;
 	xregcomp(re, s, REG_EXTENDED);
 	xregcomp(re + 1, s, REG_EXTENDED | REG_ICASE);
+	n->re_literal = regex_required_literal(s, REG_EXTENDED);
 }
 
 static node *parse_expr(uint32_t);
@@ -1809,15 +1984,13 @@ static var *nvalloc(int sz)
 	return xzalloc(sz * sizeof(var));
 }
 
-static void nvfree(var *v, int sz)
+static void nvclear(var *v, int sz)
 {
 	var *p = v;
 
 	while (--sz >= 0) {
 		if ((p->type & (VF_ARRAY | VF_CHILD)) == VF_ARRAY) {
-			clear_array(iamarray(p));
-			free(p->x.array->items);
-			free(p->x.array);
+			hash_free(p->x.array);
 		}
 		if (p->type & VF_WALK) {
 			walker_list *n;
@@ -1834,10 +2007,96 @@ static void nvfree(var *v, int sz)
 		clrvar(p);
 		p++;
 	}
+}
 
+static void nvfree(var *v, int sz)
+{
+	nvclear(v, sz);
 	free(v);
 }
 
+/* Frames of vm_run() are released in reverse order of allocation.
+ * The stack grows in chunks, so that slots never move.
+ */
+#define VM_STACK_SLOTS 256
+
+static vm_slot *vm_frame_alloc(unsigned n)
+{
+	vm_stack *c = G.vm_stack_top;
+
+	if (!c || c->used + n > c->size) {
+		vm_stack *next = c ? c->next : NULL;
+		if (!next || next->size < n) {
+			unsigned size = n > VM_STACK_SLOTS ? n : VM_STACK_SLOTS;
+			/* chunks above the top are unused */
+			while (next) {
+				vm_stack *t = next->next;
+				free(next);
+				next = t;
+			}
+			next = xzalloc(sizeof(*next) + size * sizeof(next->s[0]));
+			next->size = size;
+			next->prev = c;
+			if (c)
+				c->next = next;
+		}
+		G.vm_stack_top = c = next;
+	}
+	c->used += n;
+	return &c->s[c->used - n];
+}
+
+static void vm_frame_free(vm_slot *s, unsigned n)
+{
+	vm_stack *c = G.vm_stack_top;
+	unsigned i;
+
+	for (i = 0; i < n; i++) {
+		if (s[i].tmp.type) {
+			nvclear(&s[i].tmp, 1);
+			memset(&s[i].tmp, 0, sizeof(s[i].tmp));
+		}
+	}
+	c->used -= n;
+	if (c->used == 0 && c->prev)
+		G.vm_stack_top = c->prev;
+}
+
+static var *slot_var(vm_slot *s)
+{
+	if (s->v)
+		return s->v;
+	if (s->field)
+		return &Fields[s->field - 1];
+	return (s->v = setvar_i(&s->tmp, s->d));
+}
+
+static double slot_num(vm_slot *s)
+{
+	if (!s->v && !s->field)
+		return s->d;
+	return getvar_i(slot_var(s));
+}
+
+static const char *slot_str(vm_slot *s)
+{
+	return getvar_s(slot_var(s));
+}
+
+static int slot_true(vm_slot *s)
+{
+	if (!s->v && !s->field)
+		return (s->d != 0);
+	return istrue(slot_var(s));
+}
+
+static void slot_set_num(vm_slot *s, double d)
+{
+	s->v = NULL;
+	s->field = 0;
+	s->d = d;
+}
+
 static node *mk_splitter(const char *s, tsplitter *spl)
 {
 	regex_t *re, *ire;
@@ -1846,9 +2105,15 @@ static node *mk_splitter(const char *s, tsplitter *spl)
 	re = &spl->re[0];
 	ire = &spl->re[1];
 	n = &spl->n;
+	/* split(s, a, sep) is usually called with the same sep */
+	if (spl->str && strcmp(spl->str, s) == 0)
+		return n;
+	free(spl->str);
+	spl->str = xstrdup(s);
 	if (n->info == TI_REGEXP) {
 		regfree(re);
 		regfree(ire); // TODO: nuke ire, use re+1?
+		free(n->re_literal);
 	}
 	if (s[0] && s[1]) { /* strlen(s) > 1 */
 		mk_re_node(s, n, re);
@@ -1861,12 +2126,13 @@ static node *mk_splitter(const char *s, tsplitter *spl)
 
 static var *evaluate(node *, var *);
 
-/* Use node as a regular expression. Supplied with node ptr and regex_t
- * storage space. Return ptr to regex (if result points to preg, it should
- * be later regfree'd manually).
+/* Use node as a regular expression. Return ptr to regex, which stays
+ * valid until the next as_regex() call.
  */
-static regex_t *as_regex(node *op, regex_t *preg)
+static regex_t *as_regex(node *op)
 {
+	struct regex_cache_s *c, *lru;
+	regex_t *preg;
 	int cflags;
 	const char *s;
 
@@ -1882,6 +2148,24 @@ static regex_t *as_regex(node *op, regex_t *preg)
 	// TMPVAR's value is still needed.
 	s = getvar_s(evaluate(op, TMPVAR));
 
+	/* Dynamic regexps are usually the same for many records,
+	 * keep the most recently used ones compiled */
+	lru = c = G.as_regex__cache;
+	for (; c < G.as_regex__cache + REGEX_CACHE_SIZE; c++) {
+		if (c->str && c->ignorecase == icase && strcmp(c->str, s) == 0) {
+			c->stamp = ++G.as_regex__stamp;
+			return &c->re;
+		}
+		if (c->stamp < lru->stamp)
+			lru = c;
+	}
+	if (lru->str) {
+		regfree(&lru->re);
+		free(lru->str);
+		lru->str = NULL;
+	}
+	preg = &lru->re;
+
 	cflags = icase ? REG_EXTENDED | REG_ICASE : REG_EXTENDED;
 	/* Testcase where REG_EXTENDED fails (unpaired '{'):
 	 * echo Hi | awk 'gsub("@(samp|code|file)\{","");'
@@ -1892,6 +2176,9 @@ static regex_t *as_regex(node *op, regex_t *preg)
 		cflags &= ~REG_EXTENDED;
 		xregcomp(preg, s, cflags);
 	}
+	lru->str = xstrdup(s);
+	lru->ignorecase = icase;
+	lru->stamp = ++G.as_regex__stamp;
 	//nvfree(tmpvar, 1);
 #undef TMPVAR
 	return preg;
@@ -2159,7 +2446,6 @@ static node *nextarg(node **pn)
 static void hashwalk_init(var *v, xhash *array)
 {
 	hash_item *hi;
-	unsigned i;
 	walker_list *w;
 	walker_list *prev_walker;
 
@@ -2175,13 +2461,8 @@ static void hashwalk_init(var *v, xhash *array)
 	debug_printf_walker(" walker@%p=%p\n", &v->x.walker, w);
 	w->cur = w->end = w->wbuf;
 	w->prev = prev_walker;
-	for (i = 0; i < array->csize; i++) {
-		hi = array->items[i];
-		while (hi) {
-			w->end = stpcpy(w->end, hi->name) + 1;
-			hi = hi->next;
-		}
-	}
+	for (hi = array->first; hi; hi = hi->next)
+		w->end = stpcpy(w->end, hi->name) + 1;
 }
 
 static int hashwalk_next(var *v)
@@ -2201,16 +2482,6 @@ static int hashwalk_next(var *v)
 	return TRUE;
 }
 
-/* evaluate node, return 1 when result is true, 0 otherwise */
-static int ptest(node *pattern)
-{
-	// We use a single "static" tmpvar (instead of on-stack or malloced one)
-	// to decrease memory consumption in deeply-recursive awk programs.
-	// The rule to work safely is to never call evaluate() while our static
-	// TMPVAR's value is still needed.
-	return istrue(evaluate(pattern, &G.ptest__tmpvar));
-}
-
 #if ENABLE_PLATFORM_MINGW32
 static ssize_t FAST_FUNC safe_read_strip_cr(int fd, void *buf, size_t count)
 {
@@ -2328,30 +2599,27 @@ static int awk_getline(rstream *rsm, var *v)
 	return r;
 }
 
-/* formatted output into an allocated buffer, return ptr to buffer */
+/* formatted output into an allocated buffer, return ptr to buffer.
+ * args[0] is the format, args[1..nargs-1] are the values.
+ */
 #if !ENABLE_FEATURE_AWK_GNU_EXTENSIONS
-# define awk_printf(a, b) awk_printf(a)
+# define awk_printf(a, b, c) awk_printf(a, b)
 #endif
-static char *awk_printf(node *n, int *len)
+static char *awk_printf(vm_slot *args, int nargs, int *len)
 {
 	char *b = NULL;
 	char *fmt, *s, *f;
 	const char *s1;
-	int i, j, incr, bsize;
+	int i, j, incr, bsize, argi;
 	char c, c1;
 	var *arg;
 
-	//tmpvar = nvalloc(1);
+	/* missing values are empty strings */
 #define TMPVAR (&G.awk_printf__tmpvar)
-	// We use a single "static" tmpvar (instead of on-stack or malloced one)
-	// to decrease memory consumption in deeply-recursive awk programs.
-	// The rule to work safely is to never call evaluate() while our static
-	// TMPVAR's value is still needed.
-	fmt = f = xstrdup(getvar_s(evaluate(nextarg(&n), TMPVAR)));
-	// ^^^^^^^^^ here we immediately strdup() the value, so the later call
-	// to evaluate() potentially recursing into another awk_printf() can't
-	// mangle the value.
+	/* format is cut into pieces in place */
+	fmt = f = xstrdup(getvar_s(slot_var(args)));
 
+	argi = 1;
 	i = 0;
 	while (*f) {
 		s = f;
@@ -2370,7 +2638,7 @@ static char *awk_printf(node *n, int *len)
 			f++;
 		c1 = *f;
 		*f = '\0';
-		arg = evaluate(nextarg(&n), TMPVAR);
+		arg = (argi < nargs) ? slot_var(&args[argi++]) : setvar_s(TMPVAR, NULL);
 
 		j = i;
 		if (c == 'c' || !c) {
@@ -2391,7 +2659,6 @@ static char *awk_printf(node *n, int *len)
 	}
 
 	free(fmt);
-	//nvfree(tmpvar, 1);
 #undef TMPVAR
 
 	b = xrealloc(b, i + 1);
@@ -2417,13 +2684,13 @@ static int awk_sub(node *rn, const char *repl, int nm, var *src, var *dest, int
 	int match_no, residx, replen, resbufsize;
 	int regexec_flags;
 	regmatch_t pmatch[10];
-	regex_t sreg, *regex;
+	regex_t *regex;
 
 	resbuf = NULL;
 	residx = 0;
 	match_no = 0;
 	regexec_flags = 0;
-	regex = as_regex(rn, &sreg);
+	regex = as_regex(rn);
 	sp = getvar_s(src ? src : intvar[F0]);
 	replen = strlen(repl);
 	while (regexec(regex, sp, 10, pmatch, regexec_flags) == 0) {
@@ -2496,8 +2763,6 @@ static int awk_sub(node *rn, const char *repl, int nm, var *src, var *dest, int
  ret:
 	//bb_error_msg("end sp:'%s'%p", sp,sp);
 	setvar_p(dest ? dest : intvar[F0], resbuf);
-	if (regex == &sreg)
-		regfree(regex);
 	return match_no;
 }
 
@@ -2533,13 +2798,11 @@ static NOINLINE int do_mktime(const char *ds)
 static NOINLINE var *do_match(node *an1, const char *as0)
 {
 	regmatch_t pmatch[1];
-	regex_t sreg, *re;
+	regex_t *re;
 	int n, start, len;
 
-	re = as_regex(an1, &sreg);
+	re = as_regex(an1);
 	n = regexec(re, as0, 1, pmatch, 0);
-	if (re == &sreg)
-		regfree(re);
 	start = 0;
 	len = -1;
 	if (n == 0) {
@@ -2550,12 +2813,13 @@ static NOINLINE var *do_match(node *an1, const char *as0)
 	return setvar_i(newvar("RSTART"), start);
 }
 
-/* Reduce stack usage in evaluate() by keeping builtins' code separate */
-static NOINLINE var *exec_builtin(node *op, var *res)
+/* Reduce stack usage in vm_run() by keeping builtins' code separate.
+ * args[] are the arguments vm_compile_builtin() put on the stack.
+ */
+static NOINLINE var *exec_builtin(node *op, vm_slot *args, var *res)
 {
 #define tspl (G.exec_builtin__tspl)
 
-	var *tmpvars;
 	node *an[4];
 	var *av[4];
 	const char *as[4];
@@ -2565,12 +2829,6 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 	time_t tt;
 	int i, l, ll, n;
 
-	tmpvars = nvalloc(4);
-#define TMPVAR0 (tmpvars)
-#define TMPVAR1 (tmpvars + 1)
-#define TMPVAR2 (tmpvars + 2)
-#define TMPVAR3 (tmpvars + 3)
-#define TMPVAR(i) (tmpvars + (i))
 	isr = info = op->info;
 	op = op->l.n;
 
@@ -2578,7 +2836,7 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 	for (i = 0; i < 4 && op; i++) {
 		an[i] = nextarg(&op);
 		if (isr & 0x09000000)
-			av[i] = evaluate(an[i], TMPVAR(i));
+			av[i] = slot_var(args++);
 		if (isr & 0x08000000)
 			as[i] = getvar_s(av[i]);
 		isr >>= 1;
@@ -2603,7 +2861,7 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 
 		if (nargs > 2) {
 			spl = (an[2]->info == TI_REGEXP) ? an[2]
-				: mk_splitter(getvar_s(evaluate(an[2], TMPVAR2)), &tspl);
+				: mk_splitter(slot_str(args), &tspl);
 		} else {
 			spl = &fsplitter.n;
 		}
@@ -2733,13 +2991,6 @@ static NOINLINE var *exec_builtin(node *op, var *res)
 		break;
 	}
 
-	nvfree(tmpvars, 4);
-#undef TMPVAR0
-#undef TMPVAR1
-#undef TMPVAR2
-#undef TMPVAR3
-#undef TMPVAR
-
 	return res;
 #undef tspl
 }
@@ -2801,699 +3052,1492 @@ static rstream *next_input_file(void)
 #undef files_happen
 }
 
-/*
- * Evaluate node - the heart of the program. Supplied with subtree
- * and "res" variable to assign the result to if we evaluate an expression.
- * If node refers to e.g. a variable or a field, no assignment happens.
- * Return ptr to the result (which may or may not be the "res" variable!)
- */
-#define XC(n) ((n) >> 8)
-
-static var *evaluate(node *op, var *res)
+/* Simple builtins, lv is the argument if there is one */
+static NOINLINE double exec_fbltin(node *op, var *lv)
 {
-/* This procedure is recursive so we should count every byte */
-#define fnargs (G.evaluate__fnargs)
 /* seed is initialized to 1 */
 #define seed   (G.evaluate__seed)
-#define sreg   (G.evaluate__sreg)
 
-	var *tmpvars;
+	uint32_t opinfo = op->info;
+	node *op1 = op->l.n;
+	const char *ls = NULL;
+	double L_d = 0;
+	double R_d = R_d; /* for compiler */
 
-	if (!op)
-		return setvar_s(res, NULL);
-
-	debug_printf_eval("entered %s()\n", __func__);
+	if (opinfo & OF_STR1)
+		ls = getvar_s(lv);
+	if (opinfo & OF_NUM1)
+		L_d = getvar_i(lv);
 
-	tmpvars = nvalloc(2);
-#define TMPVAR0 (tmpvars)
-#define TMPVAR1 (tmpvars + 1)
-
-	while (op) {
-		struct {
-			var *v;
-			const char *s;
-		} L = L; /* for compiler */
-		struct {
-			var *v;
-			const char *s;
-		} R = R;
-		double L_d = L_d;
-		uint32_t opinfo;
-		int opn;
-		node *op1;
+	if (op1 && op1->info == TI_COMMA)
+		/* Simple builtins take one arg maximum */
+		syntax_error("Too many arguments");
 
-		opinfo = op->info;
-		opn = (opinfo & OPNMASK);
-		g_lineno = op->lineno;
-		op1 = op->l.n;
-		debug_printf_eval("opinfo:%08x opn:%08x\n", opinfo, opn);
+	switch (opinfo & OPNMASK) {
+	case F_in:
+		R_d = (long long)L_d;
+		break;
 
-		/* execute inevitable things */
-		if (opinfo & OF_RES1) {
-			if ((opinfo & OF_REQUIRED) && !op1)
-				syntax_error(EMSG_TOO_FEW_ARGS);
-			L.v = evaluate(op1, TMPVAR0);
-			if (opinfo & OF_STR1) {
-				L.s = getvar_s(L.v);
-				debug_printf_eval("L.s:'%s'\n", L.s);
-			}
-			if (opinfo & OF_NUM1) {
-				L_d = getvar_i(L.v);
-				debug_printf_eval("L_d:%f\n", L_d);
-			}
-		}
-		/* NB: Must get string/numeric values of L (done above)
-		 * _before_ evaluate()'ing R.v: if both L and R are $NNNs,
-		 * and right one is large, then L.v points to Fields[NNN1],
-		 * second evaluate() reallocates and moves (!) Fields[],
-		 * R.v points to Fields[NNN2] but L.v now points to freed mem!
-		 * (Seen trying to evaluate "$444 $44444")
-		 */
-		if (opinfo & OF_RES2) {
-			R.v = evaluate(op->r.n, TMPVAR1);
-			//TODO: L.v may be invalid now, set L.v to NULL to catch bugs?
-			//L.v = NULL;
-			if (opinfo & OF_STR2) {
-				R.s = getvar_s(R.v);
-				debug_printf_eval("R.s:'%s'\n", R.s);
-			}
+	case F_rn: /*rand*/
+		if (op1)
+			syntax_error("Too many arguments");
+	{
+#if RAND_MAX >= 0x7fffffff
+		uint32_t u = ((uint32_t)rand() << 16) ^ rand();
+		uint64_t v = ((uint64_t)rand() << 32) | u;
+		/* the above shift+or is optimized out on 32-bit arches */
+# if RAND_MAX > 0x7fffffff
+		v &= 0x7fffffffffffffffULL;
+# endif
+		R_d = (double)v / 0x8000000000000000ULL;
+#elif ENABLE_PLATFORM_MINGW32 && RAND_MAX == 0x7fff
+		/* 45 bits of randomness ought to be enough for anyone */
+		uint64_t v = ((uint64_t)rand() << 48) |
+						((uint64_t)rand() << 33) |
+						((uint64_t)rand() << 18);
+		R_d = (double)v / 0x8000000000000000ULL;
+#else
+# error Not implemented for this value of RAND_MAX
+#endif
+		break;
+	}
+	case F_co:
+		if (ENABLE_FEATURE_AWK_LIBM) {
+			R_d = cos(L_d);
+			break;
 		}
 
-		debug_printf_eval("switch(0x%x)\n", XC(opinfo & OPCLSMASK));
-		switch (XC(opinfo & OPCLSMASK)) {
-
-		/* -- iterative node type -- */
-
-		/* test pattern */
-		case XC( OC_TEST ):
-			debug_printf_eval("TEST\n");
-			if (op1->info == TI_COMMA) {
-				/* it's range pattern */
-				if ((opinfo & OF_CHECKED) || ptest(op1->l.n)) {
-					op->info |= OF_CHECKED;
-					if (ptest(op1->r.n))
-						op->info &= ~OF_CHECKED;
-					op = op->a.n;
-				} else {
-					op = op->r.n;
-				}
-			} else {
-				op = ptest(op1) ? op->a.n : op->r.n;
-			}
+	case F_ex:
+		if (ENABLE_FEATURE_AWK_LIBM) {
+			R_d = exp(L_d);
 			break;
+		}
 
-		/* just evaluate an expression, also used as unconditional jump */
-		case XC( OC_EXEC ):
-			debug_printf_eval("EXEC\n");
+	case F_lg:
+		if (ENABLE_FEATURE_AWK_LIBM) {
+			R_d = log(L_d);
 			break;
+		}
 
-		/* branch, used in if-else and various loops */
-		case XC( OC_BR ):
-			debug_printf_eval("BR\n");
-			op = istrue(L.v) ? op->a.n : op->r.n;
+	case F_si:
+		if (ENABLE_FEATURE_AWK_LIBM) {
+			R_d = sin(L_d);
 			break;
+		}
 
-		/* initialize for-in loop */
-		case XC( OC_WALKINIT ):
-			debug_printf_eval("WALKINIT\n");
-			hashwalk_init(L.v, iamarray(R.v));
+	case F_sq:
+		if (ENABLE_FEATURE_AWK_LIBM) {
+			R_d = sqrt(L_d);
 			break;
+		}
 
-		/* get next array item */
-		case XC( OC_WALKNEXT ):
-			debug_printf_eval("WALKNEXT\n");
-			op = hashwalk_next(L.v) ? op->a.n : op->r.n;
-			break;
+		syntax_error(EMSG_NO_MATH);
+		break;
 
-		case XC( OC_PRINT ):
-			debug_printf_eval("PRINT /\n");
-		case XC( OC_PRINTF ):
-			debug_printf_eval("PRINTF\n");
-		{
-			FILE *F = stdout;
-			IF_FEATURE_AWK_GNU_EXTENSIONS(int len;)
+	case F_sr:
+		R_d = (double)seed;
+		seed = op1 ? (unsigned)L_d : (unsigned)time(NULL);
+		srand(seed);
+		break;
 
-			if (op->r.n) {
-				rstream *rsm = newfile(R.s);
-				if (!rsm->F) {
-					if (opn == '|') {
-						rsm->F = popen(R.s, "w");
-						if (rsm->F == NULL)
-							bb_simple_perror_msg_and_die("popen");
-						rsm->is_pipe = 1;
-					} else {
-						rsm->F = xfopen(R.s, opn=='w' ? "w" : "a");
-					}
-				}
-				F = rsm->F;
-			}
+	case F_ti: /*systime*/
+		if (op1)
+			syntax_error("Too many arguments");
+		R_d = time(NULL);
+		break;
 
-			if (opinfo == TI_PRINT) {
-				if (!op1) {
-					fputs(getvar_s(intvar[F0]), F);
-				} else {
-					for (;;) {
-						var *v = evaluate(nextarg(&op1), TMPVAR0);
-						if (v->type & VF_NUMBER) {
-							fmt_num(g_buf, MAXVARFMT, getvar_s(intvar[OFMT]),
-									getvar_i(v), TRUE);
-							fputs(g_buf, F);
-						} else {
-							fputs(getvar_s(v), F);
-						}
-						if (!op1)
-							break;
-						fputs(getvar_s(intvar[OFS]), F);
-					}
-				}
-				fputs(getvar_s(intvar[ORS]), F);
-			} else {	/* PRINTF */
-				char *s = awk_printf(op1, &len);
-#if ENABLE_FEATURE_AWK_GNU_EXTENSIONS
-				fwrite(s, len, 1, F);
-#else
-				fputs(s, F);
-#endif
-				free(s);
-			}
-			fflush(F);
+	case F_le:
+		debug_printf_eval("length: ls:'%s'\n", ls);
+		if (!op1) {
+			ls = getvar_s(intvar[F0]);
+			debug_printf_eval("length: ls='%s'\n", ls);
+		}
+		else if (lv->type & VF_ARRAY) {
+			R_d = lv->x.array->nel;
+			debug_printf_eval("length: array_len:%d\n", lv->x.array->nel);
 			break;
 		}
+		R_d = strlen(ls);
+		break;
 
-		case XC( OC_DELETE ):
-			debug_printf_eval("DELETE\n");
-		{
-			/* "delete" is special:
-			 * "delete array[var--]" must evaluate index expr only once.
-			 */
-			uint32_t info = op1->info & OPCLSMASK;
-			var *v;
+	case F_sy:
+		fflush_all();
+		R_d = (ENABLE_FEATURE_ALLOW_EXEC && ls && *ls)
+				? (system(ls) >> 8) : 0;
+		break;
 
-			if (info == OC_VAR) {
-				v = op1->l.v;
-			} else if (info == OC_FNARG) {
-				v = &fnargs[op1->l.aidx];
-			} else {
-				syntax_error(EMSG_NOT_ARRAY);
-			}
-			if (op1->r.n) { /* array ref? */
-				const char *s;
-				s = getvar_s(evaluate(op1->r.n, TMPVAR0));
-				hash_remove(iamarray(v), s);
-			} else {
-				clear_array(iamarray(v));
-			}
-			break;
+	case F_ff:
+		if (!op1) {
+			fflush(stdout);
+		} else if (ls && *ls) {
+			rstream *rsm = newfile(ls);
+			fflush(rsm->F);
+		} else {
+			fflush_all();
 		}
+		break;
 
-		case XC( OC_NEWSOURCE ):
-			debug_printf_eval("NEWSOURCE\n");
-			g_progname = op->l.new_progname;
-			break;
+	case F_cl: {
+		rstream *rsm;
+		int err = 0;
+		rsm = (rstream *)hash_search(fdhash, ls);
+		debug_printf_eval("OC_FBLTIN close: op1:%p s:'%s' rsm:%p\n", op1, ls, rsm);
+		if (rsm) {
+			debug_printf_eval("OC_FBLTIN F_cl "
+				"rsm->is_pipe:%d, ->F:%p\n",
+				rsm->is_pipe, rsm->F);
+			/* Can be NULL if open failed. Example:
+			 * getline line <"doesnt_exist";
+			 * close("doesnt_exist"); <--- here rsm->F is NULL
+			 */
+			if (rsm->F)
+				err = rsm->is_pipe ? pclose(rsm->F) : fclose(rsm->F);
+//TODO: fix this case:
+// $ awk 'BEGIN { print close(""); print ERRNO }'
+// -1
+// close of redirection that was never opened
+// (we print 0, 0)
+			free(rsm->buffer);
+			hash_remove(fdhash, ls);
+		}
+		if (err)
+			setvar_i(intvar[ERRNO], errno);
+		R_d = (double)err;
+		break;
+	}
+	} /* switch */
 
-		case XC( OC_RETURN ):
-			debug_printf_eval("RETURN\n");
-			copyvar(res, L.v);
-			break;
+	return R_d;
+#undef seed
+}
 
-		case XC( OC_NEXTFILE ):
-			debug_printf_eval("NEXTFILE\n");
-			nextfile = TRUE;
+/* -------- bytecode -------- */
+
+#define XC(n) ((n) >> 8)
+
+/*
+ * Node trees are not walked at run time: the first evaluate() of
+ * a tree compiles it into a linear sequence of instructions for
+ * a stack machine, vm_run() executes them. Statement chains are
+ * laid out with their jumps, expressions in postfix order.
+ * Operands are evaluated in the same order as the tree walker did.
+ */
+enum {
+	VM_PUSH_EMPTY,  /* push "" */
+	VM_PUSH_VAR,    /* push a.v */
+	VM_PUSH_NF,     /* push NF, splitting $0 */
+	VM_PUSH_FNARG,  /* push function argument a.aidx */
+	VM_ELEM,        /* replace index on top by element of array a.v */
+	VM_ELEM_FNARG,  /* same, the array is function argument a.aidx */
+	VM_FIELD,       /* replace top by $top */
+	VM_FIELD_VAR,   /* push $a.v */
+	VM_SNAP,        /* copy var on top, next operands may change it */
+	VM_TONUM,       /* replace top by its numeric value */
+	VM_DUPNUM,      /* push numeric value of top */
+	VM_POP,
+	VM_BINARY,      /* arithmetic operation sub */
+	VM_REPLACE,     /* same, store to lvalue; cnt: DUPNUM'ed lvalue */
+	VM_UNARY,       /* unary operation sub */
+	VM_COMPARE,     /* comparison sub */
+	VM_CONCAT,      /* sub: join with SUBSEP */
+	VM_MOVE,        /* assign top to the lvalue below it, pop */
+	VM_IN,          /* pop array, replace key by 0 or 1 */
+	VM_REGEXP,      /* push $0 ~ a.n */
+	VM_MATCH,       /* replace top by top ~ a.n (sub '!': !~) */
+	VM_TRUTH,       /* replace top by 0 or 1 */
+	VM_JMP,
+	VM_JFALSE,      /* pop, jump if false */
+	VM_LAND,        /* false on top: replace by 0 and jump, else pop */
+	VM_LOR,         /* true on top: replace by 1 and jump, else pop */
+	VM_JCHECKED,    /* jump if range pattern a.n is active */
+	VM_RANGE_END,   /* pop end condition of range pattern a.n */
+	VM_WALKINIT,    /* pop array and var */
+	VM_WALKNEXT,    /* pop var, jump if walk is over */
+	VM_PRINT_BEGIN, /* sub: pop redirection */
+	VM_PRINT_ARG,   /* pop and print, sub: print OFS after it */
+	VM_PRINT_END,   /* sub: print $0 */
+	VM_PRINTF,      /* pop cnt args */
+	VM_SPRINTF,     /* replace cnt args by result */
+	VM_DELETE,      /* sub: 1 - pop index, 2 - array is function arg */
+	VM_SETPROG,     /* g_progname = a.s */
+	VM_GETLINE,     /* a.n, sub: 1 - pop file, 2 - pop target var */
+	VM_FBLTIN,      /* a.n, sub: replace argument on top */
+	VM_BUILTIN,     /* a.n, replace cnt args by result */
+	VM_ARGS_BEGIN,  /* push argvars of function a.f */
+	VM_ARG,         /* pop into argument a.aidx */
+	VM_ARG_EXTRA,   /* pop argument the function doesn't take */
+	VM_CALL,        /* replace argvars by result, sub: args were pushed */
+	VM_NEXTCHK,     /* return if "next" was done in a called function */
+	VM_NEXT,        /* sub: nextfile */
+	VM_EXIT,        /* sub: pop exit code */
+	VM_RETURN,      /* pop return value */
+	VM_DONE,
+	VM_RET,         /* chain fell off its end */
+	VM_RET_TOP,     /* return top */
+	VM_ERROR,       /* syntax_error(a.s) */
+};
+
+typedef struct vm_comp_s {
+	vm_insn *insn;
+	unsigned len;
+	int depth;
+	int max_depth;
+	unsigned lineno;
+	smallint calls;   /* statement calls functions */
+	smallint fbody;   /* compiling a function body */
+	/* statements compiled so far and their addresses */
+	struct vm_label_s {
+		node *n;
+		unsigned pc;
+	} *label;
+	unsigned label_mask;
+	unsigned nlabels;
+	/* jumps to statements, patched when all are compiled */
+	struct vm_fixup_s {
+		unsigned at;
+		node *n;
+	} *fixup;
+	unsigned nfixups;
+} vm_comp;
+
+static vm_insn *vm_emit(vm_comp *c, int opcode, int effect)
+{
+	vm_insn *ip;
+
+	c->insn = xrealloc_vector(c->insn, 8, c->len);
+	ip = &c->insn[c->len++];
+	ip->op = opcode;
+	ip->lineno = c->lineno;
+	c->depth += effect;
+	if (c->max_depth < c->depth)
+		c->max_depth = c->depth;
+	return ip;
+}
+
+/* jump to statement "to", resolved by vm_compile() */
+static void vm_jump(vm_comp *c, int opcode, int effect, node *to)
+{
+	vm_emit(c, opcode, effect);
+	c->fixup = xrealloc_vector(c->fixup, 6, c->nfixups);
+	c->fixup[c->nfixups].at = c->len - 1;
+	c->fixup[c->nfixups].n = to;
+	c->nfixups++;
+}
+
+static int vm_label_find(vm_comp *c, node *n)
+{
+	unsigned i;
+
+	if (!c->label)
+		return -1;
+	for (i = (uintptr_t)n / sizeof(*n);; i++) {
+		struct vm_label_s *l = &c->label[i & c->label_mask];
+		if (!l->n)
+			return -1;
+		if (l->n == n)
+			return l->pc;
+	}
+}
+
+static void vm_label_add(vm_comp *c, node *n, unsigned pc)
+{
+	unsigned i;
+
+	if (c->nlabels * 2 >= c->label_mask) {
+		struct vm_label_s *old = c->label;
+		unsigned old_size = old ? c->label_mask + 1 : 0;
+
+		c->label_mask = old ? old_size * 2 - 1 : 63;
+		c->label = xzalloc((c->label_mask + 1) * sizeof(c->label[0]));
+		c->nlabels = 0;
+		for (i = 0; i < old_size; i++) {
+			if (old[i].n)
+				vm_label_add(c, old[i].n, old[i].pc);
+		}
+		free(old);
+	}
+	for (i = (uintptr_t)n / sizeof(*n);; i++) {
+		struct vm_label_s *l = &c->label[i & c->label_mask];
+		if (!l->n) {
+			l->n = n;
+			l->pc = pc;
+			c->nlabels++;
+			return;
+		}
+	}
+}
+
+/* Can evaluating op change variables, fields or $0?
+ * Operands fetched before it then have to be copied.
+ */
+static int vm_impure(node *op)
+{
+	while (op) {
+		switch (XC(op->info & OPCLSMASK)) {
+		case XC( OC_MOVE ):
+		case XC( OC_REPLACE ):
+		case XC( OC_FUNC ):
+		case XC( OC_GETLINE ):
+		case XC( OC_PGETLINE ):
+			return TRUE;
+		case XC( OC_BUILTIN ):
+			switch (op->info & OPNMASK) {
+			case B_sp:
+			case B_su:
+			case B_gs:
+			case B_ma:
+				return TRUE;
+			}
+			op = op->l.n;
+			continue;
+		case XC( OC_UNARY ):
+			switch (op->info & OPNMASK) {
+			case 'P':
+			case 'p':
+			case 'M':
+			case 'm':
+				return TRUE;
+			}
+			break;
+		case XC( OC_VAR ):
+		case XC( OC_FNARG ):
+			op = op->r.n;
+			continue;
+		case XC( OC_REGEXP ):
+			return FALSE;
+		}
+		if (vm_impure(op->l.n))
+			return TRUE;
+		op = op->r.n;
+	}
+	return FALSE;
+}
+
+static void vm_compile_expr(vm_comp *c, node *op);
+
+/* push comma separated list, at least one item */
+static int vm_compile_list(vm_comp *c, node *list)
+{
+	int k = 0;
+
+	while (list) {
+		vm_compile_expr(c, nextarg(&list));
+		if (vm_impure(list))
+			vm_emit(c, VM_SNAP, 0);
+		k++;
+	}
+	if (!k) {
+		vm_emit(c, VM_PUSH_EMPTY, 1);
+		k = 1;
+	}
+	return k;
+}
+
+/* push arguments exec_builtin() wants evaluated */
+static int vm_compile_builtin(vm_comp *c, node *op)
+{
+	uint32_t isr = op->info;
+	int opn = op->info & OPNMASK;
+	node *list = op->l.n;
+	node *sep = NULL;
+	int i, k = 0;
+
+	for (i = 0; i < 4 && list; i++) {
+		node *an = nextarg(&list);
+		if (i == 2)
+			sep = an;
+		if (isr & 0x09000000) {
+			vm_compile_expr(c, an);
+			k++;
+			/* keep the value of a string argument, but
+			 * not the target var of sub() and gsub() */
+			if ((isr & 0x08000000)
+			 && !(i == 2 && (opn == B_su || opn == B_gs))
+			 && vm_impure(list)
+			) {
+				vm_emit(c, VM_SNAP, 0);
+			}
+		}
+		isr >>= 1;
+	}
+	/* split(s, a, sep): sep string is made into a regexp at run time */
+	if (opn == B_sp && sep && sep->info != TI_REGEXP) {
+		vm_compile_expr(c, sep);
+		k++;
+	}
+	return k;
+}
+
+static void vm_compile_expr(vm_comp *c, node *op)
+{
+	uint32_t opinfo;
+	node *op1;
+	vm_insn *ip;
+	unsigned sv_lineno;
+	int snap, k;
+	unsigned j;
+
+	if (!op) {
+		vm_emit(c, VM_PUSH_EMPTY, 1);
+		return;
+	}
+
+	sv_lineno = c->lineno;
+	c->lineno = op->lineno;
+	opinfo = op->info;
+	op1 = op->l.n;
+
+	switch (XC(opinfo & OPCLSMASK)) {
+	case XC( OC_VAR ):
+		if (op->r.n) {
+			vm_compile_expr(c, op->r.n);
+			vm_emit(c, VM_ELEM, 0)->a.v = op->l.v;
+		} else if (op->l.v == intvar[NF]) {
+			vm_emit(c, VM_PUSH_NF, 1);
+		} else {
+			vm_emit(c, VM_PUSH_VAR, 1)->a.v = op->l.v;
+		}
+		break;
+
+	case XC( OC_FNARG ):
+		if (op->r.n) {
+			vm_compile_expr(c, op->r.n);
+			vm_emit(c, VM_ELEM_FNARG, 0)->a.aidx = op->l.aidx;
+		} else {
+			vm_emit(c, VM_PUSH_FNARG, 1)->a.aidx = op->l.aidx;
+		}
+		break;
+
+	case XC( OC_FIELD ):
+		if (op->r.n && op->r.n->info == OC_VAR
+		 && op->r.n->l.v != intvar[NF]
+		) {
+			vm_emit(c, VM_FIELD_VAR, 1)->a.v = op->r.n->l.v;
+		} else {
+			vm_compile_expr(c, op->r.n);
+			vm_emit(c, VM_FIELD, 0);
+		}
+		break;
+
+	case XC( OC_UNARY ):
+		vm_compile_expr(c, op->r.n);
+		vm_emit(c, VM_UNARY, 0)->sub = opinfo & OPNMASK;
+		break;
+
+	case XC( OC_BINARY ):
+		vm_compile_expr(c, op1);
+		if (vm_impure(op->r.n))
+			vm_emit(c, VM_TONUM, 0);
+		vm_compile_expr(c, op->r.n);
+		vm_emit(c, VM_BINARY, -1)->sub = opinfo & OPNMASK;
+		break;
+
+	case XC( OC_REPLACE ):
+		vm_compile_expr(c, op1);
+		snap = vm_impure(op->r.n);
+		if (snap)
+			vm_emit(c, VM_DUPNUM, 1);
+		vm_compile_expr(c, op->r.n);
+		ip = vm_emit(c, VM_REPLACE, -1 - snap);
+		ip->sub = opinfo & OPNMASK;
+		ip->cnt = snap;
+		break;
+
+	case XC( OC_COMPARE ):
+		vm_compile_expr(c, op1);
+		vm_compile_expr(c, op->r.n);
+		vm_emit(c, VM_COMPARE, -1)->sub = opinfo & OPNMASK;
+		break;
+
+	/* concatenation (" ") and index joining (",") */
+	case XC( OC_CONCAT ):
+	case XC( OC_COMMA ):
+		vm_compile_expr(c, op1);
+		if (vm_impure(op->r.n))
+			vm_emit(c, VM_SNAP, 0);
+		vm_compile_expr(c, op->r.n);
+		vm_emit(c, VM_CONCAT, -1)->sub = (opinfo == TI_COMMA);
+		break;
+
+	case XC( OC_MOVE ):
+		vm_compile_expr(c, op1);
+		vm_compile_expr(c, op->r.n);
+		vm_emit(c, VM_MOVE, -1);
+		break;
+
+	case XC( OC_IN ):
+		vm_compile_expr(c, op1);
+		if (vm_impure(op->r.n))
+			vm_emit(c, VM_SNAP, 0);
+		vm_compile_expr(c, op->r.n);
+		vm_emit(c, VM_IN, -1);
+		break;
+
+	case XC( OC_REGEXP ):
+		vm_emit(c, VM_REGEXP, 1)->a.n = op;
+		break;
+
+	case XC( OC_MATCH ):
+		vm_compile_expr(c, op1);
+		if (op->r.n->info != TI_REGEXP && vm_impure(op->r.n))
+			vm_emit(c, VM_SNAP, 0);
+		ip = vm_emit(c, VM_MATCH, 0);
+		ip->a.n = op->r.n;
+		ip->sub = opinfo & OPNMASK;
+		break;
+
+	case XC( OC_LAND ):
+	case XC( OC_LOR ):
+		vm_compile_expr(c, op1);
+		j = c->len;
+		vm_emit(c, (opinfo & OPCLSMASK) == OC_LAND ? VM_LAND : VM_LOR, -1);
+		vm_compile_expr(c, op->r.n);
+		vm_emit(c, VM_TRUTH, 0);
+		c->insn[j].target = c->len;
+		break;
+
+	case XC( OC_TERNARY ):
+		vm_compile_expr(c, op1);
+		if (!op->r.n || op->r.n->info != TI_COLON) {
+			vm_emit(c, VM_POP, -1);
+			vm_emit(c, VM_ERROR, 1)->a.s = EMSG_POSSIBLE_ERROR;
+			break;
+		}
+		j = c->len;
+		vm_emit(c, VM_JFALSE, -1);
+		vm_compile_expr(c, op->r.n->l.n);
+		k = c->len;
+		vm_emit(c, VM_JMP, 0);
+		c->insn[j].target = c->len;
+		c->depth--;
+		vm_compile_expr(c, op->r.n->r.n);
+		c->insn[k].target = c->len;
+		break;
+
+	case XC( OC_FUNC ): {
+		func *f = op->r.f;
+		unsigned i;
+
+		if (!f->defined) {
+			vm_emit(c, VM_ERROR, 1)->a.s = EMSG_UNDEF_FUNC;
+			break;
+		}
+		/* The body might be empty, still has to eval the args */
+		vm_emit(c, VM_ARGS_BEGIN, 1)->a.f = f;
+		i = 0;
+		while (op1) {
+			vm_compile_expr(c, nextarg(&op1));
+			if (i == f->nargs) {
+				/* call with more arguments than function takes.
+				 * (gawk warns: "warning: function 'f' called with more arguments than declared").
+				 * They are still evaluated, but discarded: */
+				vm_emit(c, VM_ARG_EXTRA, -1);
+				continue;
+			}
+			vm_emit(c, VM_ARG, -1)->a.aidx = i;
+			i++;
+		}
+		ip = vm_emit(c, VM_CALL, 0);
+		ip->a.f = f;
+		ip->sub = (op->l.n != NULL);
+		c->calls = TRUE;
+		break;
+	}
+
+	case XC( OC_GETLINE ):
+	case XC( OC_PGETLINE ):
+		k = 0;
+		if (op1) {
+			vm_compile_expr(c, op1);
+			if (vm_impure(op->r.n))
+				vm_emit(c, VM_SNAP, 0);
+			k |= 1;
+		}
+		if (op->r.n) {
+			vm_compile_expr(c, op->r.n);
+			k |= 2;
+		}
+		ip = vm_emit(c, VM_GETLINE, 1 - (k & 1) - (k >> 1));
+		ip->a.n = op;
+		ip->sub = k;
+		break;
+
+	/* simple builtins */
+	case XC( OC_FBLTIN ):
+		if (opinfo & OF_RES1) {
+			if ((opinfo & OF_REQUIRED) && !op1) {
+				vm_emit(c, VM_ERROR, 1)->a.s = EMSG_TOO_FEW_ARGS;
+				break;
+			}
+			vm_compile_expr(c, op1);
+			ip = vm_emit(c, VM_FBLTIN, 0);
+			ip->sub = 1;
+		} else {
+			ip = vm_emit(c, VM_FBLTIN, 1);
+		}
+		ip->a.n = op;
+		break;
+
+	case XC( OC_BUILTIN ):
+		k = vm_compile_builtin(c, op);
+		ip = vm_emit(c, VM_BUILTIN, 1 - k);
+		ip->a.n = op;
+		ip->cnt = k;
+		break;
+
+	case XC( OC_SPRINTF ):
+		k = vm_compile_list(c, op1);
+		vm_emit(c, VM_SPRINTF, 1 - k)->cnt = k;
+		break;
+
+	default:
+		vm_emit(c, VM_ERROR, 1)->a.s = EMSG_POSSIBLE_ERROR;
+	}
+
+	c->lineno = sv_lineno;
+}
+
+/* "next" in a function returns to the statement which called it,
+ * the rest of that chain is skipped. Function bodies themselves may
+ * run while that happens and end after their first statement.
+ */
+static void vm_nextchk(vm_comp *c)
+{
+	if (c->calls || c->fbody)
+		vm_emit(c, VM_NEXTCHK, 0);
+}
+
+static void vm_compile_chain(vm_comp *c, node *op)
+{
+	for (;;) {
+		uint32_t opinfo;
+		node *op1;
+		vm_insn *ip;
+		int pc;
+
+		if (!op) {
+			vm_emit(c, VM_RET, 0);
+			return;
+		}
+		pc = vm_label_find(c, op);
+		if (pc >= 0) {
+			vm_emit(c, VM_JMP, 0)->target = pc;
+			return;
+		}
+		vm_label_add(c, op, c->len);
+
+		opinfo = op->info;
+		op1 = op->l.n;
+		c->lineno = op->lineno;
+		c->depth = 0;
+		c->calls = FALSE;
+
+		switch (XC(opinfo & OPCLSMASK)) {
+
+		/* test pattern */
+		case XC( OC_TEST ):
+			if (op1->info == TI_COMMA) {
+				/* it's range pattern, OF_CHECKED while inside the range */
+				unsigned j = c->len;
+				vm_emit(c, VM_JCHECKED, 0)->a.n = op;
+				vm_compile_expr(c, op1->l.n);
+				vm_nextchk(c);
+				vm_jump(c, VM_JFALSE, -1, op->r.n);
+				c->insn[j].target = c->len;
+				vm_compile_expr(c, op1->r.n);
+				vm_emit(c, VM_RANGE_END, -1)->a.n = op;
+				break;
+			}
+			vm_compile_expr(c, op1);
+			vm_nextchk(c);
+			vm_jump(c, VM_JFALSE, -1, op->r.n);
+			op = op->a.n;
+			continue;
+
+		/* just evaluate an expression, also used as unconditional jump */
+		case XC( OC_EXEC ):
+			if ((opinfo & OF_RES1) && op1) {
+				vm_compile_expr(c, op1);
+				vm_emit(c, VM_POP, -1);
+			}
+			break;
+
+		/* branch, used in if-else and various loops */
+		case XC( OC_BR ):
+			vm_compile_expr(c, op1);
+			vm_nextchk(c);
+			vm_jump(c, VM_JFALSE, -1, op->r.n);
+			op = op->a.n;
+			continue;
+
+		/* initialize for-in loop */
+		case XC( OC_WALKINIT ):
+			vm_compile_expr(c, op1);
+			vm_compile_expr(c, op->r.n);
+			vm_emit(c, VM_WALKINIT, -2);
+			break;
+
+		/* get next array item */
+		case XC( OC_WALKNEXT ):
+			vm_compile_expr(c, op1);
+			vm_nextchk(c);
+			vm_jump(c, VM_WALKNEXT, -1, op->r.n);
+			op = op->a.n;
+			continue;
+
+		case XC( OC_PRINT ):
+		case XC( OC_PRINTF ): {
+			int redir = (op->r.n != NULL);
+
+			if (redir)
+				vm_compile_expr(c, op->r.n);
+			ip = vm_emit(c, VM_PRINT_BEGIN, -redir);
+			ip->a.n = op;
+			ip->sub = redir;
+			if (opinfo == TI_PRINT) {
+				if (!op1)
+					vm_emit(c, VM_PRINT_END, 0)->sub = 1;
+				else {
+					while (op1) {
+						vm_compile_expr(c, nextarg(&op1));
+						vm_emit(c, VM_PRINT_ARG, -1)->sub = (op1 != NULL);
+					}
+					vm_emit(c, VM_PRINT_END, 0);
+				}
+			} else {
+				int k = vm_compile_list(c, op1);
+				vm_emit(c, VM_PRINTF, -k)->cnt = k;
+			}
+			break;
+		}
+
+		case XC( OC_DELETE ): {
+			/* "delete" is special:
+			 * "delete array[var--]" must evaluate index expr only once.
+			 */
+			uint32_t info = op1->info & OPCLSMASK;
+
+			if (info != OC_VAR && info != OC_FNARG) {
+				vm_emit(c, VM_ERROR, 0)->a.s = EMSG_NOT_ARRAY;
+				return;
+			}
+			if (op1->r.n) /* array ref? */
+				vm_compile_expr(c, op1->r.n);
+			ip = vm_emit(c, VM_DELETE, op1->r.n ? -1 : 0);
+			ip->sub = (op1->r.n ? 1 : 0) | (info == OC_FNARG ? 2 : 0);
+			if (info == OC_VAR)
+				ip->a.v = op1->l.v;
+			else
+				ip->a.aidx = op1->l.aidx;
+			break;
+		}
+
+		case XC( OC_NEWSOURCE ):
+			vm_emit(c, VM_SETPROG, 0)->a.s = op->l.new_progname;
+			break;
+
+		case XC( OC_RETURN ):
+			vm_compile_expr(c, op1);
+			vm_emit(c, VM_RETURN, -1);
+			return;
+
+		case XC( OC_NEXTFILE ):
 		case XC( OC_NEXT ):
-			debug_printf_eval("NEXT\n");
-			nextrec = TRUE;
+			vm_emit(c, VM_NEXT, 0)->sub = ((opinfo & OPCLSMASK) == OC_NEXTFILE);
+			return;
+
 		case XC( OC_DONE ):
-			debug_printf_eval("DONE\n");
-			clrvar(res);
-			break;
+			vm_emit(c, VM_DONE, 0);
+			return;
 
 		case XC( OC_EXIT ):
-			debug_printf_eval("EXIT\n");
-			if (op1)
-				G.exitcode = (int)L_d;
-			awk_exit();
+			vm_compile_expr(c, op1);
+			vm_emit(c, VM_EXIT, -1)->sub = (op1 != NULL);
+			return;
 
-		/* -- recursive node type -- */
+		default:
+			vm_emit(c, VM_ERROR, 0)->a.s = EMSG_POSSIBLE_ERROR;
+			return;
+		}
 
-		case XC( OC_VAR ):
-			debug_printf_eval("VAR\n");
-			L.v = op->l.v;
-			if (L.v == intvar[NF])
-				split_f0();
-			goto v_cont;
+		vm_nextchk(c);
+		op = op->a.n;
+	}
+}
 
-		case XC( OC_FNARG ):
-			debug_printf_eval("FNARG[%d]\n", op->l.aidx);
-			L.v = &fnargs[op->l.aidx];
- v_cont:
-			res = op->r.n ? findvar(iamarray(L.v), R.s) : L.v;
+/* Compile statement chain or expression starting at op */
+static vm_code *vm_compile(node *op, int fbody)
+{
+	vm_comp c;
+	vm_code *code;
+	uint32_t cls = op->info & OPCLSMASK;
+	unsigned i;
+
+	memset(&c, 0, sizeof(c));
+	c.fbody = fbody;
+	c.lineno = op->lineno;
+
+	if (cls < RECUR_FROM_THIS || cls == OC_RETURN || cls == OC_DONE) {
+		int ret_pc = -1;
+
+		vm_compile_chain(&c, op);
+		/* statements reached only by jumps; more jumps may be added */
+		for (i = 0; i < c.nfixups; i++) {
+			node *n = c.fixup[i].n;
+			int pc;
+
+			if (!n) {
+				if (ret_pc < 0) {
+					ret_pc = c.len;
+					vm_emit(&c, VM_RET, 0);
+				}
+				pc = ret_pc;
+			} else {
+				pc = vm_label_find(&c, n);
+				if (pc < 0) {
+					pc = c.len;
+					vm_compile_chain(&c, n);
+				}
+			}
+			c.insn[c.fixup[i].at].target = pc;
+		}
+	} else {
+		vm_compile_expr(&c, op);
+		vm_emit(&c, VM_RET_TOP, -1);
+	}
+	debug_printf_eval("vm_compile: %u insns, %d slots\n", c.len, c.max_depth);
+
+	code = xmalloc(sizeof(*code) + c.len * sizeof(c.insn[0]));
+	code->depth = c.max_depth;
+	memcpy(code->insn, c.insn, c.len * sizeof(c.insn[0]));
+	free(c.insn);
+	free(c.label);
+	free(c.fixup);
+	return code;
+}
+
+/* move value of var src to dst, src is left empty */
+static var *vm_take(var *dst, var *src)
+{
+	clrvar(dst);
+	dst->type |= (src->type & ~(VF_DONTTOUCH | VF_FSTR));
+	dst->number = src->number;
+	dst->string = src->string;
+	src->string = NULL;
+	return dst;
+}
+
+static void vm_field(vm_slot *s, int i)
+{
+	if (i < 0)
+		syntax_error(EMSG_NEGATIVE_FIELD);
+	s->v = NULL;
+	s->field = i;
+	if (i == 0) {
+		s->v = intvar[F0];
+	} else {
+		split_f0();
+		if (i > nfields)
+			fsrealloc(i);
+	}
+}
+
+static double vm_arith(int opn, double L_d, double R_d)
+{
+	switch (opn) {
+	case '+':
+		L_d += R_d;
+		break;
+	case '-':
+		L_d -= R_d;
+		break;
+	case '*':
+		L_d *= R_d;
+		break;
+	case '/':
+		if (R_d == 0)
+			syntax_error(EMSG_DIV_BY_ZERO);
+		L_d /= R_d;
+		break;
+	case '&':
+		if (ENABLE_FEATURE_AWK_LIBM)
+			L_d = pow(L_d, R_d);
+		else
+			syntax_error(EMSG_NO_MATH);
+		break;
+	case '%':
+		if (R_d == 0)
+			syntax_error(EMSG_DIV_BY_ZERO);
+		L_d -= (long long)(L_d / R_d) * R_d;
+		break;
+	}
+	return L_d;
+}
+
+/*
+ * Run compiled code. Supplied with "res" variable to assign
+ * the result to if it's an expression or a function body.
+ * If the expression refers to e.g. a variable or a field,
+ * no assignment happens.
+ * Return ptr to the result (which may or may not be the "res" variable!)
+ */
+static var *vm_run(const vm_code *code, var *res)
+{
+/* This procedure is recursive so we should count every byte */
+#define fnargs (G.evaluate__fnargs)
+
+	const vm_insn *ip = code->insn;
+	vm_slot *base = vm_frame_alloc(code->depth);
+	vm_slot *sp = base; /* first free slot */
+	FILE *F = stdout;
+
+	for (;;) {
+		g_lineno = ip->lineno;
+		debug_printf_eval("vm op:%d sp:%d\n", ip->op, (int)(sp - base));
+
+		switch (ip->op) {
+
+		case VM_PUSH_EMPTY:
+			sp->v = setvar_s(&sp->tmp, NULL);
+			sp++;
+			break;
+
+		case VM_PUSH_VAR:
+			sp->v = ip->a.v;
+			sp++;
+			break;
+
+		case VM_PUSH_NF:
+			split_f0();
+			sp->v = intvar[NF];
+			sp++;
+			break;
+
+		case VM_PUSH_FNARG:
+			sp->v = &fnargs[ip->a.aidx];
+			sp++;
+			break;
+
+		case VM_ELEM:
+		case VM_ELEM_FNARG: {
+			var *v = (ip->op == VM_ELEM) ? ip->a.v : &fnargs[ip->a.aidx];
+			sp[-1].v = findvar(iamarray(v), slot_str(&sp[-1]));
+			break;
+		}
+
+		case VM_FIELD:
+			vm_field(&sp[-1], (int)slot_num(&sp[-1]));
+			break;
+
+		case VM_FIELD_VAR:
+			vm_field(sp, (int)getvar_i(ip->a.v));
+			sp++;
+			break;
+
+		case VM_SNAP:
+			if (sp[-1].v != &sp[-1].tmp && (sp[-1].v || sp[-1].field))
+				sp[-1].v = copyvar(&sp[-1].tmp, slot_var(&sp[-1]));
+			break;
+
+		case VM_TONUM:
+			slot_set_num(&sp[-1], slot_num(&sp[-1]));
+			break;
+
+		case VM_DUPNUM:
+			slot_set_num(sp, slot_num(&sp[-1]));
+			sp++;
+			break;
+
+		case VM_POP:
+			sp--;
+			break;
+
+		case VM_BINARY: {
+			double R_d = slot_num(&sp[-1]);
+			sp--;
+			slot_set_num(&sp[-1], vm_arith(ip->sub, slot_num(&sp[-1]), R_d));
+			break;
+		}
+
+		case VM_REPLACE: {
+			double R_d = slot_num(&sp[-1]);
+			double L_d;
+
+			sp--;
+			if (ip->cnt) {
+				L_d = sp[-1].d;
+				sp--;
+			} else {
+				L_d = slot_num(&sp[-1]);
+			}
+			setvar_i(slot_var(&sp[-1]), vm_arith(ip->sub, L_d, R_d));
+			break;
+		}
+
+		case VM_UNARY: {
+			vm_slot *s = &sp[-1];
+			double Ld, R_d;
+
+			Ld = R_d = slot_num(s);
+			switch (ip->sub) {
+			case 'P':
+				Ld = ++R_d;
+				goto r_op_change;
+			case 'p':
+				R_d++;
+				goto r_op_change;
+			case 'M':
+				Ld = --R_d;
+				goto r_op_change;
+			case 'm':
+				R_d--;
+ r_op_change:
+				setvar_i(slot_var(s), R_d);
+				break;
+			case '!':
+				Ld = !slot_true(s);
+				break;
+			case '-':
+				Ld = -R_d;
+				break;
+			}
+			slot_set_num(s, Ld);
 			break;
+		}
 
-		case XC( OC_IN ):
-			debug_printf_eval("IN\n");
-			setvar_i(res, hash_search(iamarray(R.v), L.s) ? 1 : 0);
-			break;
+		case VM_COMPARE: {
+			vm_slot *l = &sp[-2];
+			vm_slot *r = &sp[-1];
+			int opn = ip->sub;
+			int i = i; /* for compiler */
+			double Ld;
 
-		case XC( OC_REGEXP ):
-			debug_printf_eval("REGEXP\n");
-			op1 = op;
-			L.s = getvar_s(intvar[F0]);
-			goto re_cont;
-
-		case XC( OC_MATCH ):
-			debug_printf_eval("MATCH\n");
-			op1 = op->r.n;
- re_cont:
+			if ((!l->v && !l->field) || is_numeric(slot_var(l))) {
+				if ((!r->v && !r->field) || is_numeric(slot_var(r))) {
+					Ld = slot_num(l) - slot_num(r);
+					goto cmp;
+				}
+			}
 			{
-				regex_t *re = as_regex(op1, &sreg);
-				int i = regexec(re, L.s, 0, NULL, 0);
-				if (re == &sreg)
-					regfree(re);
-				setvar_i(res, (i == 0) ^ (opn == '!'));
+				const char *ls = slot_str(l);
+				const char *rs = slot_str(r);
+				Ld = icase ? strcasecmp(ls, rs) : strcmp(ls, rs);
+			}
+ cmp:
+			switch (opn & 0xfe) {
+			case 0:
+				i = (Ld > 0);
+				break;
+			case 2:
+				i = (Ld >= 0);
+				break;
+			case 4:
+				i = (Ld == 0);
+				break;
 			}
+			slot_set_num(l, (i == 0) ^ (opn & 1));
+			sp--;
 			break;
+		}
 
-		case XC( OC_MOVE ):
-			debug_printf_eval("MOVE\n");
-			/* if source is a temporary string, jusk relink it to dest */
-			if (R.v == TMPVAR1
-			 && !(R.v->type & VF_NUMBER)
-				/* Why check !NUMBER? if R.v is a number but has cached R.v->string,
-				 * L.v ends up a string, which is wrong */
-			 /*&& R.v->string - always not NULL (right?) */
-			) {
-				res = setvar_p(L.v, R.v->string); /* avoids strdup */
-				R.v->string = NULL;
+		case VM_CONCAT: {
+			vm_slot *l = &sp[-2];
+			const char *ls = slot_str(l);
+			const char *rs = slot_str(&sp[-1]);
+			const char *sep = ip->sub ? getvar_s(intvar[SUBSEP]) : "";
+			size_t ll = strlen(ls);
+			size_t sl = strlen(sep);
+			size_t rl = strlen(rs);
+			char *s = xmalloc(ll + sl + rl + 1);
+
+			memcpy(s, ls, ll);
+			memcpy(s + ll, sep, sl);
+			memcpy(s + ll + sl, rs, rl + 1);
+			l->v = setvar_p(&l->tmp, s);
+			sp--;
+			break;
+		}
+
+		case VM_MOVE: {
+			vm_slot *r = &sp[-1];
+
+			sp--;
+			if (!r->v && !r->field) {
+				setvar_i(slot_var(&sp[-1]), r->d);
 			} else {
-				res = copyvar(L.v, R.v);
+				var *rv = slot_var(r);
+				var *lv = slot_var(&sp[-1]);
+				/* if source is a temporary string, jusk relink it to dest */
+				if (rv == &r->tmp
+				 && !(rv->type & VF_NUMBER)
+					/* Why check !NUMBER? if rv is a number but has cached rv->string,
+					 * lv ends up a string, which is wrong */
+				) {
+					setvar_p(lv, rv->string); /* avoids strdup */
+					rv->string = NULL;
+				} else {
+					copyvar(lv, rv);
+				}
 			}
 			break;
+		}
 
-		case XC( OC_TERNARY ):
-			debug_printf_eval("TERNARY\n");
-			if (op->r.n->info != TI_COLON)
-				syntax_error(EMSG_POSSIBLE_ERROR);
-			res = evaluate(istrue(L.v) ? op->r.n->l.n : op->r.n->r.n, res);
+		case VM_IN: {
+			const char *s = slot_str(&sp[-2]);
+			int i = hash_search(iamarray(slot_var(&sp[-1])), s) ? 1 : 0;
+			sp--;
+			slot_set_num(&sp[-1], i);
 			break;
+		}
+
+		case VM_REGEXP:
+		case VM_MATCH: {
+			node *n = ip->a.n;
+			const char *s;
+			regex_t *re;
+			int i = REG_NOMATCH;
 
-		case XC( OC_FUNC ): {
-			var *argvars, *sv_fnargs;
-			const char *sv_progname;
-			int nargs, i;
+			if (ip->op == VM_REGEXP) {
+				s = getvar_s(intvar[F0]);
+				sp++;
+			} else {
+				s = slot_str(&sp[-1]);
+			}
+			re = as_regex(n);
+			if (n->info != TI_REGEXP
+			 || !regex_literal_missing(s, n->re_literal, icase ? REG_ICASE : 0)
+			) {
+				i = regexec(re, s, 0, NULL, 0);
+			}
+			slot_set_num(&sp[-1], (i == 0) ^ (ip->sub == '!'));
+			break;
+		}
 
-			debug_printf_eval("FUNC\n");
+		case VM_TRUTH:
+			slot_set_num(&sp[-1], slot_true(&sp[-1]));
+			break;
 
-			if (!op->r.f->defined)
-				syntax_error(EMSG_UNDEF_FUNC);
+		case VM_JMP:
+			ip = code->insn + ip->target;
+			continue;
 
-			/* The body might be empty, still has to eval the args */
-			nargs = op->r.f->nargs;
-			argvars = nvalloc(nargs);
-			i = 0;
-			while (op1) {
-				var *arg = evaluate(nextarg(&op1), TMPVAR0);
-				if (i == nargs) {
-					/* call with more arguments than function takes.
-					 * (gawk warns: "warning: function 'f' called with more arguments than declared").
-					 * They are still evaluated, but discarded: */
-					clrvar(arg);
-					continue;
-				}
-				copyvar(&argvars[i], arg);
-				argvars[i].type |= VF_CHILD;
-				argvars[i].x.parent = arg;
-				i++;
+		case VM_JFALSE:
+			sp--;
+			if (!slot_true(sp)) {
+				ip = code->insn + ip->target;
+				continue;
 			}
+			break;
 
-			sv_fnargs = fnargs;
-			sv_progname = g_progname;
+		case VM_LAND:
+		case VM_LOR: {
+			int t = slot_true(&sp[-1]);
+			if (t == (ip->op == VM_LOR)) {
+				slot_set_num(&sp[-1], t);
+				ip = code->insn + ip->target;
+				continue;
+			}
+			sp--;
+			break;
+		}
 
-			fnargs = argvars;
-			res = evaluate(op->r.f->body.first, res);
-			nvfree(argvars, nargs);
+		case VM_JCHECKED:
+			if (ip->a.n->info & OF_CHECKED) {
+				ip = code->insn + ip->target;
+				continue;
+			}
+			break;
 
-			g_progname = sv_progname;
-			fnargs = sv_fnargs;
+		case VM_RANGE_END:
+			sp--;
+			ip->a.n->info |= OF_CHECKED;
+			if (slot_true(sp))
+				ip->a.n->info &= ~OF_CHECKED;
+			break;
 
+		case VM_WALKINIT:
+			hashwalk_init(slot_var(&sp[-2]), iamarray(slot_var(&sp[-1])));
+			sp -= 2;
 			break;
-		}
 
-		case XC( OC_GETLINE ):
-			debug_printf_eval("GETLINE /\n");
-		case XC( OC_PGETLINE ):
-			debug_printf_eval("PGETLINE\n");
-		{
-			rstream *rsm;
-			int i;
+		case VM_WALKNEXT:
+			sp--;
+			if (!hashwalk_next(slot_var(sp))) {
+				ip = code->insn + ip->target;
+				continue;
+			}
+			break;
 
-			if (op1) {
-				rsm = newfile(L.s);
+		case VM_PRINT_BEGIN:
+			F = stdout;
+			if (ip->sub) {
+				const char *s = slot_str(&sp[-1]);
+				rstream *rsm = newfile(s);
 				if (!rsm->F) {
-					if (opinfo == TI_PGETLINE) {
-						rsm->F = popen(L.s, "r");
-						rsm->is_pipe = TRUE;
+					if ((ip->a.n->info & OPNMASK) == '|') {
+						rsm->F = popen(s, "w");
+						if (rsm->F == NULL)
+							bb_simple_perror_msg_and_die("popen");
+						rsm->is_pipe = 1;
 					} else {
-						rsm->F = fopen_for_read(L.s);  /* not xfopen! */
+						rsm->F = xfopen(s, (ip->a.n->info & OPNMASK) == 'w' ? "w" : "a");
 					}
 				}
-			} else {
-				if (!iF)
-					iF = next_input_file();
-				rsm = iF;
-			}
-
-			if (!rsm || !rsm->F) {
-				setvar_i(intvar[ERRNO], errno);
-				setvar_i(res, -1);
-				break;
+				F = rsm->F;
+				sp--;
 			}
+			break;
 
-			if (!op->r.n)
-				R.v = intvar[F0];
+		case VM_PRINT_ARG: {
+			vm_slot *s = &sp[-1];
 
-			i = awk_getline(rsm, R.v);
-			if (i > 0 && !op1) {
-				incvar(intvar[FNR]);
-				incvar(intvar[NR]);
+			if ((!s->v && !s->field) || (slot_var(s)->type & VF_NUMBER)) {
+				fmt_num(g_buf, MAXVARFMT, getvar_s(intvar[OFMT]),
+						slot_num(s), TRUE);
+				fputs(g_buf, F);
+			} else {
+				fputs(slot_str(s), F);
 			}
-			setvar_i(res, i);
+			if (ip->sub)
+				fputs(getvar_s(intvar[OFS]), F);
+			sp--;
 			break;
 		}
 
-		/* simple builtins */
-		case XC( OC_FBLTIN ): {
-			double R_d = R_d; /* for compiler */
-			debug_printf_eval("FBLTIN\n");
-
-			if (op1 && op1->info == TI_COMMA)
-				/* Simple builtins take one arg maximum */
-				syntax_error("Too many arguments");
-
-			switch (opn) {
-			case F_in:
-				R_d = (long long)L_d;
-				break;
+		case VM_PRINT_END:
+			if (ip->sub)
+				fputs(getvar_s(intvar[F0]), F);
+			fputs(getvar_s(intvar[ORS]), F);
+			fflush(F);
+			break;
 
-			case F_rn: /*rand*/
-				if (op1)
-					syntax_error("Too many arguments");
-			{
-#if RAND_MAX >= 0x7fffffff
-				uint32_t u = ((uint32_t)rand() << 16) ^ rand();
-				uint64_t v = ((uint64_t)rand() << 32) | u;
-				/* the above shift+or is optimized out on 32-bit arches */
-# if RAND_MAX > 0x7fffffff
-				v &= 0x7fffffffffffffffULL;
-# endif
-				R_d = (double)v / 0x8000000000000000ULL;
-#elif ENABLE_PLATFORM_MINGW32 && RAND_MAX == 0x7fff
-				/* 45 bits of randomness ought to be enough for anyone */
-				uint64_t v = ((uint64_t)rand() << 48) |
-								((uint64_t)rand() << 33) |
-								((uint64_t)rand() << 18);
-				R_d = (double)v / 0x8000000000000000ULL;
+		case VM_PRINTF: {
+			IF_FEATURE_AWK_GNU_EXTENSIONS(int len;)
+			char *s = awk_printf(sp - ip->cnt, ip->cnt, &len);
+#if ENABLE_FEATURE_AWK_GNU_EXTENSIONS
+			fwrite(s, len, 1, F);
 #else
-# error Not implemented for this value of RAND_MAX
+			fputs(s, F);
 #endif
-				break;
-			}
-			case F_co:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = cos(L_d);
-					break;
-				}
-
-			case F_ex:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = exp(L_d);
-					break;
-				}
-
-			case F_lg:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = log(L_d);
-					break;
-				}
-
-			case F_si:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = sin(L_d);
-					break;
-				}
-
-			case F_sq:
-				if (ENABLE_FEATURE_AWK_LIBM) {
-					R_d = sqrt(L_d);
-					break;
-				}
+			free(s);
+			fflush(F);
+			sp -= ip->cnt;
+			break;
+		}
 
-				syntax_error(EMSG_NO_MATH);
-				break;
+		case VM_SPRINTF: {
+			char *s = awk_printf(sp - ip->cnt, ip->cnt, NULL);
+			sp -= ip->cnt;
+			sp->v = setvar_p(&sp->tmp, s);
+			sp++;
+			break;
+		}
 
-			case F_sr:
-				R_d = (double)seed;
-				seed = op1 ? (unsigned)L_d : (unsigned)time(NULL);
-				srand(seed);
-				break;
+		case VM_DELETE: {
+			var *v = (ip->sub & 2) ? &fnargs[ip->a.aidx] : ip->a.v;
+			if (ip->sub & 1) {
+				hash_remove(iamarray(v), slot_str(&sp[-1]));
+				sp--;
+			} else {
+				clear_array(iamarray(v));
+			}
+			break;
+		}
 
-			case F_ti: /*systime*/
-				if (op1)
-					syntax_error("Too many arguments");
-				R_d = time(NULL);
-				break;
+		case VM_SETPROG:
+			g_progname = ip->a.s;
+			break;
 
-			case F_le:
-				debug_printf_eval("length: L.s:'%s'\n", L.s);
-				if (!op1) {
-					L.s = getvar_s(intvar[F0]);
-					debug_printf_eval("length: L.s='%s'\n", L.s);
-				}
-				else if (L.v->type & VF_ARRAY) {
-					R_d = L.v->x.array->nel;
-					debug_printf_eval("length: array_len:%d\n", L.v->x.array->nel);
-					break;
-				}
-				R_d = strlen(L.s);
-				break;
+		case VM_GETLINE: {
+			node *op = ip->a.n;
+			vm_slot *file = NULL;
+			vm_slot *target = NULL;
+			rstream *rsm;
+			int i;
 
-			case F_sy:
-				fflush_all();
-				R_d = (ENABLE_FEATURE_ALLOW_EXEC && L.s && *L.s)
-						? (system(L.s) >> 8) : 0;
-				break;
+			if (ip->sub & 2)
+				target = --sp;
+			if (ip->sub & 1)
+				file = --sp;
 
-			case F_ff:
-				if (!op1) {
-					fflush(stdout);
-				} else if (L.s && *L.s) {
-					rstream *rsm = newfile(L.s);
-					fflush(rsm->F);
-				} else {
-					fflush_all();
+			if (file) {
+				const char *s = slot_str(file);
+				rsm = newfile(s);
+				if (!rsm->F) {
+					if (op->info == TI_PGETLINE) {
+						rsm->F = popen(s, "r");
+						rsm->is_pipe = TRUE;
+					} else {
+						rsm->F = fopen_for_read(s);  /* not xfopen! */
+					}
 				}
-				break;
+			} else {
+				if (!iF)
+					iF = next_input_file();
+				rsm = iF;
+			}
 
-			case F_cl: {
-				rstream *rsm;
-				int err = 0;
-				rsm = (rstream *)hash_search(fdhash, L.s);
-				debug_printf_eval("OC_FBLTIN close: op1:%p s:'%s' rsm:%p\n", op1, L.s, rsm);
-				if (rsm) {
-					debug_printf_eval("OC_FBLTIN F_cl "
-						"rsm->is_pipe:%d, ->F:%p\n",
-						rsm->is_pipe, rsm->F);
-					/* Can be NULL if open failed. Example:
-					 * getline line <"doesnt_exist";
-					 * close("doesnt_exist"); <--- here rsm->F is NULL
-					 */
-					if (rsm->F)
-						err = rsm->is_pipe ? pclose(rsm->F) : fclose(rsm->F);
-//TODO: fix this case:
-// $ awk 'BEGIN { print close(""); print ERRNO }'
-// -1
-// close of redirection that was never opened
-// (we print 0, 0)
-					free(rsm->buffer);
-					hash_remove(fdhash, L.s);
+			if (!rsm || !rsm->F) {
+				setvar_i(intvar[ERRNO], errno);
+				i = -1;
+			} else {
+				i = awk_getline(rsm, target ? slot_var(target) : intvar[F0]);
+				if (i > 0 && !file) {
+					incvar(intvar[FNR]);
+					incvar(intvar[NR]);
 				}
-				if (err)
-					setvar_i(intvar[ERRNO], errno);
-				R_d = (double)err;
-				break;
 			}
-			} /* switch */
-			setvar_i(res, R_d);
+			slot_set_num(sp, i);
+			sp++;
 			break;
 		}
 
-		case XC( OC_BUILTIN ):
-			debug_printf_eval("BUILTIN\n");
-			res = exec_builtin(op, res);
-			break;
-
-		case XC( OC_SPRINTF ):
-			debug_printf_eval("SPRINTF\n");
-			setvar_p(res, awk_printf(op1, NULL));
+		case VM_FBLTIN:
+			if (ip->sub) {
+				slot_set_num(&sp[-1], exec_fbltin(ip->a.n, slot_var(&sp[-1])));
+			} else {
+				slot_set_num(sp, exec_fbltin(ip->a.n, NULL));
+				sp++;
+			}
 			break;
 
-		case XC( OC_UNARY ):
-			debug_printf_eval("UNARY\n");
-		{
-			double Ld, R_d;
+		case VM_BUILTIN: {
+			var r;
+			var *v;
 
-			Ld = R_d = getvar_i(R.v);
-			switch (opn) {
-			case 'P':
-				Ld = ++R_d;
-				goto r_op_change;
-			case 'p':
-				R_d++;
-				goto r_op_change;
-			case 'M':
-				Ld = --R_d;
-				goto r_op_change;
-			case 'm':
-				R_d--;
- r_op_change:
-				setvar_i(R.v, R_d);
-				break;
-			case '!':
-				Ld = !istrue(R.v);
-				break;
-			case '-':
-				Ld = -R_d;
-				break;
-			}
-			setvar_i(res, Ld);
+			memset(&r, 0, sizeof(r));
+			sp -= ip->cnt;
+			v = exec_builtin(ip->a.n, sp, &r);
+			if (v == &r)
+				v = vm_take(&sp->tmp, &r);
+			sp->v = v;
+			sp->field = 0;
+			sp++;
 			break;
 		}
 
-		case XC( OC_FIELD ):
-			debug_printf_eval("FIELD\n");
-		{
-			int i = (int)getvar_i(R.v);
-			if (i < 0)
-				syntax_error(EMSG_NEGATIVE_FIELD);
-			if (i == 0) {
-				res = intvar[F0];
-			} else {
-				split_f0();
-				if (i > nfields)
-					fsrealloc(i);
-				res = &Fields[i - 1];
-			}
+		case VM_ARGS_BEGIN:
+			sp->v = nvalloc(ip->a.f->nargs);
+			sp->field = 0;
+			sp++;
 			break;
-		}
 
-		/* concatenation (" ") and index joining (",") */
-		case XC( OC_CONCAT ):
-			debug_printf_eval("CONCAT /\n");
-		case XC( OC_COMMA ): {
-			const char *sep = "";
-			debug_printf_eval("COMMA\n");
-			if (opinfo == TI_COMMA)
-				sep = getvar_s(intvar[SUBSEP]);
-			setvar_p(res, xasprintf("%s%s%s", L.s, sep, R.s));
+		case VM_ARG: {
+			var *arg = slot_var(&sp[-1]);
+			var *av = &sp[-2].v[ip->a.aidx];
+			copyvar(av, arg);
+			av->type |= VF_CHILD;
+			av->x.parent = arg;
+			sp--;
 			break;
 		}
 
-		case XC( OC_LAND ):
-			debug_printf_eval("LAND\n");
-			setvar_i(res, istrue(L.v) ? ptest(op->r.n) : 0);
+		case VM_ARG_EXTRA:
+			clrvar(slot_var(&sp[-1]));
+			sp--;
 			break;
 
-		case XC( OC_LOR ):
-			debug_printf_eval("LOR\n");
-			setvar_i(res, istrue(L.v) ? 1 : ptest(op->r.n));
-			break;
+		case VM_CALL: {
+			func *f = ip->a.f;
+			node *body = f->body.first;
+			vm_slot *s = &sp[-1];
+			var *argvars = s->v;
+			var *sv_fnargs = fnargs;
+			const char *sv_progname = g_progname;
 
-		case XC( OC_BINARY ):
-			debug_printf_eval("BINARY /\n");
-		case XC( OC_REPLACE ):
-			debug_printf_eval("REPLACE\n");
-		{
-			double R_d = getvar_i(R.v);
-			debug_printf_eval("R_d:%f opn:%c\n", R_d, opn);
-			switch (opn) {
-			case '+':
-				L_d += R_d;
-				break;
-			case '-':
-				L_d -= R_d;
-				break;
-			case '*':
-				L_d *= R_d;
-				break;
-			case '/':
-				if (R_d == 0)
-					syntax_error(EMSG_DIV_BY_ZERO);
-				L_d /= R_d;
-				break;
-			case '&':
-				if (ENABLE_FEATURE_AWK_LIBM)
-					L_d = pow(L_d, R_d);
-				else
-					syntax_error(EMSG_NO_MATH);
-				break;
-			case '%':
-				if (R_d == 0)
-					syntax_error(EMSG_DIV_BY_ZERO);
-				L_d -= (long long)(L_d / R_d) * R_d;
-				break;
-			}
-			debug_printf_eval("BINARY/REPLACE result:%f\n", L_d);
-			res = setvar_i(((opinfo & OPCLSMASK) == OC_BINARY) ? res : L.v, L_d);
-			break;
-		}
+			if (body && !body->code)
+				body->code = vm_compile(body, TRUE);
 
-		case XC( OC_COMPARE ): {
-			int i = i; /* for compiler */
-			double Ld;
-			debug_printf_eval("COMPARE\n");
+			fnargs = argvars;
+			s->v = evaluate(body, &s->tmp);
+			nvfree(argvars, f->nargs);
 
-			if (is_numeric(L.v) && is_numeric(R.v)) {
-				Ld = getvar_i(L.v) - getvar_i(R.v);
-			} else {
-				const char *l = getvar_s(L.v);
-				const char *r = getvar_s(R.v);
-				Ld = icase ? strcasecmp(l, r) : strcmp(l, r);
-			}
-			switch (opn & 0xfe) {
-			case 0:
-				i = (Ld > 0);
-				break;
-			case 2:
-				i = (Ld >= 0);
-				break;
-			case 4:
-				i = (Ld == 0);
-				break;
+			g_progname = sv_progname;
+			fnargs = sv_fnargs;
+
+			/* an argument evaluated to the temporary
+			 * could have been made an array */
+			if (ip->sub && (s[1].tmp.type & (VF_ARRAY | VF_WALK))) {
+				nvclear(&s[1].tmp, 1);
+				memset(&s[1].tmp, 0, sizeof(s[1].tmp));
 			}
-			setvar_i(res, (i == 0) ^ (opn & 1));
 			break;
 		}
 
-		default:
-			syntax_error(EMSG_POSSIBLE_ERROR);
-		} /* switch */
-
-		if ((opinfo & OPCLSMASK) <= SHIFT_TIL_THIS)
-			op = op->a.n;
-		if ((opinfo & OPCLSMASK) >= RECUR_FROM_THIS)
+		case VM_NEXTCHK:
+			if (nextrec)
+				goto out;
 			break;
-		if (nextrec)
-			break;
-	} /* while (op) */
 
-	nvfree(tmpvars, 2);
-#undef TMPVAR0
-#undef TMPVAR1
+		case VM_NEXT:
+			if (ip->sub)
+				nextfile = TRUE;
+			nextrec = TRUE;
+			/* fall through */
+		case VM_DONE:
+			clrvar(res);
+			goto out;
+
+		case VM_RET:
+			goto out;
+
+		case VM_RETURN:
+			copyvar(res, slot_var(&sp[-1]));
+			goto out;
+
+		case VM_RET_TOP:
+			sp--;
+			if (sp->v == &sp->tmp)
+				res = vm_take(res, &sp->tmp);
+			else if (sp->v || sp->field)
+				res = slot_var(sp);
+			else
+				setvar_i(res, sp->d);
+			goto out;
+
+		case VM_EXIT:
+			if (ip->sub)
+				G.exitcode = (int)slot_num(&sp[-1]);
+			awk_exit();
+
+		default: /* VM_ERROR */
+			syntax_error(ip->a.s);
+		}
+		ip++;
+	}
+ out:
+	vm_frame_free(base, code->depth);
 
 	debug_printf_eval("returning from %s(): %p\n", __func__, res);
 	return res;
 #undef fnargs
-#undef seed
-#undef sreg
+}
+
+/*
+ * Evaluate node - the heart of the program. Supplied with subtree
+ * and "res" variable to assign the result to if we evaluate an expression.
+ * If node refers to e.g. a variable or a field, no assignment happens.
+ * Return ptr to the result (which may or may not be the "res" variable!)
+ */
+static var *evaluate(node *op, var *res)
+{
+	if (!op)
+		return setvar_s(res, NULL);
+
+	/* Plain variables and constants are the most common dynamic
+	 * regexps, return them without running the VM */
+	if (op->info == OC_VAR && op->l.v != intvar[NF]) {
+		g_lineno = op->lineno;
+		return op->l.v;
+	}
+	if (op->info == OC_FNARG) {
+		g_lineno = op->lineno;
+		return &G.evaluate__fnargs[op->l.aidx];
+	}
+
+	if (!op->code)
+		op->code = vm_compile(op, FALSE);
+	return vm_run(op->code, res);
 }
 
 
@@ -3501,7 +4545,7 @@ static var *evaluate(node *op, var *res)
 
 static int awk_exit(void)
 {
-	unsigned i;
+	hash_item *hi;
 
 	if (!exiting) {
 		exiting = TRUE;
@@ -3510,14 +4554,9 @@ static int awk_exit(void)
 	}
 
 	/* waiting for children */
-	for (i = 0; i < fdhash->csize; i++) {
-		hash_item *hi;
-		hi = fdhash->items[i];
-		while (hi) {
-			if (hi->data.rs.F && hi->data.rs.is_pipe)
-				pclose(hi->data.rs.F);
-			hi = hi->next;
-		}
+	for (hi = fdhash->first; hi; hi = hi->next) {
+		if (hi->data.rs.F && hi->data.rs.is_pipe)
+			pclose(hi->data.rs.F);
 	}
 
 	exit(G.exitcode);
@@ -3626,7 +4665,7 @@ int awk_main(int argc UNUSED_PARAM, char **argv)
 	//hash_free(fnhash); // ~250 bytes when empty, used only for function names
 	//^^^^^^^^^^^^^^^^^ does not work, hash_clear() inside SEGVs
 	// (IOW: hash_clear() assumes it's a hash of variables. fnhash is not).
-	free(fnhash->items);
+	free(fnhash->slots);
 	free(fnhash);
 	fnhash = NULL; // debug
 	//hash_free(ahash); // empty after parsing, will reuse as fdhash instead of freeing
@@ -59,6 +59,16 @@
 //config:	help
 //config:	sed is used to perform text transformations on a file
 //config:	or input from a pipeline.
+//config:
+//config:config FEATURE_SED_FAST_IN_PLACE
+//config:	bool "Copy the parts of files no command can touch as is with -i"
+//config:	default y
+//config:	depends on SED && PLATFORM_POSIX
+//config:	help
+//config:	When no command can match the next lines of a large file (they
+//config:	are outside all line number ranges, and lack the text which the
+//config:	regexps need), sed -i copies them to the new file without
+//config:	splitting them into lines, with copy_file_range() if possible.
 
 //applet:IF_SED(APPLET(sed, BB_DIR_BIN, BB_SUID_DROP))
 
@@ -88,6 +98,10 @@
 #include "libbb.h"
 #include "common_bufsiz.h"
 #include "xregex.h"
+#if ENABLE_FEATURE_SED_FAST_IN_PLACE
+# include <sys/mman.h>
+# include <sys/syscall.h>
+#endif
 
 #if 0
 # define dbg(...) bb_error_msg(__VA_ARGS__)
@@ -100,15 +114,22 @@ enum {
 	OPT_in_place = 1 << 0,
 };
 
+/* Compiled regex and the literal every match of it contains */
+typedef struct sed_regex_s {
+	regex_t re;
+	char *literal;
+	int cflags;
+} sed_regex_t;
+
 /* Each sed command turns into one of these structures. */
 typedef struct sed_cmd_s {
 	/* Ordered by alignment requirements: currently 36 bytes on x86 */
 	struct sed_cmd_s *next; /* Next command (linked list, NULL terminated) */
 
 	/* address storage */
-	regex_t *beg_match;     /* sed -e '/match/cmd' */
-	regex_t *end_match;     /* sed -e '/match/,/end_match/cmd' */
-	regex_t *sub_match;     /* For 's/sub_match/string/' */
+	sed_regex_t *beg_match; /* sed -e '/match/cmd' */
+	sed_regex_t *end_match; /* sed -e '/match/,/end_match/cmd' */
+	sed_regex_t *sub_match; /* For 's/sub_match/string/' */
 	int beg_line;           /* 'sed 1p'   0 == apply commands to all lines */
 	int beg_line_orig;      /* copy of the above, needed for -i */
 	int end_line;           /* 'sed 1,3p' 0 == one line only. -1 = last line ($). -2-N = +N */
@@ -142,6 +163,7 @@ struct globals {
 	FILE *nonstdout;
 	char *outname, *hold_space;
 	smallint exitcode;
+	IF_FEATURE_SED_FAST_IN_PLACE(smallint in_place;)
 
 	/* list of input files */
 	int current_input_file, last_input_file;
@@ -149,7 +171,7 @@ struct globals {
 	FILE *current_fp;
 
 	regmatch_t regmatch[10];
-	regex_t *previous_regex_ptr;
+	sed_regex_t *previous_regex_ptr;
 
 	/* linked list of sed commands */
 	sed_cmd_t *sed_cmd_head, **sed_cmd_tail;
@@ -339,7 +361,25 @@ static int parse_regex_delim(const char *cmdstr, char **match, char **replace)
 /*
  * returns the index in the string just past where the address ends.
  */
-static int get_address(const char *my_str, int *linenum, regex_t ** regex)
+static sed_regex_t *sed_regcomp(const char *regex, int cflags)
+{
+	sed_regex_t *r = xzalloc(sizeof(*r));
+	xregcomp(&r->re, regex, cflags);
+	r->literal = regex_required_literal(regex, cflags);
+	r->cflags = cflags;
+	return r;
+}
+
+static int sed_regexec(const sed_regex_t *r, const char *string,
+		size_t nmatch, regmatch_t pmatch[], int eflags)
+{
+	/* Most lines don't contain the literal, skip regexec for them */
+	if (regex_literal_missing(string, r->literal, r->cflags))
+		return REG_NOMATCH;
+	return regexec(&r->re, string, nmatch, pmatch, eflags);
+}
+
+static int get_address(const char *my_str, int *linenum, sed_regex_t **regex)
 {
 	const char *pos = my_str;
 
@@ -360,8 +400,7 @@ static int get_address(const char *my_str, int *linenum, regex_t ** regex)
 		next = index_of_next_unescaped_regexp_delim(delimiter, ++pos);
 		if (next != 0) {
 			temp = copy_parsing_escapes(pos, next);
-			G.previous_regex_ptr = *regex = xzalloc(sizeof(regex_t));
-			xregcomp(*regex, temp, G.regex_type);
+			G.previous_regex_ptr = *regex = sed_regcomp(temp, G.regex_type);
 			free(temp);
 		} else {
 			*regex = G.previous_regex_ptr;
@@ -481,9 +520,8 @@ static int parse_subst_cmd(sed_cmd_t *sed_cmd, const char *substr)
 	/* compile the match string into a regex */
 	if (*match != '\0') {
 		/* If match is empty, we use last regex used at runtime */
-		sed_cmd->sub_match = xzalloc(sizeof(regex_t));
 		dbg("xregcomp('%s',%x)", match, cflags);
-		xregcomp(sed_cmd->sub_match, match, cflags);
+		sed_cmd->sub_match = sed_regcomp(match, cflags);
 		dbg("regcomp ok");
 	}
 	free(match);
@@ -790,7 +828,7 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 	bool altered = 0;
 	bool prev_match_empty = 1;
 	bool tried_at_eol = 0;
-	regex_t *current_regex;
+	sed_regex_t *current_regex;
 
 	current_regex = sed_cmd->sub_match;
 	/* Handle empty regex. */
@@ -803,7 +841,7 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 
 	/* Find the first match */
 	dbg("matching '%s'", line);
-	if (REG_NOMATCH == regexec(current_regex, line, 10, G.regmatch, 0)) {
+	if (REG_NOMATCH == sed_regexec(current_regex, line, 10, G.regmatch, 0)) {
 		dbg("no match");
 		return 0;
 	}
@@ -885,7 +923,7 @@ static int do_subst_command(sed_cmd_t *sed_cmd, char **line_p)
 		}
 
 //maybe (end ? REG_NOTBOL : 0) instead of unconditional REG_NOTBOL?
-	} while (regexec(current_regex, line, 10, G.regmatch, REG_NOTBOL) != REG_NOMATCH);
+	} while (sed_regexec(current_regex, line, 10, G.regmatch, REG_NOTBOL) != REG_NOMATCH);
 
 	/* Copy rest of string into output pipeline */
 	while (1) {
@@ -1067,12 +1105,182 @@ static char *get_next_line(char *gets_char, char *last_puts_char)
 
 static int beg_match(sed_cmd_t *sed_cmd, const char *pattern_space)
 {
-	int retval = sed_cmd->beg_match && !regexec(sed_cmd->beg_match, pattern_space, 0, NULL, 0);
+	int retval = sed_cmd->beg_match && !sed_regexec(sed_cmd->beg_match, pattern_space, 0, NULL, 0);
 	if (retval)
 		G.previous_regex_ptr = sed_cmd->beg_match;
 	return retval;
 }
 
+#if ENABLE_FEATURE_SED_FAST_IN_PLACE
+/*
+ * sed -i on big files: find stretches of whole lines on which no command
+ * can do anything, and copy them to the new file without reading them
+ * as lines. A command can't act on the next lines if it
+ * - is past its line number address (or range), or its range hasn't
+ *   come yet (this gives the line we must stop at),
+ * - needs a regex address to start, or is an unaddressed s///, and the
+ *   literal each match of that regex contains doesn't occur in them.
+ * Anything else (ranges in progress, $, '!', other unaddressed
+ * commands, case insensitive regexps) means no skipping.
+ */
+struct skip_lit {
+	const char *lit;
+	off_t pos;	/* first occurrence at or after the last search */
+};
+
+struct skip_state {
+	const char *map;
+	off_t size;
+	smallint disabled;
+	unsigned fails;	/* in a row: try less often */
+	unsigned wait;	/* lines until the next try */
+	unsigned nlits;
+	struct skip_lit *lits;
+};
+
+static off_t next_literal(struct skip_state *sk, const char *lit, off_t off)
+{
+	struct skip_lit *l;
+	const char *p;
+	unsigned i;
+
+	for (i = 0; i < sk->nlits; i++) {
+		if (sk->lits[i].lit == lit)
+			goto found;
+	}
+	sk->lits = xrealloc_vector(sk->lits, 3, sk->nlits);
+	sk->nlits++;
+	sk->lits[i].lit = lit;
+	sk->lits[i].pos = -1;
+ found:
+	l = &sk->lits[i];
+	if (l->pos < off) {
+		p = memmem(sk->map + off, sk->size - off, lit, strlen(lit));
+		l->pos = p ? p - sk->map : sk->size;
+	}
+	return l->pos;
+}
+
+/* How many bytes after 'off' can be copied as is. *lines gets the
+ * number of lines in them. The line before them (line linenum + 1)
+ * is 'line', it was read already and must be checked too.
+ */
+static off_t skippable(struct skip_state *sk, off_t off, int linenum,
+		const char *line, int *lines)
+{
+	sed_cmd_t *sed_cmd;
+	int bound = INT_MAX;
+	off_t cut = sk->size;
+	const char *p, *end, *last;
+	int n;
+
+	for (sed_cmd = G.sed_cmd_head; sed_cmd; sed_cmd = sed_cmd->next) {
+		const sed_regex_t *re = NULL;
+		off_t pos;
+
+		if (sed_cmd->cmd == '}' || sed_cmd->cmd == ':')
+			continue;
+		if (sed_cmd->in_match || sed_cmd->invert || sed_cmd->beg_line == -1)
+			return 0;
+		if (sed_cmd->beg_match) {
+			re = sed_cmd->beg_match;
+		} else if (sed_cmd->beg_line > 0) {
+			if (sed_cmd->beg_line > linenum + 1) {
+				if (bound > sed_cmd->beg_line)
+					bound = sed_cmd->beg_line;
+			} else if (sed_cmd->beg_line == linenum + 1
+			 || sed_cmd->end_line || sed_cmd->end_match
+			) {
+				/* it matches now (or range's start was skipped) */
+				return 0;
+			}
+			/* else: single line address in the past */
+		} else if (sed_cmd->beg_line == -2) {
+			/* range is over */
+		} else if (sed_cmd->cmd == 's' && !sed_cmd->end_line && !sed_cmd->end_match) {
+			re = sed_cmd->sub_match;
+			if (!re)
+				return 0; /* s//repl/ uses the last regex used */
+		} else {
+			return 0;
+		}
+		if (re) {
+			if (!re->literal || (re->cflags & REG_ICASE)
+			 || strstr(line, re->literal)
+			) {
+				return 0;
+			}
+			pos = next_literal(sk, re->literal, off);
+			if (cut > pos)
+				cut = pos;
+		}
+		if (sed_cmd->cmd == '{') {
+			/* nothing in this block can run either */
+			unsigned nest_cnt = 0;
+			do {
+				if (sed_cmd->cmd == '{')
+					nest_cnt++;
+				if (sed_cmd->cmd == '}')
+					nest_cnt--;
+				if (nest_cnt == 0)
+					break;
+				sed_cmd = sed_cmd->next;
+			} while (sed_cmd);
+			if (!sed_cmd)
+				return 0;
+		}
+	}
+	if (bound <= linenum + 2)
+		return 0;
+
+	/* Whole lines before the one with the literal, and before line 'bound' */
+	p = last = sk->map + off;
+	end = sk->map + cut;
+	n = 0;
+	while (linenum + 2 + n < bound) {
+		const char *eol = memchr(p, '\n', end - p);
+		if (!eol) {
+			/* last line of the file, without newline? */
+			if (cut == sk->size && p != end) {
+				last = end;
+				n++;
+			}
+			break;
+		}
+		last = p = eol + 1;
+		n++;
+	}
+	/* NUL ends a line too: let the usual code deal with such files */
+	if (memchr(sk->map + off, '\0', last - (sk->map + off))) {
+		sk->disabled = 1;
+		return 0;
+	}
+	*lines = n;
+	return last - (sk->map + off);
+}
+
+static void copy_as_is(int fd, const char *map, off_t off, off_t len)
+{
+	int out_fd = fileno(G.nonstdout);
+
+	fflush(G.nonstdout);
+# ifdef __NR_copy_file_range
+	/* in the kernel if possible, maybe even without copying data */
+	while (len > 0) {
+		long long in_off = off;
+		ssize_t n = syscall(__NR_copy_file_range, fd, &in_off, out_fd, NULL,
+				len > INT_MAX ? INT_MAX : (size_t)len, 0);
+		if (n <= 0)
+			break;
+		off += n;
+		len -= n;
+	}
+# endif
+	if (len > 0)
+		xwrite(out_fd, map + off, len);
+}
+#endif
+
 /* Process all the lines in all the files */
 
 static void process_files(void)
@@ -1083,18 +1291,75 @@ static void process_files(void)
 	char last_gets_char, next_gets_char;
 	sed_cmd_t *sed_cmd;
 	int substituted;
+#if ENABLE_FEATURE_SED_FAST_IN_PLACE
+	struct skip_state sk;
+	FILE *sk_fp = NULL;
+#endif
 
 	/* Prime the pump */
 	next_line = get_next_line(&next_gets_char, &last_puts_char);
 
+#if ENABLE_FEATURE_SED_FAST_IN_PLACE
+	/* -i processes files one at a time, the first one is open now */
+	memset(&sk, 0, sizeof(sk));
+	if (G.in_place && G.current_fp && G.current_fp != stdin) {
+		struct stat st;
+		int fd = fileno(G.current_fp);
+
+		if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)
+		 && st.st_size >= 64 * 1024 && st.st_size == (size_t)st.st_size
+		) {
+			void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			if (map != MAP_FAILED) {
+				sk.map = map;
+				sk.size = st.st_size;
+				sk_fp = G.current_fp;
+			}
+		}
+	}
+#endif
+
 	/* Go through every line in each file */
  again:
 	substituted = 0;
 
+#if ENABLE_FEATURE_SED_FAST_IN_PLACE
+	if (sk.map && !sk.disabled && next_line && G.current_fp == sk_fp
+	 && sk.wait-- == 0
+	) {
+		off_t off = ftello(sk_fp);
+		int lines;
+		off_t len = (off > 0 && off < sk.size)
+			? skippable(&sk, off, linenum, next_line, &lines)
+			: 0;
+
+		/* the regexps match every few lines? don't waste time here */
+		sk.wait = 0;
+		if (len == 0) {
+			sk.fails++;
+			sk.wait = (1 << MIN(sk.fails, 6)) - 1;
+		} else {
+			sk.fails = 0;
+			/* next_line is untouched too */
+			if (!G.be_quiet)
+				sed_puts(next_line, next_gets_char);
+			free(next_line);
+			if (!G.be_quiet) {
+				copy_as_is(fileno(sk_fp), sk.map, off, len);
+				last_puts_char = sk.map[off + len - 1];
+			}
+			linenum += 1 + lines;
+			if (fseeko(sk_fp, off + len, SEEK_SET) != 0)
+				bb_simple_perror_msg_and_die(G.input_file_list[G.current_input_file]);
+			next_line = get_next_line(&next_gets_char, &last_puts_char);
+		}
+	}
+#endif
+
 	/* Advance to next line.  Stop if out of lines. */
 	pattern_space = next_line;
 	if (!pattern_space)
-		return;
+		goto done;
 	last_gets_char = next_gets_char;
 
 	/* Read one line in advance so we can act on the last line,
@@ -1172,7 +1437,7 @@ static void process_files(void)
 						? !next_line : (sed_cmd->end_line <= linenum)
 					: !sed_cmd->end_match);
 			dbg("end2:%d", sed_cmd->end_match && old_matched
-					&& !regexec(sed_cmd->end_match,pattern_space, 0, NULL, 0));
+					&& !sed_regexec(sed_cmd->end_match,pattern_space, 0, NULL, 0));
 			sed_cmd->in_match = !(
 				/* has the ending line come, or is this a single address command? */
 				(sed_cmd->end_line
@@ -1183,7 +1448,7 @@ static void process_files(void)
 				)
 				/* or does this line matches our last address regex */
 				|| (sed_cmd->end_match && old_matched
-				     && (regexec(sed_cmd->end_match,
+				     && (sed_regexec(sed_cmd->end_match,
 						pattern_space, 0, NULL, 0) == 0)
 				)
 			);
@@ -1473,6 +1738,15 @@ static void process_files(void)
 	free(pattern_space);
 
 	goto again;
+
+ done:
+#if ENABLE_FEATURE_SED_FAST_IN_PLACE
+	if (sk.map) {
+		munmap((void*)sk.map, sk.size);
+		free(sk.lits);
+	}
+#endif
+	return;
 }
 
 /* It is possible to have a command line argument with embedded
@@ -1549,6 +1823,7 @@ int sed_main(int argc UNUSED_PARAM, char **argv)
 	argv += optind;
 	if (opt & OPT_in_place) { // -i
 		die_func = cleanup_outname;
+		IF_FEATURE_SED_FAST_IN_PLACE(G.in_place = 1;)
 	}
 	if (opt & (2|4))
 		G.regex_type |= REG_EXTENDED; // -r or -E
@@ -43,6 +43,35 @@
 //config:	Print the specified number of leading (-B) and/or trailing (-A)
 //config:	context surrounding our matching lines.
 //config:	Print the specified number of context lines (-C).
+//config:
+//config:config FEATURE_GREP_AHO_CORASICK
+//config:	bool "Fast matching of many fixed strings (-F)"
+//config:	default y
+//config:	depends on GREP || EGREP || FGREP
+//config:	help
+//config:	With -F and several patterns (e.g. -F -f LIST), build
+//config:	an Aho-Corasick automaton from them, so that each line
+//config:	is scanned once regardless of the number of patterns.
+//config:
+//config:config FEATURE_GREP_BLOCK_SCAN
+//config:	bool "Search for a plain string in large blocks"
+//config:	default y
+//config:	depends on (GREP || EGREP || FGREP) && !EXTRA_COMPAT
+//config:	help
+//config:	When the only pattern is a plain string and no options
+//config:	need to look at every line (-v, -i, -w, -x, context),
+//config:	search input in large blocks with memmem() and find
+//config:	line boundaries only around matches, instead of reading
+//config:	input line by line into malloced buffers.
+//config:
+//config:config FEATURE_GREP_PARALLEL
+//config:	bool "Support -j N (search files in parallel with -r)"
+//config:	default y
+//config:	depends on (GREP || EGREP || FGREP) && PLATFORM_POSIX && !NOMMU
+//config:	help
+//config:	With -r, search up to N files at once in child processes.
+//config:	Output of every file is kept together and in the same order
+//config:	as without -j.
 
 //applet:IF_GREP(APPLET(grep, BB_DIR_BIN, BB_SUID_DROP))
 //                APPLET_ODDNAME:name   main  location    suid_type     help
@@ -62,6 +91,7 @@
 //usage:	IF_EXTRA_COMPAT("z")
 //usage:       "] [-m N] "
 //usage:	IF_FEATURE_GREP_CONTEXT("[-A|B|C N] ")
+//usage:	IF_FEATURE_GREP_PARALLEL("[-j N] ")
 //usage:       "{ PATTERN | -e PATTERN... | -f FILE... } [FILE]..."
 //usage:#define grep_full_usage "\n\n"
 //usage:       "Search for PATTERN in FILEs (or stdin)\n"
@@ -77,6 +107,9 @@
 //usage:     "\n	-s	Suppress open and read errors"
 //usage:     "\n	-r	Recurse"
 //usage:     "\n	-R	Recurse and dereference symlinks"
+//usage:	IF_FEATURE_GREP_PARALLEL(
+//usage:     "\n	-j N	Search N files in parallel (0: one per CPU)"
+//usage:	)
 //usage:     "\n	-i	Ignore case"
 //usage:     "\n	-w	Match whole words only"
 //usage:     "\n	-x	Match whole lines only"
@@ -110,6 +143,7 @@
 	"lnqvscFiHhe:*f:*LorRm:+wx" \
 	IF_FEATURE_GREP_CONTEXT("A:+B:+C:+") \
 	"E" \
+	IF_FEATURE_GREP_PARALLEL("j:+") \
 	IF_EXTRA_COMPAT("z") \
 	"aI"
 /* ignored: -a "assume all files to be text" */
@@ -138,6 +172,7 @@ enum {
 	IF_FEATURE_GREP_CONTEXT(    OPTBIT_B ,) /* -B NUM: before-match context */
 	IF_FEATURE_GREP_CONTEXT(    OPTBIT_C ,) /* -C NUM: -A and -B combined */
 	OPTBIT_E, /* extended regexp */
+	IF_FEATURE_GREP_PARALLEL(   OPTBIT_j ,) /* -j NUM: parallel jobs */
 	IF_EXTRA_COMPAT(            OPTBIT_z ,) /* input is NUL terminated */
 	OPT_l = 1 << OPTBIT_l,
 	OPT_n = 1 << OPTBIT_n,
@@ -162,6 +197,7 @@ enum {
 	OPT_B = IF_FEATURE_GREP_CONTEXT(    (1 << OPTBIT_B)) + 0,
 	OPT_C = IF_FEATURE_GREP_CONTEXT(    (1 << OPTBIT_C)) + 0,
 	OPT_E = 1 << OPTBIT_E,
+	OPT_j = IF_FEATURE_GREP_PARALLEL(   (1 << OPTBIT_j)) + 0,
 	OPT_z = IF_EXTRA_COMPAT(            (1 << OPTBIT_z)) + 0,
 };
 
@@ -193,6 +229,19 @@ struct globals {
 	/* globals used internally */
 	llist_t *pattern_head;   /* growable list of patterns to match */
 	const char *cur_file;    /* the current file we are reading */
+#if ENABLE_FEATURE_GREP_AHO_CORASICK
+	struct fixed_automaton *fixed_ac; /* -F with many patterns */
+#endif
+#if ENABLE_FEATURE_GREP_BLOCK_SCAN
+	struct grep_list_data_t *block_gl; /* the only pattern, if block scan is possible */
+	char *block_buf;
+	size_t block_size;
+#endif
+#if ENABLE_FEATURE_GREP_PARALLEL
+	unsigned njobs;
+	unsigned job_first, job_count;
+	struct grep_job *jobs; /* ring of njobs, oldest at job_first */
+#endif
 } FIX_ALIASING;
 #define G (*(struct globals*)bb_common_bufsiz1)
 #define INIT_G() do { \
@@ -225,6 +274,14 @@ struct globals {
 #define last_line_printed (G.last_line_printed   )
 #define pattern_head      (G.pattern_head        )
 #define cur_file          (G.cur_file            )
+#define fixed_ac          (G.fixed_ac            )
+#define block_gl          (G.block_gl            )
+#define block_buf         (G.block_buf           )
+#define block_size        (G.block_size          )
+#define njobs             (G.njobs               )
+#define job_first         (G.job_first           )
+#define job_count         (G.job_count           )
+#define jobs              (G.jobs                )
 
 
 typedef struct grep_list_data_t {
@@ -233,6 +290,7 @@ typedef struct grep_list_data_t {
 #if !ENABLE_EXTRA_COMPAT
 	regex_t compiled_regex;
 	regmatch_t matched_range;
+	char *literal; /* lines without it can't match */
 #else
 	struct re_pattern_buffer compiled_regex;
 	struct re_registers matched_range;
@@ -299,6 +357,381 @@ static ssize_t FAST_FUNC bb_getline(char **line_ptr, size_t *line_alloc_len, FIL
 }
 #endif
 
+#if ENABLE_FEATURE_GREP_AHO_CORASICK
+/* Aho-Corasick automaton for -F with many patterns.
+ * States form a trie of the patterns. Transitions from the root
+ * are a plain table, the rest live in one open-addressed hash
+ * keyed by (state << 8 | char). On mismatch the scan follows
+ * the failure link, the longest proper suffix of the current state
+ * which is also a trie node. Dictionary links chain the states
+ * ending a pattern along the failure path, to enumerate every
+ * pattern occurring at a position.
+ */
+struct ac_state {
+	unsigned fail;
+	unsigned dict;  /* nearest state ending a pattern on the fail path, or 0 */
+	unsigned depth; /* == length of pattern ending here */
+	int pat;        /* first (in pattern_head order) pattern ending here, or -1 */
+};
+
+struct fixed_automaton {
+	struct ac_state *state;
+	unsigned nstates;
+	unsigned hmask;
+	uint32_t *hkey;  /* (state << 8 | char) + 1, 0: empty slot */
+	uint32_t *hnext;
+	grep_list_data_t **pattern;
+	unsigned char fold[256];
+	unsigned root[256];
+};
+
+/* Patterns longer than this in total fall back to strstr() */
+enum { AC_MAX_STATES = 1 << 24 };
+
+static unsigned ac_hash(uint32_t key)
+{
+	return (key * 0x9e3779b1) >> 8;
+}
+
+static unsigned ac_goto(struct fixed_automaton *ac, unsigned st, unsigned char c)
+{
+	uint32_t key;
+	unsigned i;
+
+	if (st == 0)
+		return ac->root[c];
+	key = ((st << 8) | c) + 1;
+	for (i = ac_hash(key);; i++) {
+		i &= ac->hmask;
+		if (ac->hkey[i] == key)
+			return ac->hnext[i];
+		if (ac->hkey[i] == 0)
+			return 0;
+	}
+}
+
+static void ac_set_goto(struct fixed_automaton *ac, unsigned st, unsigned char c, unsigned next)
+{
+	uint32_t key;
+	unsigned i;
+
+	if (st == 0) {
+		ac->root[c] = next;
+		return;
+	}
+	key = ((st << 8) | c) + 1;
+	for (i = ac_hash(key);; i++) {
+		i &= ac->hmask;
+		if (ac->hkey[i] == 0) {
+			ac->hkey[i] = key;
+			ac->hnext[i] = next;
+			return;
+		}
+	}
+}
+
+/* Returns NULL if patterns are not suitable */
+static struct fixed_automaton *ac_build(llist_t *patterns)
+{
+	struct fixed_automaton *ac;
+	struct ac_state *st;
+	unsigned *first_child, *next_sibling, *queue;
+	unsigned char *edge;
+	llist_t *l;
+	size_t total;
+	unsigned npat, n, i, head, tail;
+
+	npat = 0;
+	total = 1;
+	for (l = patterns; l; l = l->link) {
+		grep_list_data_t *gl = (grep_list_data_t *)l->data;
+		/* An empty pattern matches everywhere, strstr() handles it */
+		if (!gl->pattern[0])
+			return NULL;
+		total += strlen(gl->pattern);
+		if (total >= AC_MAX_STATES)
+			return NULL;
+		npat++;
+	}
+	/* strstr() is good enough for one pattern */
+	if (npat < 2)
+		return NULL;
+
+	ac = xzalloc(sizeof(*ac));
+	for (i = 0; i < 256; i++)
+		ac->fold[i] = (option_mask32 & OPT_i) ? tolower(i) : i;
+	ac->state = st = xzalloc(total * sizeof(st[0]));
+	ac->pattern = xmalloc(npat * sizeof(ac->pattern[0]));
+	/* Load factor <= 0.5 */
+	for (ac->hmask = 255; ac->hmask < 2 * total; ac->hmask = ac->hmask * 2 + 1)
+		continue;
+	ac->hkey = xzalloc((ac->hmask + 1) * sizeof(ac->hkey[0]));
+	ac->hnext = xmalloc((ac->hmask + 1) * sizeof(ac->hnext[0]));
+	/* Trie children lists, needed only while building */
+	first_child = xzalloc(total * sizeof(first_child[0]));
+	next_sibling = xzalloc(total * sizeof(next_sibling[0]));
+	edge = xzalloc(total);
+
+	/* Build the trie */
+	st[0].pat = -1;
+	n = 1;
+	for (l = patterns, i = 0; l; l = l->link, i++) {
+		grep_list_data_t *gl = (grep_list_data_t *)l->data;
+		const unsigned char *p = (unsigned char *)gl->pattern;
+		unsigned cur = 0;
+
+		ac->pattern[i] = gl;
+		for (; *p; p++) {
+			unsigned char c = ac->fold[*p];
+			unsigned next = ac_goto(ac, cur, c);
+			if (!next) {
+				next = n++;
+				st[next].depth = st[cur].depth + 1;
+				st[next].pat = -1;
+				ac_set_goto(ac, cur, c, next);
+				edge[next] = c;
+				next_sibling[next] = first_child[cur];
+				first_child[cur] = next;
+			}
+			cur = next;
+		}
+		/* Duplicate patterns: the first one wins, as with strstr loop */
+		if (st[cur].pat < 0)
+			st[cur].pat = i;
+	}
+	ac->nstates = n;
+
+	/* Breadth-first: failure links of shallower states are known */
+	queue = xmalloc(n * sizeof(queue[0]));
+	head = tail = 0;
+	for (i = first_child[0]; i; i = next_sibling[i])
+		queue[tail++] = i; /* fail = dict = 0 */
+	while (head < tail) {
+		unsigned cur = queue[head++];
+		unsigned child;
+
+		for (child = first_child[cur]; child; child = next_sibling[child]) {
+			unsigned f = st[cur].fail;
+			unsigned next;
+
+			while ((next = ac_goto(ac, f, edge[child])) == 0 && f != 0)
+				f = st[f].fail;
+			st[child].fail = next;
+			st[child].dict = (st[next].pat >= 0) ? next : st[next].dict;
+			queue[tail++] = child;
+		}
+	}
+	free(queue);
+	free(edge);
+	free(next_sibling);
+	free(first_child);
+	return ac;
+}
+
+/* Same semantics as the strstr() loop in grep_file(),
+ * including -x and -w, and for -o: the first pattern in list which
+ * matches is returned */
+static grep_list_data_t *ac_search(struct fixed_automaton *ac, const char *line)
+{
+	const struct ac_state *st = ac->state;
+	unsigned cur = 0;
+	int best = -1;
+	size_t i;
+
+	for (i = 0; line[i]; i++) {
+		unsigned char c = ac->fold[(unsigned char)line[i]];
+		unsigned o;
+
+		for (;;) {
+			unsigned next = ac_goto(ac, cur, c);
+			if (next || cur == 0) {
+				cur = next;
+				break;
+			}
+			cur = st[cur].fail;
+		}
+
+		o = (st[cur].pat >= 0) ? cur : st[cur].dict;
+		for (; o; o = st[o].dict) {
+			size_t start = i + 1 - st[o].depth;
+
+			if (option_mask32 & OPT_x) {
+				if (start != 0 || line[i + 1] != '\0')
+					continue;
+			} else
+			if (option_mask32 & OPT_w) {
+				char ch = start ? line[start - 1] : ' ';
+				if (isalnum(ch) || ch == '_')
+					continue;
+				ch = line[i + 1];
+				if (ch && (isalnum(ch) || ch == '_'))
+					continue;
+			}
+			if (!(option_mask32 & OPT_o))
+				return ac->pattern[st[o].pat];
+			if (best < 0 || st[o].pat < best)
+				best = st[o].pat;
+		}
+	}
+	return best >= 0 ? ac->pattern[best] : NULL;
+}
+#endif
+
+#if ENABLE_FEATURE_GREP_BLOCK_SCAN
+/* Fast path for a single plain string and no options which need
+ * to see every line. Input is read in large blocks and searched with
+ * memmem(), line boundaries are located only around matches.
+ * Output is the same as grep_file() would produce.
+ */
+enum { BLOCK_SCAN_SIZE = 128 * 1024 };
+
+/* xmalloc_fgetline() ends a line at '\n' and at NUL */
+static unsigned count_lines(const char *p, const char *end)
+{
+	const char *s;
+	unsigned cnt = 0;
+
+	for (s = p; (s = memchr(s, '\n', end - s)) != NULL; s++)
+		cnt++;
+	for (s = p; (s = memchr(s, '\0', end - s)) != NULL; s++)
+		cnt++;
+	return cnt;
+}
+
+static char *line_start(char *start, char *p)
+{
+	char *s = memrchr(start, '\n', p - start);
+	if (s)
+		start = s + 1;
+	s = memrchr(start, '\0', p - start);
+	return s ? s + 1 : start;
+}
+
+static char *line_end(char *p, char *end)
+{
+	char *s = memchr(p, '\n', end - p);
+	if (s)
+		end = s;
+	s = memchr(p, '\0', end - p);
+	return s ? s : end;
+}
+
+static int grep_file_block(int fd)
+{
+	grep_list_data_t *gl = block_gl;
+	const char *pattern = gl->pattern;
+	size_t plen = strlen(pattern);
+	size_t len = 0;
+	/* Lines are counted only for -n, print_line() needs linenum >= 1 */
+	int linenum = PRINT_LINE_NUM ? 0 : 1;
+	int nmatches = 0;
+	bool eof = 0;
+
+	if (!block_buf) {
+		block_size = BLOCK_SCAN_SIZE;
+		block_buf = xmalloc(block_size + 1);
+	}
+
+	while (!eof) {
+		char *buf, *pos, *end, *counted;
+		ssize_t n;
+
+		n = safe_read(fd, block_buf + len, block_size - len);
+		if (n <= 0) { /* read errors are EOF, as in xmalloc_fgetline */
+			eof = 1;
+			if (len == 0)
+				break;
+		}
+		len += (n > 0 ? n : 0);
+		buf = block_buf;
+		/* Process complete lines only. Last line may lack '\n' */
+		if (eof) {
+			end = buf + len;
+		} else {
+			end = memrchr(buf, '\n', len);
+			if (!end) {
+				/* Line longer than buffer */
+				if (len == block_size) {
+					block_size *= 2;
+					block_buf = xrealloc(block_buf, block_size + 1);
+				}
+				continue;
+			}
+			end++;
+		}
+
+		pos = counted = buf;
+		while (pos < end) {
+			char *hit, *line, *eol;
+
+			hit = memmem(pos, end - pos, pattern, plen);
+			if (!hit)
+				break;
+			line = line_start(pos, hit);
+			eol = line_end(hit, end); /* last line may lack '\n' */
+			pos = eol + 1;
+
+			nmatches++;
+			if (option_mask32 & (OPT_q|OPT_l|OPT_L)) {
+				if (BE_QUIET)
+					exit(EXIT_SUCCESS);
+				if (option_mask32 & OPT_l) {
+					puts(cur_file);
+					return 1;
+				}
+				return 0;
+			}
+			if (PRINT_LINE_NUM) {
+				linenum += count_lines(counted, line) + 1;
+				counted = (eol < end) ? eol + 1 : end;
+			}
+			if (PRINT_MATCH_COUNTS == 0) {
+				char *e = eol;
+				char old;
+#if ENABLE_PLATFORM_MINGW32
+				/* xmalloc_fgetline() strips CR of CRLF */
+				if (e > hit + plen && e[-1] == '\r')
+					e--;
+#endif
+				old = *e;
+				*e = '\0';
+				if (!(option_mask32 & OPT_o)) {
+					print_line(line, e - line, linenum, ':');
+				} else if (FGREP_FLAG) {
+					print_line(pattern, plen, linenum, ':');
+				} else {
+					/* Every non-overlapping match, like regexec loop */
+					do {
+						print_line(pattern, plen, linenum, ':');
+						hit = memmem(hit + plen, e - hit - plen, pattern, plen);
+					} while (hit);
+				}
+				*e = old;
+			}
+			if ((option_mask32 & OPT_m) && nmatches == max_matches)
+				goto done;
+		}
+		if (PRINT_LINE_NUM)
+			linenum += count_lines(counted, end);
+
+		/* Move incomplete last line to the start */
+		len -= end - buf;
+		memmove(buf, end, len);
+	}
+ done:
+	if (PRINT_MATCH_COUNTS) {
+		if (print_filename)
+			printf("%s:", cur_file);
+		printf("%d\n", nmatches);
+	}
+	if (option_mask32 & OPT_L) {
+		puts(cur_file);
+		return 1;
+	}
+	return nmatches != 0;
+}
+#endif
+
 static int grep_file(FILE *file)
 {
 	smalluint found;
@@ -321,6 +754,11 @@ static int grep_file(FILE *file)
 	enum { print_n_lines_after = 0 };
 #endif
 
+#if ENABLE_FEATURE_GREP_BLOCK_SCAN
+	if (block_gl)
+		return grep_file_block(fileno(file));
+#endif
+
 	while (
 #if !ENABLE_EXTRA_COMPAT
 		(line = xmalloc_fgetline(file)) != NULL
@@ -333,6 +771,12 @@ static int grep_file(FILE *file)
 
 		linenum++;
 		found = 0;
+#if ENABLE_FEATURE_GREP_AHO_CORASICK
+		if (fixed_ac) {
+			gl = ac_search(fixed_ac, line);
+			found = (gl != NULL);
+		} else
+#endif
 		while (pattern_ptr) {
 			gl = (grep_list_data_t *)pattern_ptr->data;
 			if (FGREP_FLAG) {
@@ -376,6 +820,7 @@ static int grep_file(FILE *file)
 					gl->flg_mem_allocated_compiled |= COMPILED;
 #if !ENABLE_EXTRA_COMPAT
 					xregcomp(&gl->compiled_regex, gl->pattern, reflags);
+					gl->literal = regex_required_literal(gl->pattern, reflags);
 #else
 					memset(&gl->compiled_regex, 0, sizeof(gl->compiled_regex));
 					gl->compiled_regex.translate = case_fold; /* for -i */
@@ -395,7 +840,8 @@ static int grep_file(FILE *file)
 //bb_error_msg("'%s' start_pos:%d line_len:%d", match_at, start_pos, line_len);
 				if (
 #if !ENABLE_EXTRA_COMPAT
-					regexec(&gl->compiled_regex, match_at, 1, &gl->matched_range, match_flg) == 0
+					!regex_literal_missing(match_at, gl->literal, reflags)
+					&& regexec(&gl->compiled_regex, match_at, 1, &gl->matched_range, match_flg) == 0
 #else
 					re_search(&gl->compiled_regex, match_at, line_len,
 							start_pos, /*range:*/ line_len,
@@ -654,7 +1100,150 @@ static void load_pattern_list(llist_t **lst, char *pattern)
 		llist_add_to(lst, new_grep_list_data(p, 0));
 }
 
-static int FAST_FUNC file_action_grep(struct recursive_state *state UNUSED_PARAM,
+#if ENABLE_FEATURE_GREP_PARALLEL
+/* -j N: files found by -r are searched by up to N child processes,
+ * each writing to its own pipe. Output of the oldest child is copied
+ * to stdout as it arrives, output of younger ones is buffered until
+ * they become the oldest. Children report the result in exit code:
+ * bit 0 set if nothing matched, bit 1 set on error.
+ */
+enum { GREP_MAX_JOBS = 64 };
+
+struct grep_job {
+	pid_t pid;
+	int fd;
+	char *buf;
+	size_t len, size;
+	IF_FEATURE_GREP_CONTEXT(smallint started;)
+};
+
+static void kill_jobs(void)
+{
+	unsigned i;
+	for (i = 0; i < job_count; i++)
+		kill(jobs[(job_first + i) % njobs].pid, SIGTERM);
+}
+
+static void flush_job(struct grep_job *job)
+{
+	if (job->len == 0)
+		return;
+#if ENABLE_FEATURE_GREP_CONTEXT
+	/* Children don't know about each other, "--" between
+	 * output of files is added here */
+	if (!job->started) {
+		job->started = 1;
+		if ((lines_before || lines_after) && did_print_line)
+			xwrite(STDOUT_FILENO, "--\n", 3);
+		did_print_line = 1;
+		last_line_printed = -1;
+	}
+#endif
+	xwrite(STDOUT_FILENO, job->buf, job->len);
+	job->len = 0;
+}
+
+static void read_job(struct grep_job *job, int oldest)
+{
+	ssize_t n;
+
+	if (job->size - job->len < 4096) {
+		job->size += 16 * 1024;
+		job->buf = xrealloc(job->buf, job->size);
+	}
+	n = safe_read(job->fd, job->buf + job->len, job->size - job->len);
+	if (n <= 0) {
+		close(job->fd);
+		job->fd = -1;
+		return;
+	}
+	job->len += n;
+	if (oldest)
+		flush_job(job);
+}
+
+/* Wait until no more than max jobs are running */
+static int wait_jobs(unsigned max)
+{
+	int matched = 0;
+
+	while (job_count > max) {
+		struct pollfd pfd[GREP_MAX_JOBS];
+		struct grep_job *pjob[GREP_MAX_JOBS];
+		struct grep_job *job = &jobs[job_first];
+		unsigned i, n;
+
+		if (job->fd < 0) {
+			/* Oldest job is done */
+			int status = wait_for_exitstatus(job->pid);
+			status = WIFEXITED(status) ? WEXITSTATUS(status) : 3;
+			if (status & 2)
+				open_errors = 1;
+			if (!(status & 1)) {
+				matched = 1;
+				if (BE_QUIET) {
+					job_count--;
+					job_first = (job_first + 1) % njobs;
+					kill_jobs();
+					exit(EXIT_SUCCESS);
+				}
+			}
+			job_first = (job_first + 1) % njobs;
+			if (--job_count != 0) {
+				/* Flush what the new oldest job had buffered */
+				flush_job(&jobs[job_first]);
+			}
+			continue;
+		}
+
+		n = 0;
+		for (i = 0; i < job_count; i++) {
+			job = &jobs[(job_first + i) % njobs];
+			if (job->fd >= 0) {
+				pfd[n].fd = job->fd;
+				pfd[n].events = POLLIN;
+				pjob[n++] = job;
+			}
+		}
+		if (safe_poll(pfd, n, -1) < 0)
+			bb_simple_perror_msg_and_die("poll");
+		for (i = 0; i < n; i++) {
+			if (pfd[i].revents)
+				read_job(pjob[i], pjob[i] == &jobs[job_first]);
+		}
+	}
+	return matched;
+}
+
+/* Returns 0 in the child which has to search the file */
+static int start_job(struct recursive_state *state)
+{
+	struct grep_job *job;
+	struct fd_pair pp;
+
+	*(int*)state->userData |= wait_jobs(njobs - 1);
+
+	job = &jobs[(job_first + job_count) % njobs];
+	xpiped_pair(pp);
+	fflush_all();
+	job->pid = xfork();
+	if (job->pid == 0) {
+		close(pp.rd);
+		xmove_fd(pp.wr, STDOUT_FILENO);
+		xfunc_error_retval = 3;
+		IF_FEATURE_GREP_CONTEXT(did_print_line = 0;)
+		return 0;
+	}
+	close(pp.wr);
+	job->fd = pp.rd;
+	job->len = 0;
+	IF_FEATURE_GREP_CONTEXT(job->started = 0;)
+	job_count++;
+	return 1;
+}
+#endif
+
+static int FAST_FUNC file_action_grep(struct recursive_state *state,
 		const char *filename,
 		struct stat *statbuf)
 {
@@ -675,6 +1264,22 @@ static int FAST_FUNC file_action_grep(struct recursive_state *state UNUSED_PARAM
 			return 1;
 	}
 
+#if ENABLE_FEATURE_GREP_PARALLEL
+	if (njobs > 1) {
+		if (start_job(state))
+			return 1;
+		/* Child */
+		file = fopen_for_read(filename);
+		if (file == NULL) {
+			if (!SUPPRESS_ERR_MSGS)
+				bb_simple_perror_msg(filename);
+			exit(3);
+		}
+		cur_file = filename;
+		exit(!grep_file(file));
+	}
+#endif
+
 	file = fopen_for_read(filename);
 	if (file == NULL) {
 		if (!SUPPRESS_ERR_MSGS)
@@ -701,6 +1306,10 @@ static int grep_dir(const char *dir)
 		/* dirAction= */ NULL,
 		/* userData= */ &matched
 	);
+#if ENABLE_FEATURE_GREP_PARALLEL
+	if (njobs > 1)
+		matched |= wait_jobs(0);
+#endif
 	return matched;
 }
 
@@ -728,6 +1337,7 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 		"color\0" Optional_argument "\xff",
 		&pattern_head, &fopt, &max_matches,
 		&lines_after, &lines_before, &Copt
+		IF_FEATURE_GREP_PARALLEL(, &njobs)
 		, NULL
 	);
 
@@ -754,9 +1364,21 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 #else
 	/* with auto sanity checks */
 	getopt32(argv, "^" OPTSTR_GREP "\0" "H-h:c-n:q-n:l-n:", // why trailing ":"?
-		&pattern_head, &fopt, &max_matches);
+		&pattern_head, &fopt, &max_matches
+		IF_FEATURE_GREP_PARALLEL(, &njobs)
+	);
 #endif
 	invert_search = ((option_mask32 & OPT_v) != 0); /* 0 | 1 */
+#if ENABLE_FEATURE_GREP_PARALLEL
+	if (option_mask32 & OPT_j) {
+		if (njobs == 0)
+			njobs = get_cpu_count();
+		if (njobs > GREP_MAX_JOBS)
+			njobs = GREP_MAX_JOBS;
+		if (njobs > 1)
+			jobs = xzalloc(njobs * sizeof(jobs[0]));
+	}
+#endif
 
 	{	/* convert char **argv to pattern_list */
 		llist_t *cur, *new = NULL;
@@ -817,6 +1439,25 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 		load_pattern_list(&pattern_head, *argv++);
 	}
 
+#if ENABLE_FEATURE_GREP_AHO_CORASICK
+	if (FGREP_FLAG)
+		fixed_ac = ac_build(pattern_head);
+#endif
+#if ENABLE_FEATURE_GREP_BLOCK_SCAN
+	if (!pattern_head->link
+	 && !(option_mask32 & (OPT_v|OPT_i|OPT_w|OPT_x|OPT_z))
+	 IF_FEATURE_GREP_CONTEXT(&& !lines_before && !lines_after)
+	) {
+		grep_list_data_t *gl = (grep_list_data_t *)pattern_head->data;
+		/* Regex without special chars is a plain string too */
+		if (gl->pattern[0]
+		 && (FGREP_FLAG || !strpbrk(gl->pattern, "\\.[]*^$+?(){}|"))
+		) {
+			block_gl = gl;
+		}
+	}
+#endif
+
 	/* argv[0..(argc-1)] should be names of file to grep through. If
 	 * there is more than one file to grep, we will print the filenames. */
 	if (argv[0] && argv[1])
@@ -868,11 +1509,22 @@ int grep_main(int argc UNUSED_PARAM, char **argv)
 			pattern_head = pattern_head->link;
 			if (gl->flg_mem_allocated_compiled & ALLOCATED)
 				free(gl->pattern);
-			if (gl->flg_mem_allocated_compiled & COMPILED)
+			if (gl->flg_mem_allocated_compiled & COMPILED) {
 				regfree(&gl->compiled_regex);
+				IF_NOT_EXTRA_COMPAT(free(gl->literal);)
+			}
 			free(gl);
 			free(pattern_head_ptr);
 		}
+#if ENABLE_FEATURE_GREP_AHO_CORASICK
+		if (fixed_ac) {
+			free(fixed_ac->state);
+			free(fixed_ac->hkey);
+			free(fixed_ac->hnext);
+			free(fixed_ac->pattern);
+			free(fixed_ac);
+		}
+#endif
 	}
 	/* 0 = success, 1 = failed, 2 = error */
 	if (open_errors)
@@ -423,6 +423,7 @@ typedef unsigned smalluint;
 #define HAVE_FDATASYNC 1
 #define HAVE_DPRINTF 1
 #define HAVE_MEMRCHR 1
+#define HAVE_MEMMEM 1
 #define HAVE_MKDTEMP 1
 #define HAVE_TTYNAME_R 1
 #define HAVE_PTSNAME_R 1
@@ -466,6 +467,7 @@ typedef unsigned smalluint;
 # undef HAVE_DPRINTF
 # undef HAVE_GETLINE
 # undef HAVE_MEMRCHR
+# undef HAVE_MEMMEM
 # undef HAVE_MKDTEMP
 # undef HAVE_SETBIT
 # undef HAVE_STPCPY
@@ -487,6 +489,7 @@ typedef unsigned smalluint;
 # undef HAVE_DPRINTF
 # undef HAVE_GETLINE
 # undef HAVE_MEMRCHR
+# undef HAVE_MEMMEM
 # undef HAVE_MKDTEMP
 # undef HAVE_SETBIT
 # undef HAVE_STPCPY
@@ -607,6 +610,12 @@ extern int dprintf(int fd, const char *format, ...);
 extern void *memrchr(const void *s, int c, size_t n) FAST_FUNC;
 #endif
 
+#ifndef HAVE_MEMMEM
+#include <stddef.h>
+extern void *memmem(const void *haystack, size_t haystacklen,
+		const void *needle, size_t needlelen) FAST_FUNC;
+#endif
+
 #ifndef HAVE_MKDTEMP
 extern char *mkdtemp(char *template) FAST_FUNC;
 #endif
@@ -675,6 +684,7 @@ extern int vasprintf(char **string_ptr, const char *format, va_list p) FAST_FUNC
 # include <stdio.h> /* for FILE */
 # include <sys/types.h> /* size_t */
 extern ssize_t getline(char **lineptr, size_t *n, FILE *stream) FAST_FUNC;
+extern ssize_t getdelim(char **lineptr, size_t *n, int delim, FILE *stream) FAST_FUNC;
 #endif
 
 #endif
@@ -17,6 +17,13 @@ PUSH_AND_SET_FUNCTION_VISIBILITY_TO_HIDDEN
 
 char* regcomp_or_errmsg(regex_t *preg, const char *regex, int cflags) FAST_FUNC;
 void xregcomp(regex_t *preg, const char *regex, int cflags) FAST_FUNC;
+char* regex_required_literal(const char *regex, int cflags) FAST_FUNC;
+
+/* Nonzero if string can't match a regex whose required literal is lit */
+static ALWAYS_INLINE int regex_literal_missing(const char *string, const char *lit, int cflags)
+{
+	return lit && !((cflags & REG_ICASE) ? strcasestr(string, lit) : strstr(string, lit));
+}
 
 POP_SAVED_FUNCTION_VISIBILITY
 
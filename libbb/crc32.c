@@ -52,10 +52,167 @@ uint32_t* FAST_FUNC global_crc32_new_table_le(void)
 	return global_crc32_table;
 }
 
+/*
+ * Slice-by-8: eight tables, [k][i] is the CRC of byte i followed by
+ * k zero bytes, let us fold eight input bytes with eight independent
+ * lookups instead of eight dependent ones. The tables only exist for
+ * the two polynomials above and are built on first use; callers keep
+ * passing their 256-entry table, which is also used for the tails.
+ */
+#if ENABLE_CRC32_FAST
+# define CRC32_SLICE_MIN 64
+
+/* crc_table[1] of the two standard tables */
+# define CRC32_LE_1 0x77073096
+# define CRC32_BE_1 0x04c11db7
+
+static uint32_t (*crc32_slices[2])[256];
+
+static uint32_t (*get_slices(const uint32_t *crc_table, int endian))[256]
+{
+	uint32_t (*t)[256];
+	unsigned i, k;
+
+	/* someone else's polynomial? */
+	if (crc_table[1] != (endian ? CRC32_BE_1 : CRC32_LE_1))
+		return NULL;
+	t = crc32_slices[endian];
+	if (t)
+		return t;
+
+	t = xmalloc(8 * sizeof(t[0]));
+	memcpy(t[0], crc_table, sizeof(t[0]));
+	for (k = 1; k < 8; k++) {
+		for (i = 0; i < 256; i++) {
+			uint32_t c = t[k - 1][i];
+			t[k][i] = endian
+				? (c << 8) ^ t[0][c >> 24]
+				: (c >> 8) ^ t[0][(uint8_t)c];
+		}
+	}
+	crc32_slices[endian] = t;
+	return t;
+}
+
+/*
+ * Carry-less multiply folding of the little-endian CRC (Intel's
+ * "Fast CRC Computation Using PCLMULQDQ" paper, the constants are the
+ * ones Linux uses in arch/x86/crypto/crc32-pclmul_asm.S). The tail
+ * shorter than 16 bytes is left to the table code.
+ */
+# if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#  include <cpuid.h>
+#  include <immintrin.h>
+#  define CRC32_PCLMUL 1
+#  define CRC32_PCLMUL_MIN 256
+
+/* 1: CPU has PCLMULQDQ and SSE4.1, -1: it does not, 0: not checked yet */
+static smallint crc32_pclmul;
+
+static int crc32_pclmul_available(void)
+{
+	if (!crc32_pclmul) {
+		unsigned eax, ebx, ecx, edx;
+
+		crc32_pclmul = -1;
+		if (__get_cpuid(1, &eax, &ebx, &ecx, &edx)
+		 && (ecx & bit_PCLMUL) && (ecx & bit_SSE4_1)
+		) {
+			crc32_pclmul = 1;
+		}
+	}
+	return crc32_pclmul > 0;
+}
+
+/* len is a multiple of 16, at least 64 */
+static uint32_t __attribute__((target("pclmul,sse4.1")))
+crc32_le_pclmul(uint32_t val, const uint8_t *p, unsigned len)
+{
+	const __m128i mask32 = _mm_setr_epi32(-1, 0, 0, 0);
+	__m128i k, x0, x1, x2, x3, t0, t1, t2, t3;
+
+	x0 = _mm_loadu_si128((const __m128i*)p);
+	x1 = _mm_loadu_si128((const __m128i*)(p + 16));
+	x2 = _mm_loadu_si128((const __m128i*)(p + 32));
+	x3 = _mm_loadu_si128((const __m128i*)(p + 48));
+	x0 = _mm_xor_si128(x0, _mm_cvtsi32_si128(val));
+	p += 64;
+	len -= 64;
+
+	/* fold 4x128 bits at a time */
+	k = _mm_set_epi64x(0x1c6e41596, 0x154442bd4);
+	while (len >= 64) {
+#  define FOLD(x, t, off) \
+		t = _mm_clmulepi64_si128(x, k, 0x11); \
+		x = _mm_clmulepi64_si128(x, k, 0x00); \
+		x = _mm_xor_si128(x, t); \
+		x = _mm_xor_si128(x, _mm_loadu_si128((const __m128i*)(p + off)));
+		FOLD(x0, t0, 0)
+		FOLD(x1, t1, 16)
+		FOLD(x2, t2, 32)
+		FOLD(x3, t3, 48)
+		p += 64;
+		len -= 64;
+	}
+
+	/* fold them into one 128-bit value */
+	k = _mm_set_epi64x(0x0ccaa009e, 0x1751997d0);
+#  define FOLD1(x, y) \
+		t0 = _mm_clmulepi64_si128(x, k, 0x11); \
+		x = _mm_clmulepi64_si128(x, k, 0x00); \
+		x = _mm_xor_si128(_mm_xor_si128(x, t0), y);
+	FOLD1(x0, x1)
+	FOLD1(x0, x2)
+	FOLD1(x0, x3)
+	while (len >= 16) {
+		FOLD1(x0, _mm_loadu_si128((const __m128i*)p))
+		p += 16;
+		len -= 16;
+	}
+#  undef FOLD1
+#  undef FOLD
+
+	/* 128 -> 64 bits, also appends 32 zero bits */
+	x0 = _mm_xor_si128(_mm_clmulepi64_si128(k, x0, 0x01), _mm_srli_si128(x0, 8));
+	/* 64 -> 32 */
+	k = _mm_set_epi64x(0, 0x163cd6124);
+	x1 = _mm_srli_si128(x0, 4);
+	x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k, 0x00);
+	x0 = _mm_xor_si128(x0, x1);
+	/* Barrett reduction to the final 32 bits */
+	k = _mm_set_epi64x(0x1f7011641, 0x1db710641);
+	x1 = x0;
+	x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k, 0x10);
+	x0 = _mm_clmulepi64_si128(_mm_and_si128(x0, mask32), k, 0x00);
+	x0 = _mm_xor_si128(x0, x1);
+	return _mm_extract_epi32(x0, 1);
+}
+# else
+#  define CRC32_PCLMUL 0
+# endif
+#endif /* CRC32_FAST */
+
 uint32_t FAST_FUNC crc32_block_endian1(uint32_t val, const void *buf, unsigned len, uint32_t *crc_table)
 {
 	const void *end = (uint8_t*)buf + len;
 
+#if ENABLE_CRC32_FAST
+	uint32_t (*t)[256];
+
+	if (len >= CRC32_SLICE_MIN && (t = get_slices(crc_table, 1)) != NULL) {
+		const uint8_t *p = buf;
+		const uint8_t *end8 = p + (len & ~7);
+
+		while (p != end8) {
+			uint32_t a = val ^ (((uint32_t)p[0] << 24) | (p[1] << 16) | (p[2] << 8) | p[3]);
+			val = t[7][a >> 24] ^ t[6][(uint8_t)(a >> 16)]
+				^ t[5][(uint8_t)(a >> 8)] ^ t[4][(uint8_t)a]
+				^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+			p += 8;
+		}
+		buf = p;
+	}
+#endif
 	while (buf != end) {
 		val = (val << 8) ^ crc_table[(val >> 24) ^ *(uint8_t*)buf];
 		buf = (uint8_t*)buf + 1;
@@ -67,9 +224,105 @@ uint32_t FAST_FUNC crc32_block_endian0(uint32_t val, const void *buf, unsigned l
 {
 	const void *end = (uint8_t*)buf + len;
 
+#if ENABLE_CRC32_FAST
+	uint32_t (*t)[256];
+
+# if CRC32_PCLMUL
+	if (len >= CRC32_PCLMUL_MIN
+	 && crc_table[1] == CRC32_LE_1
+	 && crc32_pclmul_available()
+	) {
+		val = crc32_le_pclmul(val, buf, len & ~15);
+		buf = (uint8_t*)buf + (len & ~15);
+	} else
+# endif
+	if (len >= CRC32_SLICE_MIN && (t = get_slices(crc_table, 0)) != NULL) {
+		const uint8_t *p = buf;
+		const uint8_t *end8 = p + (len & ~7);
+
+		while (p != end8) {
+			uint32_t a = val ^ (p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24));
+			val = t[7][(uint8_t)a] ^ t[6][(uint8_t)(a >> 8)]
+				^ t[5][(uint8_t)(a >> 16)] ^ t[4][a >> 24]
+				^ t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+			p += 8;
+		}
+		buf = p;
+	}
+#endif
 	while (buf != end) {
 		val = crc_table[(uint8_t)val ^ *(uint8_t*)buf] ^ (val >> 8);
 		buf = (uint8_t*)buf + 1;
 	}
 	return val;
 }
+
+#if ENABLE_UNIT_TEST
+/* "busybox unit" checks the fast CRC32 code against the plain table
+ * loop for all alignments and tail lengths, and shows their speed
+ */
+static uint32_t crc32_bytewise(uint32_t val, const uint8_t *p, unsigned len, uint32_t *crc_table, int endian)
+{
+	while (len--) {
+		if (endian)
+			val = (val << 8) ^ crc_table[(val >> 24) ^ *p++];
+		else
+			val = crc_table[(uint8_t)val ^ *p++] ^ (val >> 8);
+	}
+	return val;
+}
+
+static void crc32_bench(const char *name, const uint8_t *buf, unsigned len,
+		uint32_t *crc_table, int endian)
+{
+	enum { ROUNDS = 64 };
+	unsigned long long us;
+	uint32_t val = 0;
+	unsigned i;
+
+	us = monotonic_us();
+	for (i = 0; i < ROUNDS; i++) {
+		if (endian < 0)
+			val = crc32_bytewise(val, buf, len, crc_table, 0);
+		else
+			val = (endian ? crc32_block_endian1 : crc32_block_endian0)(val, buf, len, crc_table);
+	}
+	us = monotonic_us() - us;
+	bb_error_msg("%s: %llu MB/s (%08x)", name, (unsigned long long)len * ROUNDS / (us | 1), (unsigned)val);
+}
+
+BBUNIT_DEFINE_TEST(crc32)
+{
+	enum { LEN = 1024 * 1024 };
+	uint32_t *le = crc32_filltable(NULL, 0);
+	uint32_t *be = crc32_filltable(NULL, 1);
+	uint8_t *buf;
+	unsigned i, len;
+
+	BBUNIT_ASSERT_EQ(0xcbf43926, ~crc32_block_endian0(~0, "123456789", 9, le));
+	BBUNIT_ASSERT_EQ(0xfc891918, ~crc32_block_endian1(~0, "123456789", 9, be));
+
+	buf = xmalloc(LEN);
+	for (i = 0; i < LEN; i++)
+		buf[i] = i * 7 + (i >> 8);
+	for (i = 0; i < 16; i++) {
+		for (len = 0; len < 600; len += 1 + (len >> 4)) {
+			BBUNIT_ASSERT_EQ(crc32_bytewise(len, buf + i, len, le, 0),
+					crc32_block_endian0(len, buf + i, len, le));
+			BBUNIT_ASSERT_EQ(crc32_bytewise(len, buf + i, len, be, 1),
+					crc32_block_endian1(len, buf + i, len, be));
+		}
+	}
+	BBUNIT_ASSERT_EQ(crc32_bytewise(~0, buf, LEN, le, 0),
+			crc32_block_endian0(~0, buf, LEN, le));
+
+	crc32_bench("crc32 bytewise", buf, LEN, le, -1);
+	crc32_bench("crc32 le", buf, LEN, le, 0);
+	crc32_bench("crc32 be", buf, LEN, be, 1);
+
+	free(buf);
+	free(be);
+	free(le);
+	BBUNIT_ENDTEST;
+}
+#endif
@@ -749,6 +749,264 @@ static void FAST_FUNC sha512_process_block128(sha512_ctx_t *ctx)
 }
 #endif /* NEED_SHA512 */
 
+/*
+ * Hardware accelerated SHA1 and SHA256 block functions: x86 SHA
+ * extensions (SHA-NI) and ARMv8 crypto extensions. They are chosen
+ * at runtime by sha1_begin/sha256_begin if the CPU has them.
+ */
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+# define SHA_HW_X86   1
+# define SHA_HW_ARM64 0
+#elif defined(__GNUC__) && defined(__aarch64__) && defined(__linux__)
+# define SHA_HW_X86   0
+# define SHA_HW_ARM64 1
+#else
+# define SHA_HW_X86   0
+# define SHA_HW_ARM64 0
+#endif
+#define SHA1_HW   (ENABLE_SHA1_HWACCEL && (SHA_HW_X86 || SHA_HW_ARM64))
+#define SHA256_HW (ENABLE_SHA256_HWACCEL && (SHA_HW_X86 || SHA_HW_ARM64))
+
+#if SHA1_HW || SHA256_HW
+# if SHA_HW_X86
+#  include <cpuid.h>
+#  include <immintrin.h>
+#  ifndef bit_SHA
+#   define bit_SHA (1 << 29)
+#  endif
+#  define SHA_HW_TARGET __attribute__((target("sha,sse4.1")))
+# else
+#  include <sys/auxv.h>
+#  include <arm_neon.h>
+#  ifndef HWCAP_SHA1
+#   define HWCAP_SHA1 (1 << 5)
+#  endif
+#  ifndef HWCAP_SHA2
+#   define HWCAP_SHA2 (1 << 6)
+#  endif
+#  if defined(__clang__)
+#   define SHA_HW_TARGET __attribute__((target("crypto")))
+#  else
+#   define SHA_HW_TARGET __attribute__((target("+crypto")))
+#  endif
+# endif
+
+/* sha_K[] may have 64-bit elements, hw wants a plain uint32_t array */
+static uint32_t sha256_K32[64] ALIGNED(16);
+
+/* 1: CPU has the instructions, -1: it does not, 0: not checked yet */
+static smallint sha_hw;
+
+static int sha_hw_available(void)
+{
+	if (!sha_hw) {
+		sha_hw = -1;
+# if SHA_HW_X86
+		{
+			unsigned eax, ebx, ecx, edx;
+			if (__get_cpuid_max(0, NULL) >= 7) {
+				__cpuid(1, eax, ebx, ecx, edx);
+				if ((ecx & bit_SSSE3) && (ecx & bit_SSE4_1)) {
+					__cpuid_count(7, 0, eax, ebx, ecx, edx);
+					if (ebx & bit_SHA)
+						sha_hw = 1;
+				}
+			}
+		}
+# else
+		if ((getauxval(AT_HWCAP) & (HWCAP_SHA1 | HWCAP_SHA2)) == (HWCAP_SHA1 | HWCAP_SHA2))
+			sha_hw = 1;
+# endif
+# if SHA256_HW
+		if (sha_hw > 0) {
+			unsigned t;
+			for (t = 0; t < 64; t++)
+				sha256_K32[t] = NEED_SHA512 ? (sha_K[t] >> 32) : sha_K[t];
+		}
+# endif
+	}
+	return sha_hw > 0;
+}
+#endif
+
+#if SHA1_HW && SHA_HW_X86
+static void FAST_FUNC SHA_HW_TARGET sha1_process_block64_hw(sha1_ctx_t *ctx)
+{
+	/* Reverses byte order of the whole vector: SHA-NI wants W[0]
+	 * in the highest lane, and message words are big-endian */
+	const __m128i mask = _mm_set_epi64x(0x0001020304050607ULL, 0x08090a0b0c0d0e0fULL);
+	const __m128i *data = (const __m128i*)ctx->wbuffer;
+	__m128i abcd, abcd_save, e, e_save, prev;
+	__m128i M[4];
+
+	abcd = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)ctx->hash), 0x1b);
+	e = _mm_set_epi32(ctx->hash[4], 0, 0, 0);
+	abcd_save = abcd;
+	e_save = e;
+
+	M[0] = _mm_shuffle_epi8(_mm_loadu_si128(data + 0), mask);
+	M[1] = _mm_shuffle_epi8(_mm_loadu_si128(data + 1), mask);
+	M[2] = _mm_shuffle_epi8(_mm_loadu_si128(data + 2), mask);
+	M[3] = _mm_shuffle_epi8(_mm_loadu_si128(data + 3), mask);
+
+	/* Rounds 0-3 */
+	e = _mm_add_epi32(e, M[0]);
+	prev = abcd;
+	abcd = _mm_sha1rnds4_epu32(abcd, e, 0);
+
+	/* Rounds 4k..4k+3. sha1rnds4 needs its function number
+	 * as an immediate, hence no loop */
+#define R4(k) do { \
+	if (k >= 4) \
+		M[k & 3] = _mm_sha1msg2_epu32( \
+			_mm_xor_si128(_mm_sha1msg1_epu32(M[k & 3], M[(k + 1) & 3]), M[(k + 2) & 3]), \
+			M[(k + 3) & 3]); \
+	e = _mm_sha1nexte_epu32(prev, M[k & 3]); \
+	prev = abcd; \
+	abcd = _mm_sha1rnds4_epu32(abcd, e, (k) / 5); \
+} while (0)
+	R4(1); R4(2); R4(3); R4(4); R4(5); R4(6); R4(7); R4(8); R4(9);
+	R4(10); R4(11); R4(12); R4(13); R4(14); R4(15); R4(16); R4(17); R4(18); R4(19);
+#undef R4
+
+	e = _mm_sha1nexte_epu32(prev, e_save);
+	abcd = _mm_add_epi32(abcd, abcd_save);
+
+	_mm_storeu_si128((__m128i*)ctx->hash, _mm_shuffle_epi32(abcd, 0x1b));
+	ctx->hash[4] = _mm_extract_epi32(e, 3);
+}
+#endif
+
+#if SHA256_HW && SHA_HW_X86
+static void FAST_FUNC SHA_HW_TARGET sha256_process_block64_hw(sha256_ctx_t *ctx)
+{
+	/* Byte swap of every 32-bit word */
+	const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+	const __m128i *data = (const __m128i*)ctx->wbuffer;
+	const __m128i *K = (const __m128i*)sha256_K32;
+	__m128i state0, state1, abef_save, cdgh_save, msg, tmp;
+	__m128i M[4];
+	unsigned i;
+
+	/* SHA-NI keeps state as ABEF and CDGH */
+	tmp = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&ctx->hash[0]), 0xb1); /* CDAB */
+	state1 = _mm_shuffle_epi32(_mm_loadu_si128((const __m128i*)&ctx->hash[4]), 0x1b); /* EFGH */
+	state0 = _mm_alignr_epi8(tmp, state1, 8);    /* ABEF */
+	state1 = _mm_blend_epi16(state1, tmp, 0xf0); /* CDGH */
+	abef_save = state0;
+	cdgh_save = state1;
+
+	M[0] = _mm_shuffle_epi8(_mm_loadu_si128(data + 0), mask);
+	M[1] = _mm_shuffle_epi8(_mm_loadu_si128(data + 1), mask);
+	M[2] = _mm_shuffle_epi8(_mm_loadu_si128(data + 2), mask);
+	M[3] = _mm_shuffle_epi8(_mm_loadu_si128(data + 3), mask);
+
+	/* Rounds 4i..4i+3, computing W[] for rounds 4i+16..4i+19 meanwhile */
+	for (i = 0; i < 16; i++) {
+		__m128i *m = &M[i & 3];
+
+		msg = _mm_add_epi32(*m, _mm_load_si128(K + i));
+		state1 = _mm_sha256rnds2_epu32(state1, state0, msg);
+		if (i < 12) {
+			*m = _mm_sha256msg2_epu32(
+				_mm_add_epi32(_mm_sha256msg1_epu32(*m, M[(i + 1) & 3]),
+					_mm_alignr_epi8(M[(i + 3) & 3], M[(i + 2) & 3], 4)),
+				M[(i + 3) & 3]);
+		}
+		state0 = _mm_sha256rnds2_epu32(state0, state1, _mm_shuffle_epi32(msg, 0x0e));
+	}
+
+	state0 = _mm_add_epi32(state0, abef_save);
+	state1 = _mm_add_epi32(state1, cdgh_save);
+
+	tmp = _mm_shuffle_epi32(state0, 0x1b);       /* FEBA */
+	state1 = _mm_shuffle_epi32(state1, 0xb1);    /* DCHG */
+	state0 = _mm_blend_epi16(tmp, state1, 0xf0); /* DCBA */
+	state1 = _mm_alignr_epi8(state1, tmp, 8);    /* HGFE */
+	_mm_storeu_si128((__m128i*)&ctx->hash[0], state0);
+	_mm_storeu_si128((__m128i*)&ctx->hash[4], state1);
+}
+#endif
+
+#if SHA1_HW && SHA_HW_ARM64
+static void FAST_FUNC SHA_HW_TARGET sha1_process_block64_hw(sha1_ctx_t *ctx)
+{
+	static const uint32_t rconsts[] ALIGN4 = {
+		0x5A827999, 0x6ED9EBA1, 0x8F1BBCDC, 0xCA62C1D6
+	};
+	const uint8_t *data = ctx->wbuffer;
+	uint32x4_t abcd, abcd_save, tmp;
+	uint32x4_t M[4];
+	uint32_t e, e_next, e_save;
+	unsigned i;
+
+	abcd = vld1q_u32(ctx->hash);
+	e = ctx->hash[4];
+	abcd_save = abcd;
+	e_save = e;
+
+	/* Message words are big-endian */
+	M[0] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+	M[1] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+	M[2] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+	M[3] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+	/* Rounds 4i..4i+3 */
+	for (i = 0; i < 20; i++) {
+		uint32x4_t *m = &M[i & 3];
+
+		if (i >= 4)
+			*m = vsha1su1q_u32(vsha1su0q_u32(*m, M[(i + 1) & 3], M[(i + 2) & 3]), M[(i + 3) & 3]);
+		tmp = vaddq_u32(*m, vdupq_n_u32(rconsts[i / 5]));
+		e_next = vsha1h_u32(vgetq_lane_u32(abcd, 0));
+		if (i < 5)
+			abcd = vsha1cq_u32(abcd, e, tmp);
+		else if (i >= 10 && i < 15)
+			abcd = vsha1mq_u32(abcd, e, tmp);
+		else
+			abcd = vsha1pq_u32(abcd, e, tmp);
+		e = e_next;
+	}
+
+	vst1q_u32(ctx->hash, vaddq_u32(abcd, abcd_save));
+	ctx->hash[4] = e + e_save;
+}
+#endif
+
+#if SHA256_HW && SHA_HW_ARM64
+static void FAST_FUNC SHA_HW_TARGET sha256_process_block64_hw(sha256_ctx_t *ctx)
+{
+	const uint8_t *data = ctx->wbuffer;
+	uint32x4_t state0, state1, abcd, msg;
+	uint32x4_t M[4];
+	unsigned i;
+
+	state0 = vld1q_u32(&ctx->hash[0]);
+	state1 = vld1q_u32(&ctx->hash[4]);
+
+	/* Message words are big-endian */
+	M[0] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 0)));
+	M[1] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 16)));
+	M[2] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 32)));
+	M[3] = vreinterpretq_u32_u8(vrev32q_u8(vld1q_u8(data + 48)));
+
+	/* Rounds 4i..4i+3, computing W[] for rounds 4i+16..4i+19 meanwhile */
+	for (i = 0; i < 16; i++) {
+		uint32x4_t *m = &M[i & 3];
+
+		msg = vaddq_u32(*m, vld1q_u32(&sha256_K32[i * 4]));
+		if (i < 12)
+			*m = vsha256su1q_u32(vsha256su0q_u32(*m, M[(i + 1) & 3]), M[(i + 2) & 3], M[(i + 3) & 3]);
+		abcd = state0;
+		state0 = vsha256hq_u32(state0, state1, msg);
+		state1 = vsha256h2q_u32(state1, abcd, msg);
+	}
+
+	vst1q_u32(&ctx->hash[0], vaddq_u32(state0, vld1q_u32(&ctx->hash[0])));
+	vst1q_u32(&ctx->hash[4], vaddq_u32(state1, vld1q_u32(&ctx->hash[4])));
+}
+#endif
+
 void FAST_FUNC sha1_begin(sha1_ctx_t *ctx)
 {
 	ctx->hash[0] = 0x67452301;
@@ -758,6 +1016,10 @@ void FAST_FUNC sha1_begin(sha1_ctx_t *ctx)
 	ctx->hash[4] = 0xc3d2e1f0;
 	ctx->total64 = 0;
 	ctx->process_block = sha1_process_block64;
+#if SHA1_HW
+	if (sha_hw_available())
+		ctx->process_block = sha1_process_block64_hw;
+#endif
 }
 
 static const uint32_t init256[] ALIGN4 = {
@@ -799,6 +1061,10 @@ void FAST_FUNC sha256_begin(sha256_ctx_t *ctx)
 	memcpy(&ctx->total64, init256, sizeof(init256));
 	/*ctx->total64 = 0; - done by prepending two 32-bit zeros to init256 */
 	ctx->process_block = sha256_process_block64;
+#if SHA256_HW
+	if (sha_hw_available())
+		ctx->process_block = sha256_process_block64_hw;
+#endif
 }
 
 #if NEED_SHA512
@@ -856,7 +1122,14 @@ unsigned FAST_FUNC sha1_end(sha1_ctx_t *ctx, void *resbuf)
 	/* SHA stores total in BE, need to swap on LE arches: */
 	common64_end(ctx, /*swap_needed:*/ BB_LITTLE_ENDIAN);
 
-	hash_size = (ctx->process_block == sha1_process_block64) ? 5 : 8;
+	hash_size = 8;
+	if (ctx->process_block == sha1_process_block64
+#if SHA1_HW
+	 || ctx->process_block == sha1_process_block64_hw
+#endif
+	) {
+		hash_size = 5;
+	}
 	/* This way we do not impose alignment constraints on resbuf: */
 	if (BB_LITTLE_ENDIAN) {
 		unsigned i;
@@ -905,6 +1178,77 @@ unsigned FAST_FUNC sha512_end(sha512_ctx_t *ctx, void *resbuf)
 }
 #endif /* NEED_SHA512 */
 
+#if ENABLE_UNIT_TEST
+/* "busybox unit" checks all SHA1/SHA256 block functions usable on this
+ * CPU against known answers and each other, and shows their speed
+ */
+static void sha_bench(const char *name,
+		void FAST_FUNC (*begin)(md5sha_ctx_t *ctx),
+		void FAST_FUNC (*process_block)(md5sha_ctx_t *ctx),
+		char *hex)
+{
+	enum { LEN = 64 * 1024, ROUNDS = 256 };
+	md5sha_ctx_t ctx;
+	uint8_t res[SHA256_OUTSIZE];
+	unsigned long long total, us;
+	char *buf;
+	unsigned i;
+
+	buf = xmalloc(LEN);
+	for (i = 0; i < LEN; i++)
+		buf[i] = i * 7 + (i >> 8);
+	total = 0;
+	us = monotonic_us();
+	begin(&ctx);
+	ctx.process_block = process_block;
+	/* all lengths mod 64 */
+	for (i = 0; i < ROUNDS; i++) {
+		md5sha_hash(&ctx, buf + i, LEN - i);
+		total += LEN - i;
+	}
+	i = sha_end(&ctx, res);
+	us = monotonic_us() - us;
+	*bin2hex(hex, (char*)res, i) = '\0';
+	bb_error_msg("%s: %llu MB/s", name, total / (us | 1));
+	free(buf);
+}
+
+BBUNIT_DEFINE_TEST(sha1_sha256)
+{
+	md5sha_ctx_t ctx;
+	uint8_t res[SHA256_OUTSIZE];
+	char hex[SHA256_OUTSIZE * 2 + 1];
+	char hex2[SHA256_OUTSIZE * 2 + 1];
+
+	sha1_begin(&ctx);
+	md5sha_hash(&ctx, "abc", 3);
+	*bin2hex(hex, (char*)res, sha_end(&ctx, res)) = '\0';
+	BBUNIT_ASSERT_STREQ("a9993e364706816aba3e25717850c26c9cd0d89d", hex);
+
+	sha256_begin(&ctx);
+	md5sha_hash(&ctx, "abc", 3);
+	*bin2hex(hex, (char*)res, sha_end(&ctx, res)) = '\0';
+	BBUNIT_ASSERT_STREQ("ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad", hex);
+
+	sha_bench("sha1 generic", sha1_begin, sha1_process_block64, hex);
+# if SHA1_HW
+	if (sha_hw_available()) {
+		sha_bench("sha1 hw", sha1_begin, sha1_process_block64_hw, hex2);
+		BBUNIT_ASSERT_STREQ(hex, hex2);
+	}
+# endif
+	sha_bench("sha256 generic", sha256_begin, sha256_process_block64, hex);
+# if SHA256_HW
+	if (sha_hw_available()) {
+		sha_bench("sha256 hw", sha256_begin, sha256_process_block64_hw, hex2);
+		BBUNIT_ASSERT_STREQ(hex, hex2);
+	}
+# endif
+
+	BBUNIT_ENDTEST;
+}
+#endif /* ENABLE_UNIT_TEST */
+
 
 /*
  * The Keccak sponge function, designed by Guido Bertoni, Joan Daemen,
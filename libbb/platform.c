@@ -102,6 +102,28 @@ void* FAST_FUNC memrchr(const void *s, int c, size_t n)
 }
 #endif
 
+#ifndef HAVE_MEMMEM
+void* FAST_FUNC memmem(const void *haystack, size_t haystacklen,
+		const void *needle, size_t needlelen)
+{
+	const char *p = haystack;
+	const char *end = p + haystacklen;
+	const char first = *(const char *)needle;
+
+	if (needlelen == 0)
+		return (void *) haystack;
+	if (haystacklen < needlelen)
+		return NULL;
+	end -= needlelen - 1;
+	while ((p = memchr(p, first, end - p)) != NULL) {
+		if (memcmp(p, needle, needlelen) == 0)
+			return (void *) p;
+		p++;
+	}
+	return NULL;
+}
+#endif
+
 #ifndef HAVE_MKDTEMP
 /* This is now actually part of POSIX.1, but was only added in 2008 */
 char* FAST_FUNC mkdtemp(char *template)
@@ -179,7 +201,7 @@ char* FAST_FUNC stpncpy(char *p, const char *to_add, size_t n)
 #endif
 
 #ifndef HAVE_GETLINE
-ssize_t FAST_FUNC getline(char **lineptr, size_t *n, FILE *stream)
+ssize_t FAST_FUNC getdelim(char **lineptr, size_t *n, int delim, FILE *stream)
 {
 	int ch;
 	char *line = *lineptr;
@@ -195,7 +217,7 @@ ssize_t FAST_FUNC getline(char **lineptr, size_t *n, FILE *stream)
 			line = xrealloc(line, alloced);
 		}
 		line[len++] = ch;
-	} while (ch != '\n');
+	} while (ch != delim);
 
 	if (len == 0)
 		return -1;
@@ -205,6 +227,11 @@ ssize_t FAST_FUNC getline(char **lineptr, size_t *n, FILE *stream)
 	*n = alloced;
 	return len;
 }
+
+ssize_t FAST_FUNC getline(char **lineptr, size_t *n, FILE *stream)
+{
+	return getdelim(lineptr, n, '\n', stream);
+}
 #endif
 
 #ifndef HAVE_TTYNAME_R
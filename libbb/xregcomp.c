@@ -29,3 +29,163 @@ void FAST_FUNC xregcomp(regex_t *preg, const char *regex, int cflags)
 		bb_error_msg_and_die("bad regex '%s': %s", regex, errmsg);
 	}
 }
+
+/* Skip [...] bracket expression, p points past '['.
+ * Returns NULL if it is unterminated.
+ */
+static const char *skip_bracket(const char *p)
+{
+	if (*p == '^')
+		p++;
+	if (*p == ']')
+		p++;
+	while (*p != ']') {
+		if (*p == '\0')
+			return NULL;
+		if (*p == '[' && (p[1] == ':' || p[1] == '.' || p[1] == '=')) {
+			char c = p[1];
+			p += 2;
+			while (p[0] != c || p[1] != ']') {
+				if (*p == '\0')
+					return NULL;
+				p++;
+			}
+			p++;
+		}
+		p++;
+	}
+	return p + 1;
+}
+
+/* Skip group, p points past opening '(' or "\(".
+ * Returns NULL if it is unterminated.
+ */
+static const char *skip_group(const char *p, int ere)
+{
+	unsigned depth = 1;
+
+	while (depth != 0) {
+		char c = *p++;
+		if (c == '\0')
+			return NULL;
+		if (c == '[') {
+			p = skip_bracket(p);
+			if (!p)
+				return NULL;
+			continue;
+		}
+		if (c == '\\') {
+			c = *p++;
+			if (c == '\0')
+				return NULL;
+			if (ere)
+				continue;
+		} else if (!ere) {
+			continue;
+		}
+		if (c == '(')
+			depth++;
+		if (c == ')')
+			depth--;
+	}
+	return p;
+}
+
+/* Length of the quantifier at p, 0 if there is none */
+static int quantifier_len(const char *p, int ere)
+{
+	if (*p == '*')
+		return 1;
+	if (ere)
+		return (*p == '+' || *p == '?' || *p == '{');
+	if (p[0] == '\\' && (p[1] == '+' || p[1] == '?' || p[1] == '{'))
+		return 2;
+	return 0;
+}
+
+/* Find the longest string which every match of the regex contains.
+ * Lines without it can be rejected with strstr() before regexec().
+ * Only plain ASCII chars outside of groups, brackets and quantified
+ * atoms are considered. Returns NULL if the regex has
+ * a top level alternation or no such string.
+ */
+char* FAST_FUNC regex_required_literal(const char *regex, int cflags)
+{
+	int ere = cflags & REG_EXTENDED;
+	const char *p = regex;
+	char *cur, *best;
+	unsigned curlen, bestlen;
+
+	cur = xmalloc(strlen(regex) + 1);
+	best = NULL;
+	bestlen = curlen = 0;
+	for (;;) {
+		int lit = -1;
+		unsigned char c = *p++;
+
+		if (c == '\0')
+			goto end_run;
+		if (c == '\\') {
+			c = *p++;
+			if (c == '\0')
+				goto end_run;
+			if (strchr(".[]*^$\\", c) || (ere && strchr("+?(){}|", c))) {
+				lit = c;
+			} else if (!ere && c == '|') {
+				goto none;
+			} else if (!ere && c == '(') {
+				p = skip_group(p, ere);
+			} else if (!ere && c == '{') {
+				p = strstr(p, "\\}");
+				if (p)
+					p += 2;
+			}
+			/* else: back reference, \w, \< etc */
+		} else if (c == '[') {
+			p = skip_bracket(p);
+		} else if (ere && c == '(') {
+			p = skip_group(p, ere);
+		} else if (ere && c == '|') {
+			goto none;
+		} else if (ere && c == '{') {
+			p = strchr(p, '}');
+			if (p)
+				p++;
+		} else if (c < 0x80 && !strchr(".*^$", c) && !(ere && strchr("+?)", c))) {
+			lit = c;
+		}
+		if (!p)
+			goto none;
+		if (lit >= 0) {
+			/* Is it quantified? Only "+" keeps it required,
+			 * and only if no other quantifier follows: "a+?"
+			 */
+			const char *q = p;
+			int n;
+
+			while ((n = quantifier_len(q, ere)) != 0) {
+				if (q[n - 1] != '+')
+					goto end_run; /* optional, or may be repeated */
+				q += n;
+			}
+			cur[curlen++] = lit;
+			if (q == p)
+				continue;
+		}
+ end_run:
+		if (curlen > bestlen) {
+			free(best);
+			best = xstrndup(cur, curlen);
+			bestlen = curlen;
+		}
+		curlen = 0;
+		if (c == '\0')
+			break;
+	}
+	free(cur);
+	return best;
+ none:
+	free(cur);
+	free(best);
+	return NULL;
+}